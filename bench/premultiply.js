@@ -0,0 +1,35 @@
+#!/usr/bin/env node
+
+// Times Image premultiply/demultiply on tile and poster sized images.
+// usage: node bench/premultiply.js [iterations]
+
+var mapnik = require('../');
+
+var iterations = +process.argv[2] || 100;
+
+function semiTransparent(size) {
+    var im = new mapnik.Image(size, size);
+    im.background = new mapnik.Color(200, 100, 50, 128);
+    return im;
+}
+
+function time(name, size, fn) {
+    var im = semiTransparent(size);
+    var n = size >= 4096 ? Math.max(1, Math.floor(iterations / 20)) : iterations;
+    var start = Date.now();
+    for (var i = 0; i < n; ++i) {
+        fn(im);
+    }
+    var elapsed = Date.now() - start;
+    var mpx = size * size * n / 1e6;
+    console.log(name + ' ' + size + 'x' + size + ': ' +
+                (elapsed / n).toFixed(3) + 'ms/op, ' +
+                (mpx / (elapsed / 1000)).toFixed(1) + ' Mpx/s');
+}
+
+console.log('pixel kernels: ' + mapnik.supports.simd);
+[256, 512, 4096].forEach(function(size) {
+    // reset the flag each time, otherwise every call after the first is a no-op
+    time('premultiply', size, function(im) { im.premultiplied = false; im.premultiplySync(); });
+    time('demultiply ', size, function(im) { im.premultiplied = true; im.demultiplySync(); });
+});
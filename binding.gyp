@@ -23,6 +23,15 @@
           "src/mapnik_feature.cpp",
           "src/mapnik_image.cpp",
           "src/mapnik_image_view.cpp",
+          "src/mapnik_image_pool.cpp",
+          "src/pixel_kernels.cpp",
+          "src/png_strip_encoder.cpp",
+          "src/palette_lookup.cpp",
+          "src/image_profile.cpp",
+          "src/solid_tile_cache.cpp",
+          "src/image_resize.cpp",
+          "src/image_probe.cpp",
+          "src/image_stats.cpp",
           "src/mapnik_grid.cpp",
           "src/mapnik_grid_view.cpp",
           "src/mapnik_js_datasource.cpp",
@@ -0,0 +1,54 @@
+#ifndef __NODE_MAPNIK_ALPHA_COPY_H__
+#define __NODE_MAPNIK_ALPHA_COPY_H__
+
+// mapnik
+#include <mapnik/graphics.hpp>          // for image_32
+#include <mapnik/image_data.hpp>        // for image_data_32
+
+#include "pixel_kernels.hpp"
+
+// boost
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <cstring>
+
+// An image can be read by several encodes, composites and views at once,
+// so work that needs its pixels in the other alpha state converts a copy
+// instead of the image. Rows are converted as they are copied, while
+// they are still in cache.
+namespace node_mapnik {
+
+// image (an image_data_32 or an image_view of one) with premultiplied
+// alpha undone
+template <typename T>
+boost::shared_ptr<mapnik::image_data_32> demultiplied_copy(T const& image)
+{
+    boost::shared_ptr<mapnik::image_data_32> copy = boost::make_shared<mapnik::image_data_32>(image.width(), image.height());
+    for (unsigned y = 0; y < image.height(); ++y)
+    {
+        unsigned * row = copy->getRow(y);
+        std::memcpy(row, image.getRow(y), image.width() * 4);
+        demultiply(reinterpret_cast<unsigned char *>(row), image.width());
+    }
+    return copy;
+}
+
+// data with premultiplied alpha, premultiplying unless it already is, as
+// an image_32 so image filters can run on it
+inline boost::shared_ptr<mapnik::image_32> premultiplied_copy(mapnik::image_data_32 const& data, bool premultiplied)
+{
+    boost::shared_ptr<mapnik::image_32> copy = boost::make_shared<mapnik::image_32>(data.width(), data.height());
+    for (unsigned y = 0; y < data.height(); ++y)
+    {
+        unsigned * row = copy->data().getRow(y);
+        std::memcpy(row, data.getRow(y), data.width() * 4);
+        if (!premultiplied) premultiply(reinterpret_cast<unsigned char *>(row), data.width());
+    }
+    return copy;
+}
+
+}
+
+#endif
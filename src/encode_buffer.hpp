@@ -0,0 +1,215 @@
+#ifndef __NODE_MAPNIK_ENCODE_BUFFER_H__
+#define __NODE_MAPNIK_ENCODE_BUFFER_H__
+
+// node
+#include <node.h>
+#include <node_buffer.h>
+#include <node_version.h>
+
+// mapnik
+#include <mapnik/version.hpp>           // for MAPNIK_VERSION
+#if MAPNIK_VERSION < 200100
+#include <mapnik/image_util.hpp>        // for save_to_string
+#include <mapnik/palette.hpp>           // for rgba_palette
+#endif
+
+// boost
+#include <boost/noncopyable.hpp>
+
+// stl
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#if MAPNIK_VERSION < 200100
+// mapnik 2.0 only encodes to strings. These are found by the same
+// unqualified save_to_stream calls through argument dependent lookup.
+namespace mapnik {
+
+template <typename T>
+inline void save_to_stream(T const& image, std::ostream & stream, std::string const& type)
+{
+    std::string s = save_to_string(image, type);
+    stream.write(s.data(), s.size());
+}
+
+template <typename T>
+inline void save_to_stream(T const& image, std::ostream & stream, std::string const& type, rgba_palette const& palette)
+{
+    std::string s = save_to_string(image, type, palette);
+    stream.write(s.data(), s.size());
+}
+
+}
+#endif
+
+namespace node_mapnik {
+
+// streambuf over a malloc'd block that doubles when full. Seeking inside
+// what has been written is supported since some image writers (tiff) go
+// back to patch headers.
+class encode_streambuf : public std::streambuf, private boost::noncopyable
+{
+public:
+    explicit encode_streambuf(std::size_t capacity) :
+        data_(0),
+        capacity_(0),
+        high_(0)
+    {
+        reserve(std::max<std::size_t>(capacity, 1));
+    }
+
+    ~encode_streambuf()
+    {
+        std::free(data_);
+    }
+
+    // number of bytes written
+    std::size_t size() const
+    {
+        return std::max(high_, static_cast<std::size_t>(pptr() - pbase()));
+    }
+
+    char const* data() const { return data_; }
+
+    // gives up ownership of the bytes, which must be released with free().
+    // The block is shrunk to the written size first, which the allocator
+    // does in place.
+    char * release()
+    {
+        std::size_t used = size();
+        char * shrunk = static_cast<char *>(std::realloc(data_, std::max<std::size_t>(used, 1)));
+        char * released = shrunk ? shrunk : data_;
+        data_ = 0;
+        capacity_ = 0;
+        high_ = 0;
+        setp(0, 0);
+        return released;
+    }
+
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            return traits_type::not_eof(c);
+        }
+        grow(capacity_ + 1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    virtual std::streamsize xsputn(char const* s, std::streamsize n)
+    {
+        std::size_t pos = pptr() - pbase();
+        grow(pos + n);
+        std::memcpy(pptr(), s, n);
+        seek_to(pos + n);
+        return n;
+    }
+
+    virtual pos_type seekoff(off_type off,
+                             std::ios_base::seekdir dir,
+                             std::ios_base::openmode which)
+    {
+        if (!(which & std::ios_base::out)) return pos_type(off_type(-1));
+        off_type base = 0;
+        if (dir == std::ios_base::cur) base = pptr() - pbase();
+        else if (dir == std::ios_base::end) base = size();
+        off_type pos = base + off;
+        if (pos < 0 || static_cast<std::size_t>(pos) > size()) return pos_type(off_type(-1));
+        high_ = size();
+        seek_to(pos);
+        return pos_type(pos);
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+
+private:
+    void grow(std::size_t needed)
+    {
+        if (needed <= capacity_) return;
+        std::size_t capacity = std::max<std::size_t>(capacity_, 1);
+        while (capacity < needed) capacity *= 2;
+        reserve(capacity);
+    }
+
+    void reserve(std::size_t capacity)
+    {
+        std::size_t used = data_ ? size() : 0;
+        std::size_t pos = data_ ? pptr() - pbase() : 0;
+        char * data = static_cast<char *>(std::realloc(data_, capacity));
+        if (!data) throw std::bad_alloc();
+        data_ = data;
+        capacity_ = capacity;
+        high_ = used;
+        seek_to(pos);
+    }
+
+    void seek_to(std::size_t pos)
+    {
+        setp(data_, data_ + capacity_);
+        // pbump takes an int so move in steps for outputs over 2GB
+        while (pos > 0)
+        {
+            int step = static_cast<int>(std::min<std::size_t>(pos, 0x40000000));
+            pbump(step);
+            pos -= step;
+        }
+    }
+
+    char * data_;
+    std::size_t capacity_;
+    std::size_t high_;
+};
+
+// Output stream for encoders whose bytes are handed to a node Buffer
+// without being copied.
+class encode_buffer : private boost::noncopyable
+{
+public:
+    explicit encode_buffer(std::size_t capacity = 16384) :
+        buf_(capacity),
+        stream_(&buf_)
+    {
+        // surface allocation failures as exceptions rather than a bad stream
+        stream_.exceptions(std::ios_base::badbit);
+    }
+
+    std::ostream & stream() { return stream_; }
+    std::size_t size() const { return buf_.size(); }
+    char const* data() const { return buf_.data(); }
+
+    // wraps the bytes in a node Buffer that frees them when collected,
+    // leaving this buffer empty
+    v8::Handle<v8::Object> to_node_buffer()
+    {
+        std::size_t length = buf_.size();
+        #if NODE_VERSION_AT_LEAST(0, 11, 0)
+        return node::Buffer::New(buf_.release(), length, free_bytes, NULL);
+        #else
+        return node::Buffer::New(buf_.release(), length, free_bytes, NULL)->handle_;
+        #endif
+    }
+
+private:
+    static void free_bytes(char * data, void *)
+    {
+        std::free(data);
+    }
+
+    encode_streambuf buf_;
+    std::ostream stream_;
+};
+
+}
+
+#endif
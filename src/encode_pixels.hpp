@@ -0,0 +1,75 @@
+#ifndef __NODE_MAPNIK_ENCODE_PIXELS_H__
+#define __NODE_MAPNIK_ENCODE_PIXELS_H__
+
+// mapnik
+#include <mapnik/image_data.hpp>        // for image_data_32
+#include <mapnik/image_util.hpp>        // for save_to_stream
+
+#include "mapnik_palette.hpp"
+#include "encode_buffer.hpp"
+#include "palette_lookup.hpp"
+#include "png_strip_encoder.hpp"
+#include "solid_tile_cache.hpp"
+
+// stl
+#include <string>
+
+namespace node_mapnik {
+
+// only whole images go through the strip encoder, views are written by mapnik
+inline bool save_strips(mapnik::image_data_32 const& image, std::ostream & out, unsigned threads)
+{
+    save_to_png_strips(image, out, threads);
+    return true;
+}
+
+template <typename T>
+bool save_strips(T const&, std::ostream &, unsigned)
+{
+    return false;
+}
+
+// Writes straight alpha pixels (an image_data_32 or a view of one) in the
+// given format: png through the strip encoder when threads > 1 and there
+// is no palette, png8 through the palette lookup, anything else through
+// mapnik. Solid images are served from, and added to, the solid tile cache.
+template <typename T>
+void encode_pixels(T const& image,
+                   std::string const& format,
+                   palette_ptr const& palette,
+                   palette_lookup_ptr const& lookup,
+                   unsigned threads,
+                   encode_buffer & out)
+{
+    solid_tile_cache & cache = solid_tile_cache::instance();
+    std::string key;
+    if (solid_tile_key(image, format, lookup.get(), key) && cache.find(key, out.stream()))
+    {
+        return;
+    }
+    if (threads > 1 && !palette.get() && png_strips_support(format) &&
+        save_strips(image, out.stream(), threads))
+    {
+        // the strip encoder wrote it
+    }
+    else if (lookup.get() && png8_lookup_support(format))
+    {
+        save_to_png8(image, *lookup, out.stream());
+    }
+    else if (palette.get())
+    {
+        mapnik::save_to_stream(image, out.stream(), format, *palette);
+    }
+    else
+    {
+        mapnik::save_to_stream(image, out.stream(), format);
+    }
+    if (!key.empty())
+    {
+        cache.insert(key, out.data(), out.size());
+    }
+}
+
+}
+
+#endif
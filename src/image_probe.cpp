@@ -0,0 +1,228 @@
+#include "image_probe.hpp"
+
+// stl
+#include <algorithm>
+#include <cstring>
+
+namespace node_mapnik {
+
+namespace {
+
+inline unsigned be16(unsigned char const* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+inline unsigned be32(unsigned char const* p)
+{
+    return (static_cast<unsigned>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+inline unsigned le16(unsigned char const* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+inline unsigned le24(unsigned char const* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+inline unsigned le32(unsigned char const* p)
+{
+    return le24(p) | (static_cast<unsigned>(p[3]) << 24);
+}
+
+bool read_exact(probe_source & source, std::size_t offset, unsigned char * out, std::size_t size)
+{
+    return source.read(offset, out, size) == size;
+}
+
+bool probe_png(probe_source & source, image_probe_result & result)
+{
+    // signature, then IHDR: length, type, width, height, depth, color type
+    unsigned char ihdr[26];
+    if (!read_exact(source, 8, ihdr, sizeof(ihdr))) return false;
+    if (std::memcmp(ihdr + 4, "IHDR", 4) != 0) return false;
+    result.format = "png";
+    result.width = be32(ihdr + 8);
+    result.height = be32(ihdr + 12);
+    unsigned color_type = ihdr[17];
+    result.alpha = color_type == 4 || color_type == 6;
+    if (result.alpha) return true;
+    // tRNS, when present, comes before the first IDAT
+    std::size_t offset = 8 + 12 + be32(ihdr);
+    unsigned char chunk[8];
+    while (read_exact(source, offset, chunk, sizeof(chunk)))
+    {
+        if (std::memcmp(chunk + 4, "tRNS", 4) == 0)
+        {
+            result.alpha = true;
+            break;
+        }
+        if (std::memcmp(chunk + 4, "IDAT", 4) == 0 || std::memcmp(chunk + 4, "IEND", 4) == 0) break;
+        offset += 12 + static_cast<std::size_t>(be32(chunk));
+    }
+    return true;
+}
+
+bool probe_jpeg(probe_source & source, image_probe_result & result)
+{
+    std::size_t offset = 2;
+    unsigned char marker[9];
+    while (read_exact(source, offset, marker, 2))
+    {
+        if (marker[0] != 0xff) return false;
+        unsigned code = marker[1];
+        if (code == 0xff)
+        {
+            // fill byte before a marker
+            ++offset;
+            continue;
+        }
+        if (code == 0x01 || (code >= 0xd0 && code <= 0xd8))
+        {
+            // markers without a segment
+            offset += 2;
+            continue;
+        }
+        if (code == 0xd9 || code == 0xda) return false;  // no frame header before the scan
+        if (!read_exact(source, offset + 2, marker, sizeof(marker) - 2)) return false;
+        // start of frame, except DHT, JPG and DAC which share the range
+        if (code >= 0xc0 && code <= 0xcf && code != 0xc4 && code != 0xc8 && code != 0xcc)
+        {
+            result.format = "jpeg";
+            result.height = be16(marker + 3);
+            result.width = be16(marker + 5);
+            result.alpha = false;
+            return true;
+        }
+        offset += 2 + be16(marker);
+    }
+    return false;
+}
+
+bool probe_webp(probe_source & source, image_probe_result & result)
+{
+    // RIFF header, then the first chunk and enough of its payload
+    unsigned char header[30];
+    if (!read_exact(source, 0, header, sizeof(header))) return false;
+    if (std::memcmp(header + 8, "WEBP", 4) != 0) return false;
+    unsigned char const* data = header + 20;
+    if (std::memcmp(header + 12, "VP8X", 4) == 0)
+    {
+        result.alpha = (data[0] & 0x10) != 0;
+        result.width = le24(data + 4) + 1;
+        result.height = le24(data + 7) + 1;
+    }
+    else if (std::memcmp(header + 12, "VP8L", 4) == 0)
+    {
+        if (data[0] != 0x2f) return false;
+        unsigned bits = le32(data + 1);
+        result.width = (bits & 0x3fff) + 1;
+        result.height = ((bits >> 14) & 0x3fff) + 1;
+        result.alpha = ((bits >> 28) & 1) != 0;
+    }
+    else if (std::memcmp(header + 12, "VP8 ", 4) == 0)
+    {
+        if (data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a) return false;
+        result.width = le16(data + 6) & 0x3fff;
+        result.height = le16(data + 8) & 0x3fff;
+        result.alpha = false;
+    }
+    else
+    {
+        return false;
+    }
+    result.format = "webp";
+    return true;
+}
+
+bool probe_tiff(probe_source & source, image_probe_result & result, bool little_endian)
+{
+    unsigned (*u16)(unsigned char const*) = little_endian ? le16 : be16;
+    unsigned (*u32)(unsigned char const*) = little_endian ? le32 : be32;
+    unsigned char buf[12];
+    if (!read_exact(source, 4, buf, 4)) return false;
+    std::size_t offset = u32(buf);
+    if (!read_exact(source, offset, buf, 2)) return false;
+    unsigned count = u16(buf);
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned samples = 1;
+    unsigned photometric = 0;
+    bool extra_alpha = false;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (!read_exact(source, offset + 2 + i * 12, buf, 12)) return false;
+        unsigned tag = u16(buf);
+        unsigned type = u16(buf + 2);
+        // SHORT values sit in the first half of the value field
+        unsigned value = type == 3 ? u16(buf + 8) : u32(buf + 8);
+        switch (tag)
+        {
+        case 256: width = value; break;
+        case 257: height = value; break;
+        case 262: photometric = value; break;
+        case 277: samples = value; break;
+        // ExtraSamples: associated (1) or unassociated (2) alpha
+        case 338: extra_alpha = value == 1 || value == 2; break;
+        default: break;
+        }
+    }
+    if (width == 0 || height == 0) return false;
+    result.format = "tiff";
+    result.width = width;
+    result.height = height;
+    // rgb with a fourth sample is read as rgba even without ExtraSamples
+    result.alpha = extra_alpha || (photometric == 2 && samples >= 4);
+    return true;
+}
+
+}
+
+std::size_t buffer_probe_source::read(std::size_t offset, unsigned char * out, std::size_t size)
+{
+    if (offset >= size_) return 0;
+    size = std::min(size, size_ - offset);
+    std::memcpy(out, data_ + offset, size);
+    return size;
+}
+
+std::size_t file_probe_source::read(std::size_t offset, unsigned char * out, std::size_t size)
+{
+    file_.clear();
+    file_.seekg(offset, std::ios::beg);
+    if (!file_) return 0;
+    file_.read(reinterpret_cast<char *>(out), size);
+    return static_cast<std::size_t>(file_.gcount());
+}
+
+bool probe_image(probe_source & source, image_probe_result & result)
+{
+    unsigned char magic[12];
+    std::size_t size = source.read(0, magic, sizeof(magic));
+    if (size >= 8 && std::memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0)
+    {
+        return probe_png(source, result);
+    }
+    if (size >= 3 && magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff)
+    {
+        return probe_jpeg(source, result);
+    }
+    if (size >= 12 && std::memcmp(magic, "RIFF", 4) == 0 && std::memcmp(magic + 8, "WEBP", 4) == 0)
+    {
+        return probe_webp(source, result);
+    }
+    if (size >= 4 && std::memcmp(magic, "II*\0", 4) == 0)
+    {
+        return probe_tiff(source, result, true);
+    }
+    if (size >= 4 && std::memcmp(magic, "MM\0*", 4) == 0)
+    {
+        return probe_tiff(source, result, false);
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef __NODE_MAPNIK_IMAGE_PROBE_H__
+#define __NODE_MAPNIK_IMAGE_PROBE_H__
+
+// stl
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+namespace node_mapnik {
+
+// What can be told about an encoded image from its headers alone.
+struct image_probe_result
+{
+    // "png", "jpeg", "tiff" or "webp", as mapnik names its readers
+    std::string format;
+    unsigned width;
+    unsigned height;
+    // the encoding can carry transparency: an alpha channel, a png tRNS
+    // chunk, a tiff extra sample or the webp alpha flag
+    bool alpha;
+};
+
+// Random access to the encoded bytes, read returns how many of size bytes
+// at offset were available.
+class probe_source
+{
+public:
+    virtual ~probe_source() {}
+    virtual std::size_t read(std::size_t offset, unsigned char * out, std::size_t size) = 0;
+};
+
+class buffer_probe_source : public probe_source
+{
+public:
+    buffer_probe_source(char const* data, std::size_t size) :
+        data_(data),
+        size_(size) {}
+    std::size_t read(std::size_t offset, unsigned char * out, std::size_t size);
+
+private:
+    char const* data_;
+    std::size_t size_;
+};
+
+class file_probe_source : public probe_source
+{
+public:
+    explicit file_probe_source(std::string const& filename) :
+        file_(filename.c_str(), std::ios::in | std::ios::binary) {}
+    bool is_open() const { return file_.is_open(); }
+    std::size_t read(std::size_t offset, unsigned char * out, std::size_t size);
+
+private:
+    std::ifstream file_;
+};
+
+// Fills result from the signature and headers, reading only the bytes it
+// needs (the jpeg markers before the frame header, the png chunks before
+// the image data, the first tiff directory). False when the format is not
+// recognised or the headers are cut short.
+bool probe_image(probe_source & source, image_probe_result & result);
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "image_profile.hpp"
+#include "pixel_scan.hpp"
+
+// stl
+#include <algorithm>
+#include <cstdlib>
+
+namespace node_mapnik {
+
+namespace {
+
+// a channel predicted within this much counts as following its neighbours
+int const edge_tolerance = 16;
+
+// opaque images with at least this share of unpredictable pixels go to jpeg
+double const jpeg_edge_density = 0.25;
+
+inline int channel(unsigned p, unsigned shift)
+{
+    return static_cast<int>((p >> shift) & 0xff);
+}
+
+// whether any channel of the pixel is away from left + up - up_left
+inline bool is_edge(unsigned left, unsigned up, unsigned up_left, unsigned p)
+{
+    for (unsigned shift = 0; shift < 32; shift += 8)
+    {
+        int predicted = channel(left, shift) + channel(up, shift) - channel(up_left, shift);
+        if (std::abs(channel(p, shift) - predicted) > edge_tolerance) return true;
+    }
+    return false;
+}
+
+}
+
+image_profile profile_pixels(unsigned const* pixels,
+                             std::size_t stride,
+                             unsigned width,
+                             unsigned height)
+{
+    image_profile profile;
+    profile.solid = true;
+    profile.colors = 0;
+    profile.alpha = false;
+    profile.edge_density = 0.0;
+    if (width == 0 || height == 0) return profile;
+
+    color_counter colors(max_counted_colors);
+    unsigned const first = pixels[0];
+    std::size_t edges = 0;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned const* row = pixels + y * stride;
+        unsigned const* prev = y > 0 ? row - stride : 0;
+        for (unsigned x = 0; x < width; ++x)
+        {
+            unsigned p = row[x];
+            if (!colors.add(p)) continue;
+            if (p != first) profile.solid = false;
+            if ((p >> 24) != 0xff) profile.alpha = true;
+        }
+        // edges are counted against the plane through the neighbours, the
+        // first row and column only have one neighbour to follow
+        for (unsigned x = 0; x < width; ++x)
+        {
+            unsigned p = row[x];
+            unsigned left = x > 0 ? row[x - 1] : (prev ? prev[x] : p);
+            unsigned up = prev ? prev[x] : left;
+            unsigned up_left = (prev && x > 0) ? prev[x - 1] : (prev ? up : left);
+            if (is_edge(left, up, up_left, p)) ++edges;
+        }
+    }
+    profile.colors = colors.colors();
+    profile.edge_density = static_cast<double>(edges) / (static_cast<double>(width) * height);
+    return profile;
+}
+
+std::string choose_format(image_profile const& profile)
+{
+    if (profile.solid || profile.colors <= max_counted_colors) return "png8";
+    if (profile.alpha || profile.edge_density < jpeg_edge_density) return "png32";
+    return "jpeg";
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef __NODE_MAPNIK_IMAGE_PROFILE_H__
+#define __NODE_MAPNIK_IMAGE_PROFILE_H__
+
+#include "pixel_scan.hpp"
+
+// stl
+#include <cstddef>
+#include <string>
+
+namespace node_mapnik {
+
+// Cheap statistics gathered in one pass over straight alpha 32 bit pixels,
+// enough to pick an output format.
+struct image_profile
+{
+    // every pixel has the same value
+    bool solid;
+    // number of distinct pixel values, counting stops at max_counted_colors + 1
+    unsigned colors;
+    // some pixel is not fully opaque
+    bool alpha;
+    // share of pixels that differ from the plane through their left, upper
+    // and upper left neighbours: low for flat fills, gradients and
+    // antialiased line work, high for imagery and other textures
+    double edge_density;
+};
+
+unsigned const max_counted_colors = 256;
+
+image_profile profile_pixels(unsigned const* pixels,
+                             std::size_t stride,
+                             unsigned width,
+                             unsigned height);
+
+template <typename T>
+image_profile profile_image(T const& image)
+{
+    if (image.width() == 0 || image.height() == 0)
+    {
+        return profile_pixels(0, 0, 0, 0);
+    }
+    return profile_pixels(image.getRow(0), row_stride(image), image.width(), image.height());
+}
+
+// The cheapest format for the profile: png8 for up to 256 colors (solid
+// tiles included), png32 when there is alpha or the image is mostly flat
+// areas and edges, jpeg for opaque images that are mostly texture.
+std::string choose_format(image_profile const& profile);
+
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include "image_resize.hpp"
+#include "pixel_kernels.hpp"
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace node_mapnik {
+
+namespace {
+
+double const pi = 3.14159265358979323846;
+
+double triangle(double x)
+{
+    x = std::fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+// Keys cubic with a = -0.5
+double cubic(double x)
+{
+    double const a = -0.5;
+    x = std::fabs(x);
+    if (x < 1.0) return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+    if (x < 2.0) return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+    return 0.0;
+}
+
+double sinc(double x)
+{
+    if (x == 0.0) return 1.0;
+    x *= pi;
+    return std::sin(x) / x;
+}
+
+double lanczos3(double x)
+{
+    return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+// Weights of every output coordinate along one axis, padded to the same
+// number of taps so the kernels can run without per pixel bounds.
+struct axis_weights
+{
+    unsigned taps;
+    std::vector<int> starts;
+    std::vector<short> weights;
+};
+
+void compute_weights(unsigned src_size, unsigned dst_size, resize_filter filter, axis_weights & out)
+{
+    double (*kernel)(double) = triangle;
+    double support = 1.0;
+    if (filter == RESIZE_BICUBIC)
+    {
+        kernel = cubic;
+        support = 2.0;
+    }
+    else if (filter == RESIZE_LANCZOS)
+    {
+        kernel = lanczos3;
+        support = 3.0;
+    }
+    double scale = static_cast<double>(src_size) / dst_size;
+    // widen the filter when downscaling so every source pixel contributes
+    double filter_scale = std::max(scale, 1.0);
+    support *= filter_scale;
+
+    unsigned taps = std::min(src_size, static_cast<unsigned>(std::ceil(support)) * 2 + 1);
+    out.taps = taps;
+    out.starts.assign(dst_size, 0);
+    out.weights.assign(static_cast<std::size_t>(dst_size) * taps, 0);
+
+    std::vector<double> w(taps);
+    for (unsigned i = 0; i < dst_size; ++i)
+    {
+        double center = (i + 0.5) * scale;
+        int lo = std::max(0, static_cast<int>(std::floor(center - support + 0.5)));
+        int hi = std::min(static_cast<int>(src_size), static_cast<int>(std::floor(center + support + 0.5)));
+        hi = std::min(hi, lo + static_cast<int>(taps));
+        double total = 0.0;
+        for (int k = lo; k < hi; ++k)
+        {
+            w[k - lo] = kernel((k + 0.5 - center) / filter_scale);
+            total += w[k - lo];
+        }
+        if (hi <= lo || total == 0.0)
+        {
+            // nothing in reach, use the nearest pixel
+            lo = std::min(static_cast<int>(src_size) - 1, static_cast<int>(center));
+            hi = lo + 1;
+            w[0] = 1.0;
+            total = 1.0;
+        }
+        // keep the run inside the source by moving the start left and
+        // padding the weights at the front
+        int start = std::min(lo, static_cast<int>(src_size - taps));
+        short * dst_w = &out.weights[static_cast<std::size_t>(i) * taps];
+        int sum = 0;
+        int largest = lo - start;
+        for (int k = lo; k < hi; ++k)
+        {
+            short fixed = static_cast<short>(std::floor(w[k - lo] / total * (1 << 14) + 0.5));
+            dst_w[k - start] = fixed;
+            sum += fixed;
+            if (fixed > dst_w[largest]) largest = k - start;
+        }
+        // rounding must not change the overall brightness
+        dst_w[largest] = static_cast<short>(dst_w[largest] + (1 << 14) - sum);
+        out.starts[i] = start;
+    }
+}
+
+unsigned char * row_bytes(mapnik::image_data_32 & image, unsigned y)
+{
+    return reinterpret_cast<unsigned char *>(image.getRow(y));
+}
+
+unsigned char const* row_bytes(mapnik::image_data_32 const& image, unsigned y)
+{
+    return reinterpret_cast<unsigned char const*>(image.getRow(y));
+}
+
+// how many times size halves to reach target, 0 if it does not
+unsigned halvings(unsigned size, unsigned target)
+{
+    unsigned count = 0;
+    while (size > target && size % 2 == 0)
+    {
+        size /= 2;
+        ++count;
+    }
+    return size == target ? count : 0;
+}
+
+void downsample_box(mapnik::image_data_32 const& src, mapnik::image_data_32 & dst, unsigned steps, bool premultiply_src)
+{
+    // image_data_32 rows are contiguous, intermediate levels live in two
+    // scratch buffers that take turns
+    std::vector<unsigned char> scratch[2];
+    // source rows premultiplied on their way into the first level
+    std::vector<unsigned char> src_rows;
+    unsigned w = src.width();
+    unsigned h = src.height();
+    unsigned char const* from = row_bytes(src, 0);
+    for (unsigned step = 0; step < steps; ++step)
+    {
+        unsigned half_w = w / 2;
+        unsigned half_h = h / 2;
+        unsigned char * to = row_bytes(dst, 0);
+        if (step + 1 < steps)
+        {
+            scratch[step % 2].resize(static_cast<std::size_t>(half_w) * half_h * 4);
+            to = &scratch[step % 2][0];
+        }
+        std::size_t stride = static_cast<std::size_t>(w) * 4;
+        for (unsigned y = 0; y < half_h; ++y)
+        {
+            unsigned char const* upper = from + 2 * y * stride;
+            unsigned char const* lower = upper + stride;
+            if (step == 0 && premultiply_src)
+            {
+                src_rows.assign(upper, lower + stride);
+                premultiply(&src_rows[0], w * 2);
+                upper = &src_rows[0];
+                lower = upper + stride;
+            }
+            downsample_2x(to + static_cast<std::size_t>(y) * half_w * 4,
+                          upper,
+                          lower,
+                          half_w);
+        }
+        from = to;
+        w = half_w;
+        h = half_h;
+    }
+}
+
+}
+
+bool parse_resize_filter(std::string const& name, resize_filter & filter)
+{
+    if (name == "bilinear") filter = RESIZE_BILINEAR;
+    else if (name == "bicubic") filter = RESIZE_BICUBIC;
+    else if (name == "lanczos") filter = RESIZE_LANCZOS;
+    else return false;
+    return true;
+}
+
+void resize_image(mapnik::image_data_32 const& src,
+                  mapnik::image_data_32 & dst,
+                  resize_filter filter,
+                  bool premultiplied,
+                  bool premultiply_src)
+{
+    unsigned src_w = src.width();
+    unsigned src_h = src.height();
+    unsigned dst_w = dst.width();
+    unsigned dst_h = dst.height();
+    if (src_w == 0 || src_h == 0 || dst_w == 0 || dst_h == 0) return;
+
+    if (filter == RESIZE_BILINEAR)
+    {
+        unsigned steps = halvings(src_w, dst_w);
+        if (steps > 0 && steps == halvings(src_h, dst_h))
+        {
+            downsample_box(src, dst, steps, premultiply_src);
+            return;
+        }
+    }
+
+    axis_weights horizontal;
+    axis_weights vertical;
+    compute_weights(src_w, dst_w, filter, horizontal);
+    compute_weights(src_h, dst_h, filter, vertical);
+
+    // rows first into an intermediate of dst_w x src_h
+    mapnik::image_data_32 rows(dst_w, src_h);
+    std::vector<unsigned char> src_row;
+    for (unsigned y = 0; y < src_h; ++y)
+    {
+        unsigned char const* from = row_bytes(src, y);
+        if (premultiply_src)
+        {
+            src_row.assign(from, from + static_cast<std::size_t>(src_w) * 4);
+            premultiply(&src_row[0], src_w);
+            from = &src_row[0];
+        }
+        convolve_row(row_bytes(rows, y), from, dst_w,
+                     &horizontal.starts[0], &horizontal.weights[0], horizontal.taps);
+    }
+    std::vector<unsigned char const*> taps(vertical.taps);
+    for (unsigned y = 0; y < dst_h; ++y)
+    {
+        for (unsigned t = 0; t < vertical.taps; ++t)
+        {
+            taps[t] = row_bytes(rows, vertical.starts[y] + t);
+        }
+        convolve_rows(row_bytes(dst, y), &taps[0],
+                      &vertical.weights[static_cast<std::size_t>(y) * vertical.taps],
+                      vertical.taps, dst_w);
+    }
+
+    if (premultiplied && filter != RESIZE_BILINEAR)
+    {
+        for (unsigned y = 0; y < dst_h; ++y)
+        {
+            unsigned char * p = row_bytes(dst, y);
+            for (unsigned x = 0; x < dst_w; ++x, p += 4)
+            {
+                p[0] = std::min(p[0], p[3]);
+                p[1] = std::min(p[1], p[3]);
+                p[2] = std::min(p[2], p[3]);
+            }
+        }
+    }
+}
+
+}
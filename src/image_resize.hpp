@@ -0,0 +1,36 @@
+#ifndef __NODE_MAPNIK_IMAGE_RESIZE_H__
+#define __NODE_MAPNIK_IMAGE_RESIZE_H__
+
+// mapnik
+#include <mapnik/image_data.hpp>        // for image_data_32
+
+// stl
+#include <string>
+
+namespace node_mapnik {
+
+enum resize_filter
+{
+    RESIZE_BILINEAR = 0,
+    RESIZE_BICUBIC,
+    RESIZE_LANCZOS
+};
+
+// "bilinear", "bicubic" or "lanczos"
+bool parse_resize_filter(std::string const& name, resize_filter & filter);
+
+// Resamples src to the size of dst with a separable filter: rows first,
+// then columns. Bilinear downscales by a power of two go through repeated
+// 2:1 box filtering instead. When `premultiplied` is set the color
+// channels are kept at or below alpha, which filters with negative lobes
+// would otherwise break. `premultiply_src` premultiplies straight alpha
+// source rows as they are read, src itself is never modified.
+void resize_image(mapnik::image_data_32 const& src,
+                  mapnik::image_data_32 & dst,
+                  resize_filter filter,
+                  bool premultiplied,
+                  bool premultiply_src = false);
+
+}
+
+#endif
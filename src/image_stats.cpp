@@ -0,0 +1,99 @@
+#include "image_stats.hpp"
+#include "pixel_kernels.hpp"
+
+// stl
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace node_mapnik {
+
+void stats_pixels(unsigned const* pixels,
+                  std::size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  bool premultiplied,
+                  unsigned max_colors,
+                  image_stats & stats)
+{
+    std::memset(stats.histogram, 0, sizeof(stats.histogram));
+    stats.pixels = static_cast<std::size_t>(width) * height;
+    stats.colors = 0;
+    stats.colors_capped = false;
+    if (stats.pixels == 0) return;
+
+    // even and odd pixels count into separate tables so that runs of one
+    // value do not serialize on incrementing the same counter
+    std::vector<std::size_t> counts(2 * 4 * 256, 0);
+    std::size_t * even = &counts[0];
+    std::size_t * odd = &counts[4 * 256];
+    color_counter colors(max_colors);
+    std::vector<unsigned> straight(premultiplied ? width : 0);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned const* row = pixels + y * stride;
+        if (premultiplied)
+        {
+            std::copy(row, row + width, straight.begin());
+            demultiply(reinterpret_cast<unsigned char *>(&straight[0]), width);
+            row = &straight[0];
+        }
+        unsigned x = 0;
+        for (; x + 2 <= width; x += 2)
+        {
+            unsigned p = row[x];
+            unsigned q = row[x + 1];
+            ++even[p & 0xff];
+            ++even[256 + ((p >> 8) & 0xff)];
+            ++even[512 + ((p >> 16) & 0xff)];
+            ++even[768 + (p >> 24)];
+            ++odd[q & 0xff];
+            ++odd[256 + ((q >> 8) & 0xff)];
+            ++odd[512 + ((q >> 16) & 0xff)];
+            ++odd[768 + (q >> 24)];
+        }
+        if (x < width)
+        {
+            unsigned p = row[x];
+            ++even[p & 0xff];
+            ++even[256 + ((p >> 8) & 0xff)];
+            ++even[512 + ((p >> 16) & 0xff)];
+            ++even[768 + (p >> 24)];
+        }
+        for (x = 0; x < width && !colors.capped(); ++x)
+        {
+            colors.add(row[x]);
+        }
+    }
+    for (unsigned c = 0; c < 4; ++c)
+    {
+        for (unsigned v = 0; v < 256; ++v)
+        {
+            stats.histogram[c][v] = even[c * 256 + v] + odd[c * 256 + v];
+        }
+    }
+    stats.colors_capped = colors.capped();
+    stats.colors = stats.colors_capped ? max_colors : colors.colors();
+}
+
+channel_summary summarize_channel(image_stats const& stats, unsigned c)
+{
+    channel_summary summary;
+    summary.min = 0;
+    summary.max = 0;
+    summary.mean = 0.0;
+    if (stats.pixels == 0) return summary;
+    std::size_t const* histogram = stats.histogram[c];
+    unsigned v = 0;
+    while (histogram[v] == 0) ++v;
+    summary.min = v;
+    v = 255;
+    while (histogram[v] == 0) --v;
+    summary.max = v;
+    double sum = 0.0;
+    for (v = 0; v < 256; ++v) sum += static_cast<double>(v) * histogram[v];
+    summary.mean = sum / stats.pixels;
+    return summary;
+}
+
+}
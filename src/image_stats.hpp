@@ -0,0 +1,63 @@
+#ifndef __NODE_MAPNIK_IMAGE_STATS_H__
+#define __NODE_MAPNIK_IMAGE_STATS_H__
+
+#include "pixel_scan.hpp"
+
+// stl
+#include <cstddef>
+
+namespace node_mapnik {
+
+// Per channel histograms and color counts of raw 32 bit pixels, gathered
+// in one pass. Everything else (min, max, mean, fully transparent and
+// fully opaque pixels) follows from the histograms.
+struct image_stats
+{
+    // histogram[c][v]: pixels whose channel c (r, g, b, a) has value v
+    std::size_t histogram[4][256];
+    std::size_t pixels;
+    // distinct pixel values, at most max_colors
+    unsigned colors;
+    // there are more than max_colors distinct values
+    bool colors_capped;
+};
+
+// largest max_colors stats accepts
+unsigned const max_stats_colors = 65536;
+
+struct channel_summary
+{
+    unsigned min;
+    unsigned max;
+    double mean;
+};
+
+// Premultiplied pixels are demultiplied a row at a time into scratch, so
+// the stats always describe straight alpha colors and the pixels are only
+// read.
+void stats_pixels(unsigned const* pixels,
+                  std::size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  bool premultiplied,
+                  unsigned max_colors,
+                  image_stats & stats);
+
+template <typename T>
+void stats_image(T const& image, bool premultiplied, unsigned max_colors, image_stats & stats)
+{
+    if (image.width() == 0 || image.height() == 0)
+    {
+        stats_pixels(0, 0, 0, 0, premultiplied, max_colors, stats);
+        return;
+    }
+    stats_pixels(image.getRow(0), row_stride(image), image.width(), image.height(),
+                 premultiplied, max_colors, stats);
+}
+
+// min, max and mean of channel c, all 0 for an empty image
+channel_summary summarize_channel(image_stats const& stats, unsigned c);
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 
 // mapnik
 #include <mapnik/feature.hpp>           // for feature_impl, etc
+#include <mapnik/feature_factory.hpp>   // for feature_factory
 #include <mapnik/grid/grid.hpp>         // for grid
 #include <mapnik/version.hpp>           // for MAPNIK_VERSION
 
@@ -14,16 +15,91 @@
 // boost
 #include <boost/foreach.hpp>
 #include "boost/ptr_container/ptr_vector.hpp"  // for ptr_vector
+#include <boost/scoped_ptr.hpp>
 
 // stl
 #include <cmath> // ceil
+#include <set>
 #include <stdint.h>  // for uint16_t
+#include <vector>
 
 using namespace v8;
 using namespace node;
 
 namespace node_mapnik {
 
+// Layers rendered into one grid share its feature ids, and most datasources
+// number their features from 1. The first layer renders straight into the
+// grid; every later one renders into scratch() and merge(index) copies it
+// over with its ids moved into a range of their own, index * id_range().
+template <typename T>
+class grid_layer_merger
+{
+public:
+    typedef typename T::value_type value_type;
+
+    explicit grid_layer_merger(T & grid) :
+        grid_(grid),
+        scratch_() {}
+
+    // ids a layer may use before running into the next layer's range
+    static value_type id_range()
+    {
+        return value_type(1) << (sizeof(value_type) >= 8 ? 32 : 24);
+    }
+
+    // an empty grid shaped like the shared one, allocated on first use
+    T & scratch()
+    {
+        if (!scratch_)
+        {
+            scratch_.reset(new T(grid_.width(), grid_.height(), grid_.get_key(), grid_.get_resolution()));
+        }
+        else
+        {
+            scratch_->clear();
+        }
+        return *scratch_;
+    }
+
+    void merge(std::size_t index)
+    {
+        if (!scratch_ || !scratch_->painted()) return;
+        value_type offset = static_cast<value_type>(index) * id_range();
+        // the grid keys features by id, so add copies carrying the moved id
+        // rather than touching features a datasource may hand out again
+        typename T::feature_key_type const& keys = scratch_->get_feature_keys();
+        typename T::feature_type const& features = scratch_->get_grid_features();
+        typename T::feature_key_type::const_iterator itr = keys.begin();
+        for (; itr != keys.end(); ++itr)
+        {
+            if (itr->first == T::base_mask) continue;
+            typename T::feature_type::const_iterator feat = features.find(itr->second);
+            if (feat == features.end()) continue;
+            mapnik::feature_ptr moved = mapnik::feature_factory::create(feat->second->context(),
+                                                                        itr->first + offset);
+            moved->set_data(feat->second->get_data());
+            grid_.add_feature(*moved);
+        }
+        typename T::data_type const& src = scratch_->data();
+        typename T::data_type & dst = grid_.data();
+        for (unsigned y = 0; y < src.height(); ++y)
+        {
+            value_type const* from = src.getRow(y);
+            value_type * to = dst.getRow(y);
+            for (unsigned x = 0; x < src.width(); ++x)
+            {
+                if (from[x] != T::base_mask) to[x] = from[x] + offset;
+            }
+        }
+        grid_.painted(true);
+    }
+
+private:
+    T & grid_;
+    boost::scoped_ptr<T> scratch_;
+};
+
 #if MAPNIK_VERSION >= 200100
 
 template <typename T>
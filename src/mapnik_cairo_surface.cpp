@@ -90,10 +90,10 @@ Handle<Value> CairoSurface::getData(const Arguments& args)
 {
     HandleScope scope;
     CairoSurface* surface = node::ObjectWrap::Unwrap<CairoSurface>(args.This());
-    std::string s = surface->ss_.str();
+    // the stream keeps everything rendered so far, each caller gets a copy
     #if NODE_VERSION_AT_LEAST(0, 11, 0)
-    return scope.Close(node::Buffer::New((char*)s.data(),s.size()));
+    return scope.Close(node::Buffer::New(surface->ss_.data(), surface->ss_.size()));
     #else
-    return scope.Close(node::Buffer::New((char*)s.data(),s.size())->handle_);
+    return scope.Close(node::Buffer::New(surface->ss_.data(), surface->ss_.size())->handle_);
     #endif
 }
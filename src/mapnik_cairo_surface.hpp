@@ -4,8 +4,10 @@
 #include <v8.h>
 #include <node_object_wrap.h>
 
-#include <iostream>
-#include <sstream>
+#include <exception>
+#include <ostream>
+
+#include "encode_buffer.hpp"
 
 // cairo
 #if defined(HAVE_CAIRO)
@@ -18,7 +20,7 @@ using namespace v8;
 
 class CairoSurface: public node::ObjectWrap {
 public:
-    typedef std::stringstream i_stream;
+    typedef std::ostream i_stream;
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static Handle<Value> New(const Arguments &args);
@@ -38,7 +40,14 @@ public:
             return CAIRO_STATUS_WRITE_ERROR;
         }
         i_stream* fin = reinterpret_cast<i_stream*>(closure);
-        *fin << std::string((const char*)data,(size_t)length);
+        try
+        {
+            fin->write((const char*)data,(std::streamsize)length);
+        }
+        catch (std::exception const&)
+        {
+            return CAIRO_STATUS_WRITE_ERROR;
+        }
         return CAIRO_STATUS_SUCCESS;
 #else
         return 11; // CAIRO_STATUS_WRITE_ERROR
@@ -46,7 +55,8 @@ public:
     }
     unsigned width() { return width_; }
     unsigned height() { return height_; }
-    mutable i_stream ss_;
+    // everything rendered onto the surface
+    mutable node_mapnik::encode_buffer ss_;
 private:
     unsigned width_;
     unsigned height_;
@@ -8,7 +8,7 @@
 #include <mapnik/graphics.hpp>          // for image_32
 #include <mapnik/image_data.hpp>        // for image_data_32
 #include <mapnik/image_reader.hpp>      // for get_image_reader, etc
-#include <mapnik/image_util.hpp>        // for save_to_string, guess_type, etc
+#include <mapnik/image_util.hpp>        // for save_to_stream, guess_type, etc
 #include <mapnik/version.hpp>           // for MAPNIK_VERSION
 
 #if MAPNIK_VERSION >= 200100
@@ -18,21 +18,39 @@
 #endif
 
 // boost
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/optional/optional.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "mapnik_image.hpp"
 #include "mapnik_image_view.hpp"
 #include "mapnik_palette.hpp"
 #include "mapnik_color.hpp"
+#include "pixel_kernels.hpp"
+#include "alpha_copy.hpp"
+#include "encode_buffer.hpp"
+#include "png_strip_encoder.hpp"
+#include "image_profile.hpp"
+#include "solid_tile_cache.hpp"
+#include "encode_pixels.hpp"
+#include "image_resize.hpp"
+#include "image_probe.hpp"
+#include "pixel_access.hpp"
+#include "image_stats.hpp"
 
 #include "utils.hpp"
 
 // std
+#include <algorithm>                    // for min, max
+#include <cstring>                      // for memcpy
 #include <exception>
 #include <memory>                       // for auto_ptr, etc
 #include <ostream>                      // for operator<<, basic_ostream
 #include <sstream>                      // for basic_ostringstream, etc
+#include <stdexcept>                    // for runtime_error
+#include <vector>
 
 Persistent<FunctionTemplate> Image::constructor;
 
@@ -46,23 +64,36 @@ void Image::Initialize(Handle<Object> target) {
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "getPixel", getPixel);
     NODE_SET_PROTOTYPE_METHOD(constructor, "setPixel", setPixel);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "getPixels", getPixels);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "setPixels", setPixels);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "readPixels", readPixels);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "writePixels", writePixels);
     NODE_SET_PROTOTYPE_METHOD(constructor, "encodeSync", encodeSync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "encode", encode);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "encodeMany", encodeMany);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "resize", resize);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "compare", compare);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "stats", stats);
     NODE_SET_PROTOTYPE_METHOD(constructor, "view", view);
     NODE_SET_PROTOTYPE_METHOD(constructor, "save", save);
     NODE_SET_PROTOTYPE_METHOD(constructor, "setGrayScaleToAlpha", setGrayScaleToAlpha);
     NODE_SET_PROTOTYPE_METHOD(constructor, "width", width);
     NODE_SET_PROTOTYPE_METHOD(constructor, "height", height);
     NODE_SET_PROTOTYPE_METHOD(constructor, "painted", painted);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "isSolid", isSolid);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "isSolidSync", isSolidSync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "composite", composite);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "compositeMany", compositeMany);
     NODE_SET_PROTOTYPE_METHOD(constructor, "premultiplySync", premultiplySync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "premultiply", premultiply);
     NODE_SET_PROTOTYPE_METHOD(constructor, "demultiplySync", demultiplySync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "demultiply", demultiply);
     NODE_SET_PROTOTYPE_METHOD(constructor, "clear", clear);
     NODE_SET_PROTOTYPE_METHOD(constructor, "clearSync", clear);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "data", data);
 
     ATTR(constructor, "background", get_prop, set_prop);
+    ATTR(constructor, "premultiplied", get_prop, set_prop);
 
     // This *must* go after the ATTR setting
     NODE_SET_METHOD(constructor->GetFunction(),
@@ -77,13 +108,20 @@ void Image::Initialize(Handle<Object> target) {
     NODE_SET_METHOD(constructor->GetFunction(),
                     "fromBytesSync",
                     Image::fromBytesSync);
+    NODE_SET_METHOD(constructor->GetFunction(),
+                    "fromBuffer",
+                    Image::fromBuffer);
+    NODE_SET_METHOD(constructor->GetFunction(),
+                    "probe",
+                    Image::probe);
     target->Set(String::NewSymbol("Image"),constructor->GetFunction());
 }
 
 Image::Image(unsigned int width, unsigned int height) :
     ObjectWrap(),
     this_(boost::make_shared<mapnik::image_32>(width,height)),
-    estimated_size_(width * height * 4)
+    estimated_size_(width * height * 4),
+    premultiplied_(false)
 {
     V8::AdjustAmountOfExternalAllocatedMemory(estimated_size_);
 }
@@ -91,7 +129,8 @@ Image::Image(unsigned int width, unsigned int height) :
 Image::Image(image_ptr _this) :
     ObjectWrap(),
     this_(_this),
-    estimated_size_(this_->width() * this_->height() * 4)
+    estimated_size_(this_->width() * this_->height() * 4),
+    premultiplied_(false)
 {
     V8::AdjustAmountOfExternalAllocatedMemory(estimated_size_);
 }
@@ -101,6 +140,34 @@ Image::~Image()
     V8::AdjustAmountOfExternalAllocatedMemory(-estimated_size_);
 }
 
+void Image::ensure_premultiplied()
+{
+    if (!premultiplied_)
+    {
+        node_mapnik::premultiply(this_->data().getBytes(), this_->width() * this_->height());
+        premultiplied_ = true;
+    }
+}
+
+void Image::ensure_demultiplied()
+{
+    if (premultiplied_)
+    {
+        node_mapnik::demultiply(this_->data().getBytes(), this_->width() * this_->height());
+        premultiplied_ = false;
+    }
+}
+
+image_ptr Image::detach()
+{
+    image_ptr pixels = this_;
+    this_ = boost::make_shared<mapnik::image_32>(0,0);
+    V8::AdjustAmountOfExternalAllocatedMemory(-estimated_size_);
+    estimated_size_ = 0;
+    premultiplied_ = false;
+    return pixels;
+}
+
 Handle<Value> Image::New(const Arguments& args)
 {
     HandleScope scope;
@@ -155,6 +222,8 @@ Handle<Value> Image::get_prop(Local<String> property,
         else
             return Undefined();
     }
+    else if (a == "premultiplied")
+        return scope.Close(Boolean::New(im->premultiplied_));
     return Undefined();
 }
 
@@ -175,6 +244,16 @@ void Image::set_prop(Local<String> property,
             ThrowException(Exception::TypeError(String::New("mapnik.Color expected")));
         Color *c = node::ObjectWrap::Unwrap<Color>(obj);
         im->get()->set_background(*c->get());
+        im->premultiplied_ = false;
+    }
+    else if (a == "premultiplied") {
+        // declares the state of pixel data that came from elsewhere,
+        // the pixels themselves are not touched
+        if (!value->IsBoolean())
+            ThrowException(Exception::TypeError(
+                               String::New("'premultiplied' must be a boolean")));
+        else
+            im->premultiplied_ = value->BooleanValue();
     }
 }
 
@@ -234,12 +313,99 @@ Handle<Value> Image::setPixel(const Arguments& args)
     return scope.Close(Undefined());
 }
 
+Handle<Value> Image::getPixels(const Arguments& args)
+{
+    HandleScope scope;
+    std::size_t length = 0;
+    int const* coords = args.Length() > 0 ?
+        static_cast<int const*>(node_mapnik::typed_array_data(args[0], kExternalIntArray, length)) : 0;
+    if (!coords || length % 2 != 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("expects an Int32Array of x,y pairs")));
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    Local<Object> pixels = node_mapnik::new_uint32_array(length / 2);
+    node_mapnik::get_pixels(im->this_->data(), coords, length / 2,
+                            static_cast<unsigned *>(pixels->GetIndexedPropertiesExternalArrayData()));
+    return scope.Close(pixels);
+}
+
+Handle<Value> Image::setPixels(const Arguments& args)
+{
+    HandleScope scope;
+    std::size_t length = 0;
+    std::size_t count = 0;
+    int const* coords = 0;
+    unsigned const* values = 0;
+    if (args.Length() >= 2)
+    {
+        coords = static_cast<int const*>(node_mapnik::typed_array_data(args[0], kExternalIntArray, length));
+        values = static_cast<unsigned const*>(node_mapnik::typed_array_data(args[1], kExternalUnsignedIntArray, count));
+    }
+    if (!coords || !values || length != count * 2)
+        return ThrowException(Exception::TypeError(
+                                  String::New("expects an Int32Array of x,y pairs and a Uint32Array with a pixel per pair")));
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    mapnik::image_data_32 & data = im->this_->data();
+    // nothing is written unless every pixel is valid
+    if (!node_mapnik::pixels_inside(data, coords, count))
+        return ThrowException(Exception::TypeError(String::New("invalid pixel requested")));
+    node_mapnik::set_pixels(data, coords, count, values);
+    return Undefined();
+}
+
+Handle<Value> Image::readPixels(const Arguments& args)
+{
+    HandleScope scope;
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    mapnik::image_data_32 const& data = im->this_->data();
+    int region[4];
+    if (!node_mapnik::parse_pixel_region(args, data, region))
+        return Undefined();
+    std::size_t count = static_cast<std::size_t>(region[2]) * region[3];
+    Local<Object> pixels;
+    if (args.Length() > 4)
+    {
+        // fill a caller's array instead of allocating one per call
+        std::size_t length = 0;
+        if (!node_mapnik::typed_array_data(args[4], kExternalUnsignedIntArray, length) || length < count)
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional fifth argument must be a Uint32Array of at least width * height pixels")));
+        pixels = args[4]->ToObject();
+    }
+    else
+    {
+        pixels = node_mapnik::new_uint32_array(count);
+    }
+    node_mapnik::read_region(data, region[0], region[1], region[2], region[3],
+                             static_cast<unsigned *>(pixels->GetIndexedPropertiesExternalArrayData()));
+    return scope.Close(pixels);
+}
+
+Handle<Value> Image::writePixels(const Arguments& args)
+{
+    HandleScope scope;
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    mapnik::image_data_32 & data = im->this_->data();
+    int region[4];
+    if (!node_mapnik::parse_pixel_region(args, data, region))
+        return Undefined();
+    std::size_t length = 0;
+    unsigned const* values = args.Length() > 4 ?
+        static_cast<unsigned const*>(node_mapnik::typed_array_data(args[4], kExternalUnsignedIntArray, length)) : 0;
+    if (!values || length < static_cast<std::size_t>(region[2]) * region[3])
+        return ThrowException(Exception::TypeError(
+                                  String::New("fifth argument must be a Uint32Array of at least width * height pixels")));
+    node_mapnik::write_region(data, region[0], region[1], region[2], region[3], values);
+    return Undefined();
+}
+
 Handle<Value> Image::clearSync(const Arguments& args)
 {
     HandleScope scope;
 #if MAPNIK_VERSION >= 200200
     Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
     im->get()->clear();
+    im->premultiplied_ = false;
 #endif
     return Undefined();
 }
@@ -283,6 +449,7 @@ void Image::EIO_Clear(uv_work_t* req)
     try
     {
         closure->im->get()->clear();
+        closure->im->premultiplied_ = false;
     }
     catch(std::exception const& ex)
     {
@@ -316,54 +483,106 @@ void Image::EIO_AfterClear(uv_work_t* req)
     delete closure;
 }
 
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    unsigned rgb;
+    // the alpha state when queued
+    bool premultiplied;
+    Persistent<Function> cb;
+} gray_to_alpha_baton_t;
+
+bool Image::gray_to_alpha_color(const Arguments& args, int argc, unsigned & rgb)
+{
+    rgb = 0xffffff;
+    if (argc == 0) return true;
+    if (!args[0]->IsObject())
+    {
+        ThrowException(Exception::TypeError(
+                           String::New("optional second arg must be a mapnik.Color")));
+        return false;
+    }
+
+    Local<Object> obj = args[0]->ToObject();
+
+    if (obj->IsNull() || obj->IsUndefined() || !Color::constructor->HasInstance(obj))
+    {
+        ThrowException(Exception::TypeError(String::New("mapnik.Color expected as second arg")));
+        return false;
+    }
+
+    Color * color = node::ObjectWrap::Unwrap<Color>(obj);
+    rgb = (color->get()->blue() << 16) |
+        (color->get()->green() << 8) |
+        (color->get()->red());
+    return true;
+}
+
 Handle<Value> Image::setGrayScaleToAlpha(const Arguments& args)
 {
     HandleScope scope;
 
     Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
-    if (args.Length() == 0) {
-        im->this_->set_grayscale_to_alpha();
-    } else {
-        if (!args[0]->IsObject())
-            return ThrowException(Exception::TypeError(
-                                      String::New("optional second arg must be a mapnik.Color")));
+    bool async = args.Length() > 0 && args[args.Length()-1]->IsFunction();
+    unsigned rgb;
+    if (!gray_to_alpha_color(args, async ? args.Length() - 1 : args.Length(), rgb))
+        return Undefined();
 
-        Local<Object> obj = args[0]->ToObject();
-
-        if (obj->IsNull() || obj->IsUndefined() || !Color::constructor->HasInstance(obj))
-            return ThrowException(Exception::TypeError(String::New("mapnik.Color expected as second arg")));
+    if (!async)
+    {
+        // gray levels come from straight colors, and the result holds
+        // straight alpha
+        im->ensure_demultiplied();
+        node_mapnik::gray_to_alpha_row(im->this_->data().getData(),
+                                       im->this_->width() * im->this_->height(), rgb);
+        return Undefined();
+    }
 
-        Color * color = node::ObjectWrap::Unwrap<Color>(obj);
+    gray_to_alpha_baton_t *closure = new gray_to_alpha_baton_t();
+    closure->request.data = closure;
+    closure->im = im;
+    closure->rgb = rgb;
+    closure->premultiplied = im->premultiplied_;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_GrayScaleToAlpha, (uv_after_work_cb)EIO_AfterGrayScaleToAlpha);
+    im->Ref();
+    return Undefined();
+}
 
-        mapnik::image_data_32 & data = im->this_->data();
-        for (unsigned int y = 0; y < data.height(); ++y)
-        {
-            unsigned int* row_from = data.getRow(y);
-            for (unsigned int x = 0; x < data.width(); ++x)
-            {
-                unsigned rgba = row_from[x];
-                // TODO - big endian support
-                unsigned r = rgba & 0xff;
-                unsigned g = (rgba >> 8 ) & 0xff;
-                unsigned b = (rgba >> 16) & 0xff;
-
-                // magic numbers for grayscale
-                unsigned a = (int)((r * .3) + (g * .59) + (b * .11));
-
-                row_from[x] = (a << 24) |
-                    (color->get()->blue() << 16) |
-                    (color->get()->green() << 8) |
-                    (color->get()->red()) ;
-            }
-        }
+void Image::EIO_GrayScaleToAlpha(uv_work_t* req)
+{
+    gray_to_alpha_baton_t *closure = static_cast<gray_to_alpha_baton_t *>(req->data);
+    image_ptr image = closure->im->this_;
+    if (closure->premultiplied)
+    {
+        node_mapnik::demultiply(image->data().getBytes(), image->width() * image->height());
     }
+    node_mapnik::gray_to_alpha_row(image->data().getData(), image->width() * image->height(), closure->rgb);
+}
 
-    return Undefined();
+void Image::EIO_AfterGrayScaleToAlpha(uv_work_t* req)
+{
+    HandleScope scope;
+    gray_to_alpha_baton_t *closure = static_cast<gray_to_alpha_baton_t *>(req->data);
+    // the result holds straight alpha
+    closure->im->premultiplied_ = false;
+    TryCatch try_catch;
+    Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->im->handle_) };
+    closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
 }
 
 typedef struct {
     uv_work_t request;
     Image* im;
+    // the alpha state when queued, then the converted one, which the
+    // after callback hands back to the image
+    bool premultiplied;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -373,10 +592,8 @@ typedef struct {
 Handle<Value> Image::premultiplySync(const Arguments& args)
 {
     HandleScope scope;
-#if MAPNIK_VERSION >= 200100
     Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
-    im->get()->premultiply();
-#endif
+    im->ensure_premultiplied();
     return Undefined();
 }
 
@@ -397,6 +614,7 @@ Handle<Value> Image::premultiply(const Arguments& args)
     image_op_baton_t *closure = new image_op_baton_t();
     closure->request.data = closure;
     closure->im = im;
+    closure->premultiplied = im->premultiplied_;
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Premultiply, (uv_after_work_cb)EIO_AfterMultiply);
@@ -410,7 +628,12 @@ void Image::EIO_Premultiply(uv_work_t* req)
 
     try
     {
-        closure->im->get()->premultiply();
+        if (!closure->premultiplied)
+        {
+            mapnik::image_data_32 & data = closure->im->this_->data();
+            node_mapnik::premultiply(data.getBytes(), data.width() * data.height());
+            closure->premultiplied = true;
+        }
     }
     catch (std::exception const& ex)
     {
@@ -424,6 +647,7 @@ void Image::EIO_AfterMultiply(uv_work_t* req)
     HandleScope scope;
     image_op_baton_t *closure = static_cast<image_op_baton_t *>(req->data);
     TryCatch try_catch;
+    closure->im->premultiplied_ = closure->premultiplied;
     if (closure->error)
     {
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
@@ -445,10 +669,8 @@ void Image::EIO_AfterMultiply(uv_work_t* req)
 Handle<Value> Image::demultiplySync(const Arguments& args)
 {
     HandleScope scope;
-#if MAPNIK_VERSION >= 200100
     Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
-    im->get()->demultiply();
-#endif
+    im->ensure_demultiplied();
     return Undefined();
 }
 
@@ -469,6 +691,7 @@ Handle<Value> Image::demultiply(const Arguments& args)
     image_op_baton_t *closure = new image_op_baton_t();
     closure->request.data = closure;
     closure->im = im;
+    closure->premultiplied = im->premultiplied_;
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Demultiply, (uv_after_work_cb)EIO_AfterMultiply);
@@ -482,7 +705,12 @@ void Image::EIO_Demultiply(uv_work_t* req)
 
     try
     {
-        closure->im->get()->demultiply();
+        if (closure->premultiplied)
+        {
+            mapnik::image_data_32 & data = closure->im->this_->data();
+            node_mapnik::demultiply(data.getBytes(), data.width() * data.height());
+            closure->premultiplied = false;
+        }
     }
     catch (std::exception const& ex)
     {
@@ -515,6 +743,238 @@ Handle<Value> Image::height(const Arguments& args)
     return scope.Close(Integer::New(im->get()->height()));
 }
 
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    Persistent<Function> cb;
+    bool error;
+    std::string error_name;
+    bool result;
+    mapnik::image_data_32::pixel_type pixel;
+} is_solid_image_baton_t;
+
+Handle<Value> Image::isSolid(const Arguments& args)
+{
+    HandleScope scope;
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+
+    if (args.Length() == 0) {
+        return isSolidSync(args);
+    }
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    is_solid_image_baton_t *closure = new is_solid_image_baton_t();
+    closure->request.data = closure;
+    closure->im = im;
+    closure->result = true;
+    closure->pixel = 0;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_IsSolid, (uv_after_work_cb)EIO_AfterIsSolid);
+    im->Ref();
+    return Undefined();
+}
+
+void Image::EIO_IsSolid(uv_work_t* req)
+{
+    is_solid_image_baton_t *closure = static_cast<is_solid_image_baton_t *>(req->data);
+    mapnik::image_data_32 const& data = closure->im->this_->data();
+    if (data.width() > 0 && data.height() > 0)
+    {
+        // the pixels are contiguous so the whole image is checked as one row
+        mapnik::image_data_32::pixel_type const* pixels = data.getData();
+        closure->pixel = pixels[0];
+        closure->result = node_mapnik::is_solid_row(pixels,
+                                                    static_cast<std::size_t>(data.width()) * data.height(),
+                                                    pixels[0]);
+    }
+    else
+    {
+        closure->error = true;
+        closure->error_name = "image does not have valid dimensions";
+    }
+}
+
+void Image::EIO_AfterIsSolid(uv_work_t* req)
+{
+    HandleScope scope;
+    is_solid_image_baton_t *closure = static_cast<is_solid_image_baton_t *>(req->data);
+    TryCatch try_catch;
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    }
+    else
+    {
+        if (closure->result)
+        {
+            Local<Value> argv[3] = { Local<Value>::New(Null()),
+                                     Local<Value>::New(Boolean::New(closure->result)),
+                                     Local<Value>::New(Number::New(closure->pixel)),
+            };
+            closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
+        }
+        else
+        {
+            Local<Value> argv[2] = { Local<Value>::New(Null()),
+                                     Local<Value>::New(Boolean::New(closure->result))
+            };
+            closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+        }
+    }
+    if (try_catch.HasCaught())
+    {
+        node::FatalException(try_catch);
+    }
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+Handle<Value> Image::isSolidSync(const Arguments& args)
+{
+    HandleScope scope;
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    mapnik::image_data_32 const& data = im->this_->data();
+    if (data.width() > 0 && data.height() > 0)
+    {
+        mapnik::image_data_32::pixel_type const* pixels = data.getData();
+        if (!node_mapnik::is_solid_row(pixels,
+                                       static_cast<std::size_t>(data.width()) * data.height(),
+                                       pixels[0]))
+        {
+            return scope.Close(False());
+        }
+    }
+    return scope.Close(True());
+}
+
+// how open/fromBytes decode, from their options object
+struct image_read_options
+{
+    // only this part of the image is decoded when width > 0
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+    // open decodes from the file mapped into memory, ignored by fromBytes
+    bool mmap;
+};
+
+static image_read_options default_read_options()
+{
+    image_read_options read_options;
+    read_options.x = read_options.y = read_options.width = read_options.height = 0;
+    read_options.mmap = false;
+    return read_options;
+}
+
+// throws and returns false if the options are invalid
+static bool parse_read_options(Local<Value> arg, image_read_options & read_options)
+{
+    read_options = default_read_options();
+    if (!arg->IsObject())
+    {
+        ThrowException(Exception::TypeError(
+                           String::New("optional second argument must be an options object")));
+        return false;
+    }
+    Local<Object> options = arg->ToObject();
+    if (options->Has(String::New("window")))
+    {
+        Local<Value> opt = options->Get(String::New("window"));
+        if (!opt->IsArray() || Local<Array>::Cast(opt)->Length() != 4)
+        {
+            ThrowException(Exception::TypeError(
+                               String::New("'window' must be an array of [x, y, width, height]")));
+            return false;
+        }
+        Local<Array> window = Local<Array>::Cast(opt);
+        int values[4];
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            Local<Value> value = window->Get(i);
+            values[i] = value->IsNumber() ? value->IntegerValue() : -1;
+            if (values[i] < 0 || (i >= 2 && values[i] == 0))
+            {
+                ThrowException(Exception::TypeError(
+                                   String::New("'window' must hold a non negative x and y and a positive width and height")));
+                return false;
+            }
+        }
+        read_options.x = values[0];
+        read_options.y = values[1];
+        read_options.width = values[2];
+        read_options.height = values[3];
+    }
+    if (options->Has(String::New("mmap")))
+    {
+        Local<Value> opt = options->Get(String::New("mmap"));
+        if (!opt->IsBoolean())
+        {
+            ThrowException(Exception::TypeError(
+                               String::New("'mmap' must be a boolean")));
+            return false;
+        }
+        read_options.mmap = opt->BooleanValue();
+    }
+    return true;
+}
+
+// Keeps a file mapped for as long as a reader decodes from it, so its
+// pages are backed by the file instead of a heap copy.
+struct mapped_image_file
+{
+    explicit mapped_image_file(std::string const& filename) :
+        mapping(filename.c_str(), boost::interprocess::read_only),
+        region(mapping, boost::interprocess::read_only) {}
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
+};
+
+static mapnik::image_reader * get_file_reader(std::string const& filename,
+                                              std::string const& type,
+                                              bool mmap,
+                                              boost::scoped_ptr<mapped_image_file> & mapped)
+{
+    if (!mmap) return mapnik::get_image_reader(filename,type);
+    mapped.reset(new mapped_image_file(filename));
+    return mapnik::get_image_reader(static_cast<char const*>(mapped->region.get_address()),
+                                    mapped->region.get_size());
+}
+
+// Decodes the window (the whole image without one). Readers of tiled or
+// stripped tiffs only decode the tiles or strips the window touches.
+static image_ptr read_image(mapnik::image_reader & reader, image_read_options const& read_options)
+{
+    unsigned x = 0;
+    unsigned y = 0;
+    unsigned width = reader.width();
+    unsigned height = reader.height();
+    if (read_options.width > 0)
+    {
+        if (read_options.x >= width || read_options.y >= height ||
+            read_options.width > width - read_options.x ||
+            read_options.height > height - read_options.y)
+        {
+            std::ostringstream s;
+            s << "window is outside of the " << width << "x" << height << " image";
+            throw std::runtime_error(s.str());
+        }
+        x = read_options.x;
+        y = read_options.y;
+        width = read_options.width;
+        height = read_options.height;
+    }
+    image_ptr image = boost::make_shared<mapnik::image_32>(width,height);
+    reader.read(x,y,image->data());
+    return image;
+}
+
 Handle<Value> Image::openSync(const Arguments& args)
 {
     HandleScope scope;
@@ -529,18 +989,21 @@ Handle<Value> Image::openSync(const Arguments& args)
                                                        "Argument must be a string")));
     }
 
+    image_read_options read_options = default_read_options();
+    if (args.Length() > 1 && !parse_read_options(args[1], read_options))
+        return Undefined();
+
     try
     {
         std::string filename = TOSTR(args[0]);
         boost::optional<std::string> type = mapnik::type_from_filename(filename);
         if (type)
         {
-            std::auto_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(filename,*type));
+            boost::scoped_ptr<mapped_image_file> mapped;
+            std::auto_ptr<mapnik::image_reader> reader(get_file_reader(filename,*type,read_options.mmap,mapped));
             if (reader.get())
             {
-                boost::shared_ptr<mapnik::image_32> image_ptr(new mapnik::image_32(reader->width(),reader->height()));
-                reader->read(0,0,image_ptr->data());
-                Image* im = new Image(image_ptr);
+                Image* im = new Image(read_image(*reader, read_options));
                 Handle<Value> ext = External::New(im);
                 Handle<Object> obj = constructor->GetFunction()->NewInstance(1, &ext);
                 return scope.Close(obj);
@@ -563,6 +1026,7 @@ typedef struct {
     image_ptr im;
     const char *data;
     size_t dataLength;
+    image_read_options read_options;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -572,6 +1036,7 @@ typedef struct {
     uv_work_t request;
     image_ptr im;
     std::string filename;
+    image_read_options read_options;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -601,9 +1066,14 @@ Handle<Value> Image::open(const Arguments& args)
         return ThrowException(Exception::TypeError(
                                   String::New("last argument must be a callback function")));
 
+    image_read_options read_options = default_read_options();
+    if (args.Length() > 2 && !parse_read_options(args[1], read_options))
+        return Undefined();
+
     image_file_ptr_baton_t *closure = new image_file_ptr_baton_t();
     closure->request.data = closure;
     closure->filename = TOSTR(args[0]);
+    closure->read_options = read_options;
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Open, (uv_after_work_cb)EIO_AfterOpen);
@@ -624,11 +1094,11 @@ void Image::EIO_Open(uv_work_t* req)
         }
         else
         {
-            std::auto_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(closure->filename,*type));
+            boost::scoped_ptr<mapped_image_file> mapped;
+            std::auto_ptr<mapnik::image_reader> reader(get_file_reader(closure->filename,*type,closure->read_options.mmap,mapped));
             if (reader.get())
             {
-                closure->im = boost::make_shared<mapnik::image_32>(reader->width(),reader->height());
-                reader->read(0,0,closure->im->data());
+                closure->im = read_image(*reader, closure->read_options);
             }
             else
             {
@@ -686,14 +1156,16 @@ Handle<Value> Image::fromBytesSync(const Arguments& args)
                                                        "first argument must be a buffer")));
     }
 
+    image_read_options read_options = default_read_options();
+    if (args.Length() > 1 && !parse_read_options(args[1], read_options))
+        return Undefined();
+
     try
     {
         std::auto_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(node::Buffer::Data(obj),node::Buffer::Length(obj)));
         if (reader.get())
         {
-            boost::shared_ptr<mapnik::image_32> image_ptr(new mapnik::image_32(reader->width(),reader->height()));
-            reader->read(0,0,image_ptr->data());
-            Image* im = new Image(image_ptr);
+            Image* im = new Image(read_image(*reader, read_options));
             Handle<Value> ext = External::New(im);
             return scope.Close(constructor->GetFunction()->NewInstance(1, &ext));
         }
@@ -707,58 +1179,179 @@ Handle<Value> Image::fromBytesSync(const Arguments& args)
     }
 }
 
-Handle<Value> Image::fromBytes(const Arguments& args)
+Handle<Value> Image::fromBuffer(const Arguments& args)
 {
     HandleScope scope;
 
-    if (args.Length() == 1) {
-        return fromBytesSync(args);
-    }
-
-    if (args.Length() < 2) {
-        return ThrowException(Exception::TypeError(
-                                  String::New("must provide a buffer argument")));
-    }
-
-    if (!args[0]->IsObject()) {
+    if (args.Length() < 3 || !args[0]->IsObject() || !args[1]->IsNumber() || !args[2]->IsNumber()) {
         return ThrowException(Exception::TypeError(
-                                  String::New("must provide a buffer argument")));
+                                  String::New("requires a Buffer of rgba pixels, a width and a height")));
     }
 
     Local<Object> obj = args[0]->ToObject();
-    if (obj->IsNull() || obj->IsUndefined())
-        return ThrowException(Exception::TypeError(String::New("first argument is invalid, must be a Buffer")));
     if (!node::Buffer::HasInstance(obj)) {
         return ThrowException(Exception::TypeError(String::New(
                                                        "first argument must be a buffer")));
     }
-    // ensure callback is a function
-    Local<Value> callback = args[args.Length()-1];
-    if (!args[args.Length()-1]->IsFunction())
+
+    int width = args[1]->IntegerValue();
+    int height = args[2]->IntegerValue();
+    if (width <= 0 || height <= 0) {
         return ThrowException(Exception::TypeError(
-                                  String::New("last argument must be a callback function")));
+                                  String::New("width and height must be greater than zero")));
+    }
 
-    image_mem_ptr_baton_t *closure = new image_mem_ptr_baton_t();
-    closure->request.data = closure;
-    closure->data = node::Buffer::Data(obj);
-    closure->dataLength = node::Buffer::Length(obj);
-    closure->error = false;
-    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_FromBytes, (uv_after_work_cb)EIO_AfterFromBytes);
-    return Undefined();
-}
+    bool premultiplied = false;
+    if (args.Length() > 3) {
+        if (!args[3]->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional fourth argument must be an options object")));
+        Local<Object> options = args[3]->ToObject();
+        if (options->Has(String::New("premultiplied"))) {
+            Local<Value> opt = options->Get(String::New("premultiplied"));
+            if (!opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("'premultiplied' must be a boolean")));
+            premultiplied = opt->BooleanValue();
+        }
+    }
 
-void Image::EIO_FromBytes(uv_work_t* req)
-{
-    image_mem_ptr_baton_t *closure = static_cast<image_mem_ptr_baton_t *>(req->data);
+    std::size_t length = static_cast<std::size_t>(width) * height * 4;
+    if (node::Buffer::Length(obj) != length) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("buffer length must be width * height * 4")));
+    }
 
     try
     {
-        std::auto_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(closure->data,closure->dataLength));
+        // image_data_32 owns its storage so the pixels are copied once
+        boost::shared_ptr<mapnik::image_32> image_ptr = boost::make_shared<mapnik::image_32>(width,height);
+        std::memcpy(image_ptr->data().getBytes(), node::Buffer::Data(obj), length);
+        Image* im = new Image(image_ptr);
+        im->premultiplied_ = premultiplied;
+        Handle<Value> ext = External::New(im);
+        return scope.Close(constructor->GetFunction()->NewInstance(1, &ext));
+    }
+    catch (std::exception const& ex)
+    {
+        return ThrowException(Exception::Error(
+                                  String::New(ex.what())));
+    }
+}
+
+Handle<Value> Image::probe(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !(args[0]->IsString() || node::Buffer::HasInstance(args[0]))) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("must provide a Buffer or a filename")));
+    }
+
+    node_mapnik::image_probe_result result;
+    bool probed = false;
+    if (args[0]->IsString())
+    {
+        std::string filename = TOSTR(args[0]);
+        node_mapnik::file_probe_source source(filename);
+        if (!source.is_open())
+            return ThrowException(Exception::Error(String::New(
+                                                       ("Failed to open: " + filename).c_str())));
+        probed = node_mapnik::probe_image(source, result);
+    }
+    else
+    {
+        Local<Object> obj = args[0]->ToObject();
+        node_mapnik::buffer_probe_source source(node::Buffer::Data(obj), node::Buffer::Length(obj));
+        probed = node_mapnik::probe_image(source, result);
+    }
+    if (!probed)
+        return ThrowException(Exception::Error(String::New("Unsupported image format or truncated header")));
+
+    Local<Object> info = Object::New();
+    info->Set(String::NewSymbol("format"), String::New(result.format.c_str()));
+    info->Set(String::NewSymbol("width"), Integer::NewFromUnsigned(result.width));
+    info->Set(String::NewSymbol("height"), Integer::NewFromUnsigned(result.height));
+    info->Set(String::NewSymbol("alpha"), Boolean::New(result.alpha));
+    return scope.Close(info);
+}
+
+// a Buffer returned by data() holds a reference on its Image
+static void release_image_data(char *, void * hint)
+{
+    static_cast<Image *>(hint)->_unref();
+}
+
+Handle<Value> Image::data(const Arguments& args)
+{
+    HandleScope scope;
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    mapnik::image_data_32 & data = im->this_->data();
+    std::size_t length = static_cast<std::size_t>(data.width()) * data.height() * 4;
+    im->_ref();
+    #if NODE_VERSION_AT_LEAST(0, 11, 0)
+    return scope.Close(node::Buffer::New(reinterpret_cast<char *>(data.getBytes()), length, release_image_data, im));
+    #else
+    return scope.Close(node::Buffer::New(reinterpret_cast<char *>(data.getBytes()), length, release_image_data, im)->handle_);
+    #endif
+}
+
+Handle<Value> Image::fromBytes(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() == 1) {
+        return fromBytesSync(args);
+    }
+
+    if (args.Length() < 2) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("must provide a buffer argument")));
+    }
+
+    if (!args[0]->IsObject()) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("must provide a buffer argument")));
+    }
+
+    Local<Object> obj = args[0]->ToObject();
+    if (obj->IsNull() || obj->IsUndefined())
+        return ThrowException(Exception::TypeError(String::New("first argument is invalid, must be a Buffer")));
+    if (!node::Buffer::HasInstance(obj)) {
+        return ThrowException(Exception::TypeError(String::New(
+                                                       "first argument must be a buffer")));
+    }
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    image_read_options read_options = default_read_options();
+    if (args.Length() > 2 && !parse_read_options(args[1], read_options))
+        return Undefined();
+
+    image_mem_ptr_baton_t *closure = new image_mem_ptr_baton_t();
+    closure->request.data = closure;
+    closure->data = node::Buffer::Data(obj);
+    closure->dataLength = node::Buffer::Length(obj);
+    closure->read_options = read_options;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_FromBytes, (uv_after_work_cb)EIO_AfterFromBytes);
+    return Undefined();
+}
+
+void Image::EIO_FromBytes(uv_work_t* req)
+{
+    image_mem_ptr_baton_t *closure = static_cast<image_mem_ptr_baton_t *>(req->data);
+
+    try
+    {
+        std::auto_ptr<mapnik::image_reader> reader(mapnik::get_image_reader(closure->data,closure->dataLength));
         if (reader.get())
         {
-            closure->im = boost::make_shared<mapnik::image_32>(reader->width(),reader->height());
-            reader->read(0,0,closure->im->data());
+            closure->im = read_image(*reader, closure->read_options);
         }
         else
         {
@@ -798,6 +1391,17 @@ void Image::EIO_AfterFromBytes(uv_work_t* req)
     delete closure;
 }
 
+// The pixels to encode: the image's own when they hold straight alpha,
+// else a demultiplied copy kept alive by scratch.
+static mapnik::image_data_32 const& straight_pixels(mapnik::image_data_32 const& data,
+                                                    bool premultiplied,
+                                                    boost::shared_ptr<mapnik::image_data_32> & scratch)
+{
+    if (!premultiplied) return data;
+    scratch = node_mapnik::demultiplied_copy(data);
+    return *scratch;
+}
+
 Handle<Value> Image::encodeSync(const Arguments& args)
 {
     HandleScope scope;
@@ -806,6 +1410,7 @@ Handle<Value> Image::encodeSync(const Arguments& args)
 
     std::string format = "png";
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
 
     // accept custom format
     if (args.Length() >= 1){
@@ -833,25 +1438,17 @@ Handle<Value> Image::encodeSync(const Arguments& args)
             if (obj->IsNull() || obj->IsUndefined() || !Palette::constructor->HasInstance(obj))
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
     }
 
     try {
-        std::string s;
-        if (palette.get())
-        {
-            s = save_to_string(*(im->this_), format, *palette);
-        }
-        else {
-            s = save_to_string(*(im->this_), format);
-        }
-
-        // https://github.com/joyent/node/commit/3a2f273bd73bc94a6e93f342d629106a9f022f2d#src/node_buffer.h
-        #if NODE_VERSION_AT_LEAST(0, 11, 0)
-        return scope.Close(node::Buffer::New((char*)s.data(),s.size()));
-        #else
-        return scope.Close(node::Buffer::New((char*)s.data(),s.size())->handle_);
-        #endif
+        // encoders expect straight alpha
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        mapnik::image_data_32 const& data = straight_pixels(im->this_->data(), im->premultiplied_, scratch);
+        node_mapnik::encode_buffer out;
+        node_mapnik::encode_pixels(data, format, palette, lookup, 1, out);
+        return scope.Close(out.to_node_buffer());
     }
     catch (std::exception const& ex)
     {
@@ -865,10 +1462,14 @@ typedef struct {
     Image* im;
     std::string format;
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
-    std::string result;
+    node_mapnik::encode_buffer result;
+    unsigned threads;
+    bool auto_format;
+    bool premultiplied;
 } encode_image_baton_t;
 
 Handle<Value> Image::encode(const Arguments& args)
@@ -879,6 +1480,8 @@ Handle<Value> Image::encode(const Arguments& args)
 
     std::string format = "png";
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
+    unsigned threads = 1;
 
     // accept custom format
     if (args.Length() >= 1){
@@ -908,9 +1511,25 @@ Handle<Value> Image::encode(const Arguments& args)
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
 
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
+        }
+
+        if (options->Has(String::New("threads")))
+        {
+            Local<Value> threads_opt = options->Get(String::New("threads"));
+            if (!threads_opt->IsNumber() || threads_opt->IntegerValue() < 1)
+                return ThrowException(Exception::TypeError(
+                                          String::New("'threads' must be a positive integer")));
+            threads = threads_opt->IntegerValue();
         }
     }
 
+    // 'auto' picks the format from the pixels and hands it to the callback
+    bool auto_format = (format == "auto");
+    if (auto_format && palette.get())
+        return ThrowException(Exception::TypeError(
+                                  String::New("'auto' format does not accept a palette")));
+
     // ensure callback is a function
     Local<Value> callback = args[args.Length()-1];
     if (!args[args.Length()-1]->IsFunction())
@@ -922,6 +1541,10 @@ Handle<Value> Image::encode(const Arguments& args)
     closure->im = im;
     closure->format = format;
     closure->palette = palette;
+    closure->lookup = lookup;
+    closure->threads = threads;
+    closure->auto_format = auto_format;
+    closure->premultiplied = im->premultiplied_;
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Encode, (uv_after_work_cb)EIO_AfterEncode);
@@ -935,14 +1558,19 @@ void Image::EIO_Encode(uv_work_t* req)
     encode_image_baton_t *closure = static_cast<encode_image_baton_t *>(req->data);
 
     try {
-        if (closure->palette.get())
-        {
-            closure->result = save_to_string(*(closure->im->this_), closure->format, *closure->palette);
-        }
-        else
+        // the image may be shared with other work, never convert it here
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        mapnik::image_data_32 const& data = straight_pixels(closure->im->this_->data(), closure->premultiplied, scratch);
+        if (closure->auto_format)
         {
-            closure->result = save_to_string(*(closure->im->this_), closure->format);
+            closure->format = node_mapnik::choose_format(node_mapnik::profile_image(data));
         }
+        node_mapnik::encode_pixels(data,
+                          closure->format,
+                          closure->palette,
+                          closure->lookup,
+                          closure->threads,
+                          closure->result);
     }
     catch (std::exception const& ex)
     {
@@ -963,13 +1591,16 @@ void Image::EIO_AfterEncode(uv_work_t* req)
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
     }
+    else if (closure->auto_format)
+    {
+        Local<Value> argv[3] = { Local<Value>::New(Null()),
+                                 Local<Value>::New(closure->result.to_node_buffer()),
+                                 String::New(closure->format.c_str()) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
+    }
     else
     {
-        #if NODE_VERSION_AT_LEAST(0, 11, 0)
-        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(node::Buffer::New((char*)closure->result.data(),closure->result.size())) };
-        #else
-        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(node::Buffer::New((char*)closure->result.data(),closure->result.size())->handle_) };
-        #endif
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->result.to_node_buffer()) };
         closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
     }
 
@@ -982,231 +1613,1040 @@ void Image::EIO_AfterEncode(uv_work_t* req)
     delete closure;
 }
 
-Handle<Value> Image::view(const Arguments& args)
-{
-    HandleScope scope;
-
-    if ( (args.Length() != 4) || (!args[0]->IsNumber() && !args[1]->IsNumber() && !args[2]->IsNumber() && !args[3]->IsNumber() ))
-        return ThrowException(Exception::TypeError(
-                                  String::New("requires 4 integer arguments: x, y, width, height")));
-
-    // TODO parse args
-    unsigned x = args[0]->IntegerValue();
-    unsigned y = args[1]->IntegerValue();
-    unsigned w = args[2]->IntegerValue();
-    unsigned h = args[3]->IntegerValue();
-
-    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
-    return scope.Close(ImageView::New(im,x,y,w,h));
-}
-
-Handle<Value> Image::save(const Arguments& args)
-{
-    HandleScope scope;
-
-    if (args.Length() == 0 || !args[0]->IsString()){
-        return ThrowException(Exception::TypeError(
-                                  String::New("filename required")));
-    }
-
-    std::string filename = TOSTR(args[0]);
-
-    std::string format("");
-
-    if (args.Length() >= 2) {
-        if (!args[1]->IsString())
-            return ThrowException(Exception::TypeError(
-                                      String::New("both 'filename' and 'format' arguments must be strings")));
-        format = TOSTR(args[1]);
-    }
-    else
-    {
-        format = mapnik::guess_type(filename);
-        if (format == "<unknown>") {
-            std::ostringstream s("");
-            s << "unknown output extension for: " << filename << "\n";
-            return ThrowException(Exception::Error(
-                                      String::New(s.str().c_str())));
-        }
-    }
-
-    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
-    try
-    {
-        mapnik::save_to_file<mapnik::image_data_32>(im->get()->data(),filename, format);
-    }
-    catch (std::exception const& ex)
-    {
-        return ThrowException(Exception::Error(
-                                  String::New(ex.what())));
-    }
-    return Undefined();
-}
+struct encode_many_baton_t;
 
-#if MAPNIK_VERSION >= 200100
+struct encode_many_job_t {
+    uv_work_t request;
+    encode_many_baton_t* closure;
+    std::string format;
+    palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
+    bool auto_format;
+    boost::shared_ptr<node_mapnik::encode_buffer> result;
+    std::string error_name;
+};
 
-typedef struct {
+struct encode_many_baton_t {
     uv_work_t request;
-    Image* im1;
-    Image* im2;
-    mapnik::composite_mode_e mode;
-    int dx;
-    int dy;
-    float opacity;
-    std::vector<mapnik::filter::filter_type> filters;
+    Image* im;
+    bool premultiplied;
+    // the straight alpha pixels every job encodes, scratch holds them when
+    // the image is premultiplied
+    boost::shared_ptr<mapnik::image_data_32> scratch;
+    mapnik::image_data_32 const* data;
+    std::vector<encode_many_job_t> jobs;
+    // jobs queued and not yet back
+    unsigned pending;
+    bool auto_format;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
-} composite_image_baton_t;
+};
 
-Handle<Value> Image::composite(const Arguments& args)
+Handle<Value> Image::encodeMany(const Arguments& args)
 {
     HandleScope scope;
 
-    if (args.Length() < 1){
-        return ThrowException(Exception::TypeError(
-                                  String::New("requires at least one argument: an image mask")));
-    }
-
-    if (!args[0]->IsObject()) {
+    if (args.Length() < 2 || !args[0]->IsArray()) {
         return ThrowException(Exception::TypeError(
-                                  String::New("first argument must be an image mask")));
+                                  String::New("requires an array of {format: 'png', ...} objects and a callback")));
     }
 
-    Local<Object> im2 = args[0]->ToObject();
-    if (im2->IsNull() || im2->IsUndefined() || !Image::constructor->HasInstance(im2))
-        return ThrowException(Exception::TypeError(String::New("mapnik.Image expected as first arg")));
-
     // ensure callback is a function
     Local<Value> callback = args[args.Length()-1];
     if (!args[args.Length()-1]->IsFunction())
         return ThrowException(Exception::TypeError(
                                   String::New("last argument must be a callback function")));
 
-    try
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    std::vector<encode_many_job_t> jobs;
+    bool auto_format = false;
+    Local<Array> a = Local<Array>::Cast(args[0]);
+    unsigned int num_formats = a->Length();
+    if (num_formats == 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires at least one format")));
+    for (unsigned int i = 0; i < num_formats; ++i)
     {
-        mapnik::composite_mode_e mode = mapnik::src_over;
-        float opacity = 1.0;
-        std::vector<mapnik::filter::filter_type> filters;
-        int dx = 0;
-        int dy = 0;
-        if (args.Length() >= 2) {
-            if (!args[1]->IsObject())
+        Local<Value> item = a->Get(i);
+        if (!item->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("each format must be an object like {format: 'png'}")));
+        Local<Object> options = item->ToObject();
+        Local<Value> format_opt = options->Get(String::New("format"));
+        if (!format_opt->IsString())
+            return ThrowException(Exception::TypeError(
+                                      String::New("each format needs a 'format' string")));
+        encode_many_job_t job;
+        job.format = TOSTR(format_opt);
+        if (options->Has(String::New("palette")))
+        {
+            Local<Value> palette_opt = options->Get(String::New("palette"));
+            if (!palette_opt->IsObject())
                 return ThrowException(Exception::TypeError(
-                                          String::New("optional second arg must be an options object")));
-
-            Local<Object> options = args[1]->ToObject();
-
-            if (options->Has(String::New("comp_op")))
-            {
-                Local<Value> opt = options->Get(String::New("comp_op"));
-                if (!opt->IsNumber()) {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("comp_op must be a mapnik.compositeOp value")));
-                }
-                mode = static_cast<mapnik::composite_mode_e>(opt->IntegerValue());
-            }
-
-            if (options->Has(String::New("opacity")))
-            {
-                Local<Value> opt = options->Get(String::New("opacity"));
-                if (!opt->IsNumber()) {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("opacity must be a floating point number")));
-                }
-                opacity = opt->NumberValue();
-            }
-
-            if (options->Has(String::New("dx")))
-            {
-                Local<Value> opt = options->Get(String::New("dx"));
-                if (!opt->IsNumber()) {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("dx must be an integer")));
-                }
-                dx = opt->IntegerValue();
-            }
+                                          String::New("'palette' must be an object")));
 
-            if (options->Has(String::New("dy")))
-            {
-                Local<Value> opt = options->Get(String::New("dy"));
-                if (!opt->IsNumber()) {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("dy must be an integer")));
-                }
-                dy = opt->IntegerValue();
-            }
+            Local<Object> obj = palette_opt->ToObject();
+            if (obj->IsNull() || obj->IsUndefined() || !Palette::constructor->HasInstance(obj))
+                return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as 'palette'")));
 
-            if (options->Has(String::New("image_filters")))
-            {
-                Local<Value> opt = options->Get(String::New("image_filters"));
-                if (!opt->IsString()) {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("image_filters argument must string of filter names")));
-                }
-                std::string filter_str = TOSTR(opt);
-                bool result = mapnik::filter::parse_image_filters(filter_str, filters);
-                if (!result)
-                {
-                    return ThrowException(Exception::TypeError(
-                                              String::New("could not parse image_filters")));
-                }
-            }
+            job.palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            job.lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
+        job.auto_format = (job.format == "auto");
+        if (job.auto_format && job.palette.get())
+            return ThrowException(Exception::TypeError(
+                                      String::New("'auto' format does not accept a palette")));
+        auto_format = auto_format || job.auto_format;
+        job.result = boost::make_shared<node_mapnik::encode_buffer>();
+        jobs.push_back(job);
+    }
 
-        composite_image_baton_t *closure = new composite_image_baton_t();
-        closure->request.data = closure;
-        closure->im1 = node::ObjectWrap::Unwrap<Image>(args.This());
-        closure->im2 = node::ObjectWrap::Unwrap<Image>(im2);
-        closure->mode = mode;
-        closure->opacity = opacity;
-        closure->filters = filters;
-        closure->dx = dx;
-        closure->dy = dy;
-        closure->error = false;
-        closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
-        uv_queue_work(uv_default_loop(), &closure->request, EIO_Composite, (uv_after_work_cb)EIO_AfterComposite);
-        closure->im1->Ref();
-        closure->im2->Ref();
+    encode_many_baton_t *closure = new encode_many_baton_t();
+    closure->request.data = closure;
+    closure->im = im;
+    closure->premultiplied = im->premultiplied_;
+    closure->data = 0;
+    closure->jobs = jobs;
+    for (std::size_t i = 0; i < closure->jobs.size(); ++i)
+    {
+        closure->jobs[i].closure = closure;
+    }
+    closure->pending = 0;
+    closure->auto_format = auto_format;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_EncodeMany, (uv_after_work_cb)EIO_AfterEncodeMany);
+    im->Ref();
+    return Undefined();
+}
+
+static void run_encode_many_job(encode_many_job_t & job)
+{
+    try
+    {
+        node_mapnik::encode_pixels(*job.closure->data, job.format, job.palette, job.lookup, 1, *job.result);
     }
     catch (std::exception const& ex)
     {
-        return ThrowException(Exception::Error(String::New(ex.what())));
+        job.error_name = ex.what();
     }
-    return Undefined();
 }
 
-void Image::EIO_Composite(uv_work_t* req)
+// mapnik's own palette quantizer caches lookups inside the palette, so
+// those encodes are not run concurrently
+static bool encode_many_on_own_work(encode_many_job_t const& job)
 {
-    composite_image_baton_t *closure = static_cast<composite_image_baton_t *>(req->data);
+    return !job.palette.get() || node_mapnik::png8_lookup_support(job.format);
+}
+
+void Image::EIO_EncodeMany(uv_work_t* req)
+{
+    encode_many_baton_t *closure = static_cast<encode_many_baton_t *>(req->data);
 
     try
     {
-        if (closure->filters.size() > 0)
+        // the pixels are demultiplied (into a copy, the image may be shared
+        // with other work) and profiled once for every format
+        closure->data = &straight_pixels(closure->im->this_->data(), closure->premultiplied, closure->scratch);
+        if (closure->auto_format)
         {
-            mapnik::filter::filter_visitor<mapnik::image_32> visitor(*closure->im2->this_);
-            BOOST_FOREACH(mapnik::filter::filter_type const& filter_tag, closure->filters)
+            std::string format = node_mapnik::choose_format(node_mapnik::profile_image(*closure->data));
+            for (std::size_t i = 0; i < closure->jobs.size(); ++i)
             {
-                boost::apply_visitor(visitor, filter_tag);
+                if (closure->jobs[i].auto_format) closure->jobs[i].format = format;
             }
         }
-        mapnik::composite(closure->im1->this_->data(),closure->im2->this_->data(), closure->mode, closure->opacity, closure->dx, closure->dy);
     }
     catch (std::exception const& ex)
     {
         closure->error = true;
         closure->error_name = ex.what();
+        return;
+    }
+
+    for (std::size_t i = 0; i < closure->jobs.size(); ++i)
+    {
+        if (!encode_many_on_own_work(closure->jobs[i])) run_encode_many_job(closure->jobs[i]);
     }
 }
 
-void Image::EIO_AfterComposite(uv_work_t* req)
+// calls back once every job is done
+static void encode_many_done(encode_many_baton_t *closure)
 {
     HandleScope scope;
 
-    composite_image_baton_t *closure = static_cast<composite_image_baton_t *>(req->data);
-
-    TryCatch try_catch;
+    for (std::size_t i = 0; i < closure->jobs.size() && !closure->error; ++i)
+    {
+        if (!closure->jobs[i].error_name.empty())
+        {
+            closure->error = true;
+            closure->error_name = closure->jobs[i].error_name;
+        }
+    }
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Array> buffers = Array::New(closure->jobs.size());
+        Local<Array> formats = Array::New(closure->jobs.size());
+        for (unsigned i = 0; i < closure->jobs.size(); ++i)
+        {
+            buffers->Set(i, closure->jobs[i].result->to_node_buffer());
+            formats->Set(i, String::New(closure->jobs[i].format.c_str()));
+        }
+        if (closure->auto_format)
+        {
+            Local<Value> argv[3] = { Local<Value>::New(Null()), buffers, formats };
+            closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
+        }
+        else
+        {
+            Local<Value> argv[2] = { Local<Value>::New(Null()), buffers };
+            closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+        }
+    }
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->im->_unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+void Image::EIO_AfterEncodeMany(uv_work_t* req)
+{
+    encode_many_baton_t *closure = static_cast<encode_many_baton_t *>(req->data);
+
+    // the remaining encoders each run as their own threadpool work
+    if (!closure->error)
+    {
+        for (std::size_t i = 0; i < closure->jobs.size(); ++i)
+        {
+            encode_many_job_t & job = closure->jobs[i];
+            if (encode_many_on_own_work(job))
+            {
+                job.request.data = &job;
+                uv_queue_work(uv_default_loop(), &job.request, EIO_EncodeManyJob, (uv_after_work_cb)EIO_AfterEncodeManyJob);
+                ++closure->pending;
+            }
+        }
+    }
+    if (closure->pending == 0) encode_many_done(closure);
+}
+
+void Image::EIO_EncodeManyJob(uv_work_t* req)
+{
+    run_encode_many_job(*static_cast<encode_many_job_t *>(req->data));
+}
+
+void Image::EIO_AfterEncodeManyJob(uv_work_t* req)
+{
+    encode_many_baton_t *closure = static_cast<encode_many_job_t *>(req->data)->closure;
+    if (--closure->pending == 0) encode_many_done(closure);
+}
+
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    unsigned width;
+    unsigned height;
+    node_mapnik::resize_filter filter;
+    bool premultiplied;
+    // whether the source pixels were premultiplied when queued
+    bool src_premultiplied;
+    image_ptr result;
+    bool result_premultiplied;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} resize_image_baton_t;
+
+Handle<Value> Image::resize(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 3 || !args[0]->IsNumber() || !args[1]->IsNumber())
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires a width, a height and a callback")));
+
+    int width = args[0]->IntegerValue();
+    int height = args[1]->IntegerValue();
+    if (width <= 0 || height <= 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("width and height must be positive integers")));
+
+    node_mapnik::resize_filter filter = node_mapnik::RESIZE_BILINEAR;
+    bool premultiplied = true;
+    if (args.Length() >= 4) {
+        if (!args[2]->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional third arg must be an options object")));
+        Local<Object> options = args[2]->ToObject();
+        if (options->Has(String::New("filter")))
+        {
+            Local<Value> filter_opt = options->Get(String::New("filter"));
+            if (!filter_opt->IsString() || !node_mapnik::parse_resize_filter(TOSTR(filter_opt), filter))
+                return ThrowException(Exception::TypeError(
+                                          String::New("'filter' must be 'bilinear', 'bicubic' or 'lanczos'")));
+        }
+        if (options->Has(String::New("premultiplied")))
+        {
+            Local<Value> premultiplied_opt = options->Get(String::New("premultiplied"));
+            if (!premultiplied_opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("'premultiplied' must be a boolean")));
+            premultiplied = premultiplied_opt->BooleanValue();
+        }
+    }
+
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    resize_image_baton_t *closure = new resize_image_baton_t();
+    closure->request.data = closure;
+    closure->im = node::ObjectWrap::Unwrap<Image>(args.This());
+    closure->width = width;
+    closure->height = height;
+    closure->filter = filter;
+    closure->premultiplied = premultiplied;
+    closure->src_premultiplied = closure->im->premultiplied_;
+    closure->result_premultiplied = false;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_Resize, (uv_after_work_cb)EIO_AfterResize);
+    closure->im->Ref();
+    return Undefined();
+}
+
+void Image::EIO_Resize(uv_work_t* req)
+{
+    resize_image_baton_t *closure = static_cast<resize_image_baton_t *>(req->data);
+
+    try
+    {
+        // filtering straight alpha bleeds the color of transparent pixels
+        // into their neighbours, so resample premultiplied unless asked not
+        // to. The source may be shared with other work, so straight pixels
+        // are premultiplied as resize_image reads them.
+        bool premultiply_src = closure->premultiplied && !closure->src_premultiplied;
+        closure->result_premultiplied = closure->premultiplied || closure->src_premultiplied;
+        closure->result = boost::make_shared<mapnik::image_32>(closure->width, closure->height);
+        node_mapnik::resize_image(closure->im->this_->data(),
+                                  closure->result->data(),
+                                  closure->filter,
+                                  closure->result_premultiplied,
+                                  premultiply_src);
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Image::EIO_AfterResize(uv_work_t* req)
+{
+    HandleScope scope;
+
+    resize_image_baton_t *closure = static_cast<resize_image_baton_t *>(req->data);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Image* im = new Image(closure->result);
+        im->set_premultiplied(closure->result_premultiplied);
+        Handle<Value> ext = External::New(im);
+        Local<Object> image_obj = constructor->GetFunction()->NewInstance(1, &ext);
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(ObjectWrap::Unwrap<Image>(image_obj)->handle_) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    Image* other;
+    // the alpha state of each image when queued
+    bool premultiplied;
+    bool other_premultiplied;
+    unsigned threshold;
+    bool alpha;
+    bool want_diff;
+    std::size_t different;
+    unsigned max_delta;
+    image_ptr diff;
+    Persistent<Function> cb;
+} compare_image_baton_t;
+
+Handle<Value> Image::compare(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[0]->IsObject())
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires a mapnik.Image and a callback")));
+
+    Local<Object> obj = args[0]->ToObject();
+    if (obj->IsNull() || obj->IsUndefined() || !Image::constructor->HasInstance(obj))
+        return ThrowException(Exception::TypeError(String::New("mapnik.Image expected as first arg")));
+
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    Image* other = node::ObjectWrap::Unwrap<Image>(obj);
+    if (im->this_->width() != other->this_->width() || im->this_->height() != other->this_->height())
+        return ThrowException(Exception::TypeError(String::New("images must have the same dimensions")));
+
+    unsigned threshold = 16;
+    bool alpha = true;
+    bool want_diff = false;
+    if (args.Length() >= 3) {
+        if (!args[1]->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional second arg must be an options object")));
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(String::New("threshold")))
+        {
+            Local<Value> threshold_opt = options->Get(String::New("threshold"));
+            if (!threshold_opt->IsNumber() || threshold_opt->NumberValue() < 0)
+                return ThrowException(Exception::TypeError(
+                                          String::New("'threshold' must be a non negative integer")));
+            // no channel can differ by more than 255
+            threshold = static_cast<unsigned>(std::min(threshold_opt->NumberValue(), 255.0));
+        }
+        if (options->Has(String::New("alpha")))
+        {
+            Local<Value> alpha_opt = options->Get(String::New("alpha"));
+            if (!alpha_opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("'alpha' must be a boolean")));
+            alpha = alpha_opt->BooleanValue();
+        }
+        if (options->Has(String::New("diff")))
+        {
+            Local<Value> diff_opt = options->Get(String::New("diff"));
+            if (!diff_opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("'diff' must be a boolean")));
+            want_diff = diff_opt->BooleanValue();
+        }
+    }
+
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    compare_image_baton_t *closure = new compare_image_baton_t();
+    closure->request.data = closure;
+    closure->im = im;
+    closure->other = other;
+    closure->premultiplied = im->premultiplied_;
+    closure->other_premultiplied = other->premultiplied_;
+    closure->threshold = threshold;
+    closure->alpha = alpha;
+    closure->want_diff = want_diff;
+    closure->different = 0;
+    closure->max_delta = 0;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_Compare, (uv_after_work_cb)EIO_AfterCompare);
+    im->Ref();
+    other->Ref();
+    return Undefined();
+}
+
+void Image::EIO_Compare(uv_work_t* req)
+{
+    compare_image_baton_t *closure = static_cast<compare_image_baton_t *>(req->data);
+    mapnik::image_data_32 const& a = closure->im->this_->data();
+    mapnik::image_data_32 const& b = closure->other->this_->data();
+    if (closure->want_diff)
+    {
+        closure->diff = boost::make_shared<mapnik::image_32>(a.width(), a.height());
+    }
+    // pixels are compared in straight alpha, premultiplied rows are
+    // demultiplied into scratch rows since the images may be shared
+    std::vector<unsigned> a_row(closure->premultiplied ? a.width() : 0);
+    std::vector<unsigned> b_row(closure->other_premultiplied ? b.width() : 0);
+    for (unsigned y = 0; y < a.height(); ++y)
+    {
+        unsigned const* a_pixels = a.getRow(y);
+        unsigned const* b_pixels = b.getRow(y);
+        if (closure->premultiplied)
+        {
+            std::copy(a_pixels, a_pixels + a.width(), a_row.begin());
+            node_mapnik::demultiply(reinterpret_cast<unsigned char *>(&a_row[0]), a.width());
+            a_pixels = &a_row[0];
+        }
+        if (closure->other_premultiplied)
+        {
+            std::copy(b_pixels, b_pixels + b.width(), b_row.begin());
+            node_mapnik::demultiply(reinterpret_cast<unsigned char *>(&b_row[0]), b.width());
+            b_pixels = &b_row[0];
+        }
+        closure->different += node_mapnik::compare_row(a_pixels, b_pixels, a.width(),
+                                                       closure->threshold, closure->alpha,
+                                                       closure->diff ? closure->diff->data().getRow(y) : 0,
+                                                       closure->max_delta);
+    }
+}
+
+void Image::EIO_AfterCompare(uv_work_t* req)
+{
+    HandleScope scope;
+
+    compare_image_baton_t *closure = static_cast<compare_image_baton_t *>(req->data);
+
+    TryCatch try_catch;
+
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("different"), Number::New(static_cast<double>(closure->different)));
+    result->Set(String::NewSymbol("max_delta"), Integer::NewFromUnsigned(closure->max_delta));
+    if (closure->diff)
+    {
+        Image* im = new Image(closure->diff);
+        Handle<Value> ext = External::New(im);
+        result->Set(String::NewSymbol("diff"), constructor->GetFunction()->NewInstance(1, &ext));
+    }
+    Local<Value> argv[2] = { Local<Value>::New(Null()), result };
+    closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->im->Unref();
+    closure->other->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+bool Image::stats_max_colors(const Arguments& args, unsigned & max_colors)
+{
+    max_colors = 256;
+    if (args.Length() < 2) return true;
+    if (!args[0]->IsObject())
+    {
+        ThrowException(Exception::TypeError(
+                           String::New("optional first arg must be an options object")));
+        return false;
+    }
+    Local<Object> options = args[0]->ToObject();
+    if (options->Has(String::New("max_colors")))
+    {
+        Local<Value> max_colors_opt = options->Get(String::New("max_colors"));
+        if (!max_colors_opt->IsNumber() || max_colors_opt->NumberValue() < 0 ||
+            max_colors_opt->NumberValue() > node_mapnik::max_stats_colors)
+        {
+            ThrowException(Exception::TypeError(
+                               String::New("'max_colors' must be an integer from 0 to 65536")));
+            return false;
+        }
+        max_colors = static_cast<unsigned>(max_colors_opt->NumberValue());
+    }
+    return true;
+}
+
+Local<Object> Image::stats_object(node_mapnik::image_stats const& stats)
+{
+    HandleScope scope;
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("pixels"), Number::New(static_cast<double>(stats.pixels)));
+    result->Set(String::NewSymbol("transparent"), Number::New(static_cast<double>(stats.histogram[3][0])));
+    result->Set(String::NewSymbol("opaque"), Number::New(static_cast<double>(stats.histogram[3][255])));
+    result->Set(String::NewSymbol("colors"), Integer::NewFromUnsigned(stats.colors));
+    result->Set(String::NewSymbol("colors_capped"), Boolean::New(stats.colors_capped));
+    char const* names[4] = { "r", "g", "b", "a" };
+    for (unsigned c = 0; c < 4; ++c)
+    {
+        node_mapnik::channel_summary summary = node_mapnik::summarize_channel(stats, c);
+        Local<Object> channel = Object::New();
+        channel->Set(String::NewSymbol("min"), Integer::NewFromUnsigned(summary.min));
+        channel->Set(String::NewSymbol("max"), Integer::NewFromUnsigned(summary.max));
+        channel->Set(String::NewSymbol("mean"), Number::New(summary.mean));
+        Local<Object> histogram = node_mapnik::new_uint32_array(256);
+        unsigned * bins = static_cast<unsigned *>(histogram->GetIndexedPropertiesExternalArrayData());
+        for (unsigned v = 0; v < 256; ++v)
+        {
+            bins[v] = static_cast<unsigned>(stats.histogram[c][v]);
+        }
+        channel->Set(String::NewSymbol("histogram"), histogram);
+        result->Set(String::NewSymbol(names[c]), channel);
+    }
+    return scope.Close(result);
+}
+
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    bool premultiplied;
+    unsigned max_colors;
+    node_mapnik::image_stats stats;
+    Persistent<Function> cb;
+} image_stats_baton_t;
+
+Handle<Value> Image::stats(const Arguments& args)
+{
+    HandleScope scope;
+
+    // ensure callback is a function
+    if (args.Length() == 0 || !args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    unsigned max_colors;
+    if (!stats_max_colors(args, max_colors))
+        return Undefined();
+
+    image_stats_baton_t *closure = new image_stats_baton_t();
+    closure->request.data = closure;
+    closure->im = node::ObjectWrap::Unwrap<Image>(args.This());
+    // stats are of straight colors, read in place and demultiplied by row
+    closure->premultiplied = closure->im->premultiplied();
+    closure->max_colors = max_colors;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_Stats, (uv_after_work_cb)EIO_AfterStats);
+    closure->im->Ref();
+    return Undefined();
+}
+
+void Image::EIO_Stats(uv_work_t* req)
+{
+    image_stats_baton_t *closure = static_cast<image_stats_baton_t *>(req->data);
+    node_mapnik::stats_image(closure->im->this_->data(), closure->premultiplied, closure->max_colors, closure->stats);
+}
+
+void Image::EIO_AfterStats(uv_work_t* req)
+{
+    HandleScope scope;
+
+    image_stats_baton_t *closure = static_cast<image_stats_baton_t *>(req->data);
+
+    TryCatch try_catch;
+
+    Local<Value> argv[2] = { Local<Value>::New(Null()), stats_object(closure->stats) };
+    closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+Handle<Value> Image::view(const Arguments& args)
+{
+    HandleScope scope;
+
+    if ( (args.Length() != 4) || (!args[0]->IsNumber() && !args[1]->IsNumber() && !args[2]->IsNumber() && !args[3]->IsNumber() ))
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires 4 integer arguments: x, y, width, height")));
+
+    // TODO parse args
+    unsigned x = args[0]->IntegerValue();
+    unsigned y = args[1]->IntegerValue();
+    unsigned w = args[2]->IntegerValue();
+    unsigned h = args[3]->IntegerValue();
+
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    return scope.Close(ImageView::New(im,x,y,w,h));
+}
+
+Handle<Value> Image::save(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() == 0 || !args[0]->IsString()){
+        return ThrowException(Exception::TypeError(
+                                  String::New("filename required")));
+    }
+
+    std::string filename = TOSTR(args[0]);
+
+    std::string format("");
+
+    if (args.Length() >= 2) {
+        if (!args[1]->IsString())
+            return ThrowException(Exception::TypeError(
+                                      String::New("both 'filename' and 'format' arguments must be strings")));
+        format = TOSTR(args[1]);
+    }
+    else
+    {
+        format = mapnik::guess_type(filename);
+        if (format == "<unknown>") {
+            std::ostringstream s("");
+            s << "unknown output extension for: " << filename << "\n";
+            return ThrowException(Exception::Error(
+                                      String::New(s.str().c_str())));
+        }
+    }
+
+    Image* im = node::ObjectWrap::Unwrap<Image>(args.This());
+    try
+    {
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        mapnik::save_to_file<mapnik::image_data_32>(straight_pixels(im->get()->data(), im->premultiplied_, scratch),filename, format);
+    }
+    catch (std::exception const& ex)
+    {
+        return ThrowException(Exception::Error(
+                                  String::New(ex.what())));
+    }
+    return Undefined();
+}
+
+#if MAPNIK_VERSION >= 200100
+
+typedef struct {
+    uv_work_t request;
+    Image* im1;
+    Image* im2;
+    mapnik::composite_mode_e mode;
+    int dx;
+    int dy;
+    float opacity;
+    std::vector<mapnik::filter::filter_type> filters;
+    // alpha states when queued, dst_premultiplied is set once the
+    // destination has been converted
+    bool src_premultiplied;
+    bool dst_premultiplied;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} composite_image_baton_t;
+
+// one entry of a compositeMany stack
+struct composite_layer_t {
+    Image* im;
+    mapnik::composite_mode_e mode;
+    float opacity;
+    int dx;
+    int dy;
+    std::vector<mapnik::filter::filter_type> filters;
+    bool premultiplied;
+    composite_layer_t() :
+        im(NULL),
+        mode(mapnik::src_over),
+        opacity(1.0),
+        dx(0),
+        dy(0),
+        filters(),
+        premultiplied(false) {}
+};
+
+// parses comp_op, opacity, dx, dy and image_filters, shared by composite
+// and compositeMany
+static bool parse_composite_options(Local<Object> options,
+                                    composite_layer_t & layer,
+                                    std::string & error_msg)
+{
+    if (options->Has(String::New("comp_op")))
+    {
+        Local<Value> opt = options->Get(String::New("comp_op"));
+        if (!opt->IsNumber()) {
+            error_msg = "comp_op must be a mapnik.compositeOp value";
+            return false;
+        }
+        layer.mode = static_cast<mapnik::composite_mode_e>(opt->IntegerValue());
+    }
+
+    if (options->Has(String::New("opacity")))
+    {
+        Local<Value> opt = options->Get(String::New("opacity"));
+        if (!opt->IsNumber()) {
+            error_msg = "opacity must be a floating point number";
+            return false;
+        }
+        layer.opacity = opt->NumberValue();
+    }
+
+    if (options->Has(String::New("dx")))
+    {
+        Local<Value> opt = options->Get(String::New("dx"));
+        if (!opt->IsNumber()) {
+            error_msg = "dx must be an integer";
+            return false;
+        }
+        layer.dx = opt->IntegerValue();
+    }
+
+    if (options->Has(String::New("dy")))
+    {
+        Local<Value> opt = options->Get(String::New("dy"));
+        if (!opt->IsNumber()) {
+            error_msg = "dy must be an integer";
+            return false;
+        }
+        layer.dy = opt->IntegerValue();
+    }
+
+    if (options->Has(String::New("image_filters")))
+    {
+        Local<Value> opt = options->Get(String::New("image_filters"));
+        if (!opt->IsString()) {
+            error_msg = "image_filters argument must string of filter names";
+            return false;
+        }
+        std::string filter_str = TOSTR(opt);
+        bool result = mapnik::filter::parse_image_filters(filter_str, layer.filters);
+        if (!result)
+        {
+            error_msg = "could not parse image_filters";
+            return false;
+        }
+    }
+    return true;
+}
+
+Handle<Value> Image::composite(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1){
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires at least one argument: an image mask")));
+    }
+
+    if (!args[0]->IsObject()) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("first argument must be an image mask")));
+    }
+
+    Local<Object> im2 = args[0]->ToObject();
+    if (im2->IsNull() || im2->IsUndefined() || !Image::constructor->HasInstance(im2))
+        return ThrowException(Exception::TypeError(String::New("mapnik.Image expected as first arg")));
+
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    try
+    {
+        composite_layer_t layer;
+        if (args.Length() >= 2) {
+            if (!args[1]->IsObject())
+                return ThrowException(Exception::TypeError(
+                                          String::New("optional second arg must be an options object")));
+
+            std::string error_msg;
+            if (!parse_composite_options(args[1]->ToObject(), layer, error_msg))
+            {
+                return ThrowException(Exception::TypeError(String::New(error_msg.c_str())));
+            }
+        }
+        composite_image_baton_t *closure = new composite_image_baton_t();
+        closure->request.data = closure;
+        closure->im1 = node::ObjectWrap::Unwrap<Image>(args.This());
+        closure->im2 = node::ObjectWrap::Unwrap<Image>(im2);
+        closure->mode = layer.mode;
+        closure->opacity = layer.opacity;
+        closure->filters = layer.filters;
+        closure->dx = layer.dx;
+        closure->dy = layer.dy;
+        closure->src_premultiplied = closure->im2->premultiplied_;
+        closure->dst_premultiplied = closure->im1->premultiplied_;
+        closure->error = false;
+        closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+        uv_queue_work(uv_default_loop(), &closure->request, EIO_Composite, (uv_after_work_cb)EIO_AfterComposite);
+        closure->im1->Ref();
+        closure->im2->Ref();
+    }
+    catch (std::exception const& ex)
+    {
+        return ThrowException(Exception::Error(String::New(ex.what())));
+    }
+    return Undefined();
+}
+
+#if MAPNIK_VERSION >= 200200
+
+// comp_ops that have a vectorized blender in pixel_kernels
+static bool composite_blend_mode(mapnik::composite_mode_e mode, node_mapnik::blend_mode & blend)
+{
+    switch (mode)
+    {
+    case mapnik::src_over:
+        blend = node_mapnik::BLEND_SRC_OVER;
+        return true;
+    case mapnik::multiply:
+        blend = node_mapnik::BLEND_MULTIPLY;
+        return true;
+    case mapnik::screen:
+        blend = node_mapnik::BLEND_SCREEN;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// a source image positioned on the destination: offset by dx/dy and
+// clipped like agg::renderer_base::blend_from
+struct blend_layer_t {
+    mapnik::image_data_32 const* src;
+    node_mapnik::blend_mode blend;
+    unsigned cover;
+    int dx;
+    int dy;
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+static bool make_blend_layer(mapnik::image_data_32 const& dst,
+                             mapnik::image_data_32 const& src,
+                             node_mapnik::blend_mode blend,
+                             float opacity,
+                             int dx,
+                             int dy,
+                             blend_layer_t & layer)
+{
+    layer.src = &src;
+    layer.blend = blend;
+    // agg takes the cover as int8u
+    layer.cover = static_cast<unsigned char>(unsigned(255 * opacity));
+    layer.dx = dx;
+    layer.dy = dy;
+    layer.x0 = std::max(0, dx);
+    layer.y0 = std::max(0, dy);
+    layer.x1 = std::min(static_cast<int>(dst.width()), static_cast<int>(src.width()) + dx);
+    layer.y1 = std::min(static_cast<int>(dst.height()), static_cast<int>(src.height()) + dy);
+    return layer.x0 < layer.x1 && layer.y0 < layer.y1;
+}
+
+// Same result as calling mapnik::composite with a premultiplied source for
+// each layer in turn, but the whole stack is applied to one destination
+// row before moving to the next so the row stays in cache.
+static void composite_rows(mapnik::image_data_32 & dst,
+                           std::vector<blend_layer_t> const& layers)
+{
+    for (int y = 0; y < static_cast<int>(dst.height()); ++y)
+    {
+        unsigned char * row = reinterpret_cast<unsigned char *>(dst.getRow(y));
+        BOOST_FOREACH(blend_layer_t const& layer, layers)
+        {
+            if (y < layer.y0 || y >= layer.y1) continue;
+            node_mapnik::blend_row(layer.blend,
+                                   row + layer.x0 * 4,
+                                   reinterpret_cast<unsigned char const*>(layer.src->getRow(y - layer.dy) + (layer.x0 - layer.dx)),
+                                   layer.x1 - layer.x0,
+                                   layer.cover);
+        }
+    }
+}
+
+#endif
+
+// The premultiplied pixels to composite from src: its own when they
+// already are and nothing changes them, else a converted and filtered
+// copy kept alive by scratch. Sources can be shared by other work, only
+// the destination is ever modified.
+static mapnik::image_data_32 & composite_source(Image * src,
+                                               bool premultiplied,
+                                               bool copy,
+                                               std::vector<mapnik::filter::filter_type> const& filters,
+                                               boost::shared_ptr<mapnik::image_32> & scratch)
+{
+    if (premultiplied && !copy && filters.empty())
+    {
+        return src->get()->data();
+    }
+    scratch = node_mapnik::premultiplied_copy(src->get()->data(), premultiplied);
+    if (!filters.empty())
+    {
+        mapnik::filter::filter_visitor<mapnik::image_32> visitor(*scratch);
+        BOOST_FOREACH(mapnik::filter::filter_type const& filter_tag, filters)
+        {
+            boost::apply_visitor(visitor, filter_tag);
+        }
+    }
+    return scratch->data();
+}
+
+void Image::EIO_Composite(uv_work_t* req)
+{
+    composite_image_baton_t *closure = static_cast<composite_image_baton_t *>(req->data);
+
+    try
+    {
+        // compositing works on premultiplied pixels. The source is taken
+        // before the destination is converted, they can be the same image.
+        boost::shared_ptr<mapnik::image_32> scratch;
+        mapnik::image_data_32 & src = composite_source(closure->im2,
+                                                       closure->src_premultiplied,
+                                                       closure->im1 == closure->im2,
+                                                       closure->filters,
+                                                       scratch);
+        mapnik::image_data_32 & dst = closure->im1->this_->data();
+        if (!closure->dst_premultiplied)
+        {
+            node_mapnik::premultiply(dst.getBytes(), dst.width() * dst.height());
+            closure->dst_premultiplied = true;
+        }
+#if MAPNIK_VERSION >= 200200
+        node_mapnik::blend_mode blend;
+        if (composite_blend_mode(closure->mode, blend))
+        {
+            std::vector<blend_layer_t> layers(1);
+            if (make_blend_layer(dst,
+                                 src,
+                                 blend,
+                                 closure->opacity,
+                                 closure->dx,
+                                 closure->dy,
+                                 layers[0]))
+            {
+                composite_rows(dst,layers);
+            }
+        }
+        else
+        {
+            mapnik::composite(dst,src, closure->mode, closure->opacity, closure->dx, closure->dy, false);
+        }
+#else
+        mapnik::composite(dst,src, closure->mode, closure->opacity, closure->dx, closure->dy);
+#endif
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Image::EIO_AfterComposite(uv_work_t* req)
+{
+    HandleScope scope;
+
+    composite_image_baton_t *closure = static_cast<composite_image_baton_t *>(req->data);
+
+    TryCatch try_catch;
 
+    closure->im1->premultiplied_ = closure->dst_premultiplied;
     if (closure->error) {
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
@@ -1225,6 +2665,184 @@ void Image::EIO_AfterComposite(uv_work_t* req)
     delete closure;
 }
 
+typedef struct {
+    uv_work_t request;
+    Image* im;
+    std::vector<composite_layer_t> layers;
+    // set once the destination has been converted
+    bool premultiplied;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} composite_many_baton_t;
+
+Handle<Value> Image::compositeMany(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[0]->IsArray()) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires an array of {image: mapnik.Image, ...} objects and a callback")));
+    }
+
+    // ensure callback is a function
+    Local<Value> callback = args[args.Length()-1];
+    if (!args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    std::vector<composite_layer_t> layers;
+    try
+    {
+        Local<Array> a = Local<Array>::Cast(args[0]);
+        unsigned int num_layers = a->Length();
+        for (unsigned int i = 0; i < num_layers; ++i)
+        {
+            Local<Value> item = a->Get(i);
+            if (!item->IsObject())
+                return ThrowException(Exception::TypeError(
+                                          String::New("each layer must be an object like {image: mapnik.Image}")));
+            Local<Object> options = item->ToObject();
+            Local<Value> image = options->Get(String::New("image"));
+            if (!image->IsObject() || !Image::constructor->HasInstance(image->ToObject()))
+                return ThrowException(Exception::TypeError(
+                                          String::New("each layer needs an 'image' property holding a mapnik.Image")));
+            composite_layer_t layer;
+            layer.im = node::ObjectWrap::Unwrap<Image>(image->ToObject());
+            layer.premultiplied = layer.im->premultiplied_;
+            std::string error_msg;
+            if (!parse_composite_options(options, layer, error_msg))
+            {
+                return ThrowException(Exception::TypeError(String::New(error_msg.c_str())));
+            }
+            layers.push_back(layer);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        return ThrowException(Exception::Error(String::New(ex.what())));
+    }
+
+    composite_many_baton_t *closure = new composite_many_baton_t();
+    closure->request.data = closure;
+    closure->im = node::ObjectWrap::Unwrap<Image>(args.This());
+    closure->layers = layers;
+    closure->premultiplied = closure->im->premultiplied_;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_CompositeMany, (uv_after_work_cb)EIO_AfterCompositeMany);
+    closure->im->Ref();
+    BOOST_FOREACH(composite_layer_t const& layer, closure->layers)
+    {
+        layer.im->Ref();
+    }
+    return Undefined();
+}
+
+void Image::EIO_CompositeMany(uv_work_t* req)
+{
+    composite_many_baton_t *closure = static_cast<composite_many_baton_t *>(req->data);
+
+    try
+    {
+        Image* dst = closure->im;
+        std::vector<composite_layer_t> const& layers = closure->layers;
+        // sources are premultiplied and filtered up front, as composite()
+        // would, and before the destination they may share is converted
+        std::vector<boost::shared_ptr<mapnik::image_32> > scratch(layers.size());
+        std::vector<mapnik::image_data_32 *> sources;
+        for (std::size_t j = 0; j < layers.size(); ++j)
+        {
+            sources.push_back(&composite_source(layers[j].im,
+                                                layers[j].premultiplied,
+                                                layers[j].im == dst,
+                                                layers[j].filters,
+                                                scratch[j]));
+        }
+        mapnik::image_data_32 & dst_data = dst->this_->data();
+        if (!closure->premultiplied)
+        {
+            node_mapnik::premultiply(dst_data.getBytes(), dst_data.width() * dst_data.height());
+            closure->premultiplied = true;
+        }
+        std::size_t i = 0;
+        while (i < layers.size())
+        {
+#if MAPNIK_VERSION >= 200200
+            // consecutive layers with a row blender are applied together,
+            // anything else goes through mapnik::composite in order
+            std::vector<blend_layer_t> run;
+            node_mapnik::blend_mode blend;
+            while (i < layers.size() &&
+                   composite_blend_mode(layers[i].mode, blend))
+            {
+                blend_layer_t blend_layer;
+                if (make_blend_layer(dst_data,
+                                     *sources[i],
+                                     blend,
+                                     layers[i].opacity,
+                                     layers[i].dx,
+                                     layers[i].dy,
+                                     blend_layer))
+                {
+                    run.push_back(blend_layer);
+                }
+                ++i;
+            }
+            if (!run.empty())
+            {
+                composite_rows(dst_data,run);
+            }
+            if (i < layers.size())
+            {
+                composite_layer_t const& layer = layers[i];
+                mapnik::composite(dst_data,*sources[i], layer.mode, layer.opacity, layer.dx, layer.dy, false);
+                ++i;
+            }
+#else
+            composite_layer_t const& layer = layers[i];
+            mapnik::composite(dst_data,*sources[i], layer.mode, layer.opacity, layer.dx, layer.dy);
+            ++i;
+#endif
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Image::EIO_AfterCompositeMany(uv_work_t* req)
+{
+    HandleScope scope;
+
+    composite_many_baton_t *closure = static_cast<composite_many_baton_t *>(req->data);
+
+    TryCatch try_catch;
+
+    closure->im->premultiplied_ = closure->premultiplied;
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->im->handle_) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->im->Unref();
+    BOOST_FOREACH(composite_layer_t const& layer, closure->layers)
+    {
+        layer.im->Unref();
+    }
+    closure->cb.Dispose();
+    delete closure;
+}
+
 #else
 
 Handle<Value> Image::composite(const Arguments& args)
@@ -1236,4 +2854,13 @@ Handle<Value> Image::composite(const Arguments& args)
 
 }
 
+Handle<Value> Image::compositeMany(const Arguments& args)
+{
+    HandleScope scope;
+
+    return ThrowException(Exception::TypeError(
+                              String::New("compositing is only supported if node-mapnik is built against >= Mapnik 2.1.x")));
+
+}
+
 #endif
@@ -8,6 +8,7 @@
 using namespace v8;
 
 namespace mapnik { class image_32; }
+namespace node_mapnik { struct image_stats; }
 
 typedef boost::shared_ptr<mapnik::image_32> image_ptr;
 
@@ -19,12 +20,40 @@ public:
 
     static Handle<Value> getPixel(const Arguments &args);
     static Handle<Value> setPixel(const Arguments &args);
+    static Handle<Value> getPixels(const Arguments &args);
+    static Handle<Value> setPixels(const Arguments &args);
+    static Handle<Value> readPixels(const Arguments &args);
+    static Handle<Value> writePixels(const Arguments &args);
     static Handle<Value> encodeSync(const Arguments &args);
     static Handle<Value> encode(const Arguments &args);
     static void EIO_Encode(uv_work_t* req);
     static void EIO_AfterEncode(uv_work_t* req);
+    static Handle<Value> encodeMany(const Arguments &args);
+    static void EIO_EncodeMany(uv_work_t* req);
+    static void EIO_AfterEncodeMany(uv_work_t* req);
+    static void EIO_EncodeManyJob(uv_work_t* req);
+    static void EIO_AfterEncodeManyJob(uv_work_t* req);
+    static Handle<Value> resize(const Arguments &args);
+    static void EIO_Resize(uv_work_t* req);
+    static void EIO_AfterResize(uv_work_t* req);
+    static Handle<Value> compare(const Arguments &args);
+    static void EIO_Compare(uv_work_t* req);
+    static void EIO_AfterCompare(uv_work_t* req);
+    static Handle<Value> stats(const Arguments &args);
+    static void EIO_Stats(uv_work_t* req);
+    static void EIO_AfterStats(uv_work_t* req);
+    // the optional {max_colors} of stats, 256 without one; throws and
+    // returns false if invalid
+    static bool stats_max_colors(const Arguments& args, unsigned & max_colors);
+    // the object stats calls back with
+    static Local<Object> stats_object(node_mapnik::image_stats const& stats);
 
     static Handle<Value> setGrayScaleToAlpha(const Arguments &args);
+    static void EIO_GrayScaleToAlpha(uv_work_t* req);
+    static void EIO_AfterGrayScaleToAlpha(uv_work_t* req);
+    // reads the optional mapnik.Color of setGrayScaleToAlpha from the first
+    // of argc arguments, white without one; throws and returns false if invalid
+    static bool gray_to_alpha_color(const Arguments& args, int argc, unsigned & rgb);
     static Handle<Value> width(const Arguments &args);
     static Handle<Value> height(const Arguments &args);
     static Handle<Value> view(const Arguments &args);
@@ -36,9 +65,17 @@ public:
     static Handle<Value> fromBytes(const Arguments &args);
     static void EIO_FromBytes(uv_work_t* req);
     static void EIO_AfterFromBytes(uv_work_t* req);
+    static Handle<Value> fromBuffer(const Arguments &args);
+    static Handle<Value> probe(const Arguments &args);
+    static Handle<Value> data(const Arguments &args);
     static Handle<Value> save(const Arguments &args);
     static Handle<Value> painted(const Arguments &args);
+    static Handle<Value> isSolid(const Arguments &args);
+    static void EIO_IsSolid(uv_work_t* req);
+    static void EIO_AfterIsSolid(uv_work_t* req);
+    static Handle<Value> isSolidSync(const Arguments &args);
     static Handle<Value> composite(const Arguments &args);
+    static Handle<Value> compositeMany(const Arguments &args);
     static Handle<Value> premultiplySync(const Arguments& args);
     static Handle<Value> premultiply(const Arguments& args);
     static void EIO_Premultiply(uv_work_t* req);
@@ -52,6 +89,8 @@ public:
     static void EIO_AfterClear(uv_work_t* req);
     static void EIO_Composite(uv_work_t* req);
     static void EIO_AfterComposite(uv_work_t* req);
+    static void EIO_CompositeMany(uv_work_t* req);
+    static void EIO_AfterCompositeMany(uv_work_t* req);
 
     static Handle<Value> get_prop(Local<String> property,
                                   const AccessorInfo& info);
@@ -65,10 +104,23 @@ public:
     Image(image_ptr this_);
     inline image_ptr get() { return this_; }
 
+    // whether the pixels currently hold premultiplied alpha
+    inline bool premultiplied() const { return premultiplied_; }
+    inline void set_premultiplied(bool premultiplied) { premultiplied_ = premultiplied; }
+    // convert in place only if the pixels are not already in that state
+    void ensure_premultiplied();
+    void ensure_demultiplied();
+
+    // true while views, data() Buffers or async work reference the image
+    inline bool in_use() const { return refs_ > 0; }
+    // hands the pixels to the caller, leaving this image empty (0x0)
+    image_ptr detach();
+
 private:
     ~Image();
     image_ptr this_;
     int estimated_size_;
+    bool premultiplied_;
 };
 
 #endif
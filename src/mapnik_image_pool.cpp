@@ -0,0 +1,204 @@
+// node
+#include <node.h>
+
+// mapnik
+#include <mapnik/graphics.hpp>          // for image_32
+
+// boost
+#include <boost/make_shared.hpp>
+
+#include "mapnik_image_pool.hpp"
+#include "mapnik_image.hpp"
+#include "utils.hpp"
+
+// stl
+#include <cstddef>
+#include <cstring>                      // for memset
+#include <exception>
+
+Persistent<FunctionTemplate> ImagePool::constructor;
+
+void ImagePool::Initialize(Handle<Object> target) {
+
+    HandleScope scope;
+
+    constructor = Persistent<FunctionTemplate>::New(FunctionTemplate::New(ImagePool::New));
+    constructor->InstanceTemplate()->SetInternalFieldCount(1);
+    constructor->SetClassName(String::NewSymbol("ImagePool"));
+
+    NODE_SET_PROTOTYPE_METHOD(constructor, "acquire", acquire);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "release", release);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "stats", stats);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "width", width);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "height", height);
+
+    target->Set(String::NewSymbol("ImagePool"),constructor->GetFunction());
+}
+
+ImagePool::ImagePool(unsigned width, unsigned height, unsigned max_size) :
+    ObjectWrap(),
+    width_(width),
+    height_(height),
+    max_size_(max_size),
+    images_(),
+    hits_(0),
+    misses_(0),
+    released_(0),
+    dropped_(0) {}
+
+ImagePool::~ImagePool()
+{
+    V8::AdjustAmountOfExternalAllocatedMemory(-static_cast<int64_t>(images_.size()) * image_bytes());
+}
+
+Handle<Value> ImagePool::New(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (!args.IsConstructCall())
+        return ThrowException(String::New("Cannot call constructor as function, you need to use 'new' keyword"));
+
+    if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber())
+        return ThrowException(Exception::TypeError(
+                                  String::New("ImagePool requires a width and a height")));
+
+    int width = args[0]->IntegerValue();
+    int height = args[1]->IntegerValue();
+    if (width <= 0 || height <= 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("width and height must be greater than zero")));
+
+    int max_size = 64;
+    if (args.Length() > 2) {
+        if (!args[2]->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional third argument must be an options object")));
+        Local<Object> options = args[2]->ToObject();
+        if (options->Has(String::New("max"))) {
+            Local<Value> opt = options->Get(String::New("max"));
+            if (!opt->IsNumber() || opt->IntegerValue() < 1)
+                return ThrowException(Exception::TypeError(
+                                          String::New("'max' must be a positive integer")));
+            max_size = opt->IntegerValue();
+        }
+    }
+
+    ImagePool* pool = new ImagePool(width,height,max_size);
+    pool->Wrap(args.This());
+    return args.This();
+}
+
+Handle<Value> ImagePool::acquire(const Arguments& args)
+{
+    HandleScope scope;
+
+    bool clear = true;
+    if (args.Length() > 0) {
+        if (!args[0]->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional argument must be an options object")));
+        Local<Object> options = args[0]->ToObject();
+        if (options->Has(String::New("clear"))) {
+            Local<Value> opt = options->Get(String::New("clear"));
+            if (!opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("'clear' must be a boolean")));
+            clear = opt->BooleanValue();
+        }
+    }
+
+    ImagePool* pool = node::ObjectWrap::Unwrap<ImagePool>(args.This());
+    try
+    {
+        image_ptr image;
+        if (pool->images_.empty())
+        {
+            // new images come zeroed from mapnik
+            image = boost::make_shared<mapnik::image_32>(pool->width_,pool->height_);
+            ++pool->misses_;
+        }
+        else
+        {
+            image = pool->images_.back();
+            pool->images_.pop_back();
+            V8::AdjustAmountOfExternalAllocatedMemory(-pool->image_bytes());
+            if (clear)
+            {
+                std::memset(image->data().getBytes(), 0, static_cast<std::size_t>(pool->image_bytes()));
+            }
+            image->painted(false);
+            ++pool->hits_;
+        }
+        Image* im = new Image(image);
+        Handle<Value> ext = External::New(im);
+        return scope.Close(Image::constructor->GetFunction()->NewInstance(1, &ext));
+    }
+    catch (std::exception const& ex)
+    {
+        return ThrowException(Exception::Error(String::New(ex.what())));
+    }
+}
+
+Handle<Value> ImagePool::release(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsObject())
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires a mapnik.Image argument")));
+    Local<Object> obj = args[0]->ToObject();
+    if (obj->IsNull() || obj->IsUndefined() || !Image::constructor->HasInstance(obj))
+        return ThrowException(Exception::TypeError(
+                                  String::New("mapnik.Image expected as first arg")));
+
+    ImagePool* pool = node::ObjectWrap::Unwrap<ImagePool>(args.This());
+    Image* im = node::ObjectWrap::Unwrap<Image>(obj);
+    if (im->get()->width() != pool->width_ || im->get()->height() != pool->height_)
+        return ThrowException(Exception::TypeError(
+                                  String::New("image size does not match the pool")));
+    if (im->in_use())
+        return ThrowException(Exception::Error(
+                                  String::New("image is still referenced by a view, a data() Buffer or a pending operation")));
+
+    // mapnik offers no way to unset the background of an image_32, and the
+    // next user must not inherit it, so those images are not kept
+    if (pool->images_.size() >= pool->max_size_ || im->get()->get_background())
+    {
+        ++pool->dropped_;
+        return scope.Close(False());
+    }
+    // the Image is left empty (0x0) so it cannot write into pixels that
+    // another Image now owns
+    pool->images_.push_back(im->detach());
+    V8::AdjustAmountOfExternalAllocatedMemory(pool->image_bytes());
+    ++pool->released_;
+    return scope.Close(True());
+}
+
+Handle<Value> ImagePool::stats(const Arguments& args)
+{
+    HandleScope scope;
+    ImagePool* pool = node::ObjectWrap::Unwrap<ImagePool>(args.This());
+    Local<Object> stats = Object::New();
+    stats->Set(String::NewSymbol("hits"), Number::New(pool->hits_));
+    stats->Set(String::NewSymbol("misses"), Number::New(pool->misses_));
+    stats->Set(String::NewSymbol("released"), Number::New(pool->released_));
+    stats->Set(String::NewSymbol("dropped"), Number::New(pool->dropped_));
+    stats->Set(String::NewSymbol("available"), Integer::New(static_cast<int>(pool->images_.size())));
+    stats->Set(String::NewSymbol("max"), Integer::New(pool->max_size_));
+    return scope.Close(stats);
+}
+
+Handle<Value> ImagePool::width(const Arguments& args)
+{
+    HandleScope scope;
+    ImagePool* pool = node::ObjectWrap::Unwrap<ImagePool>(args.This());
+    return scope.Close(Integer::New(pool->width_));
+}
+
+Handle<Value> ImagePool::height(const Arguments& args)
+{
+    HandleScope scope;
+    ImagePool* pool = node::ObjectWrap::Unwrap<ImagePool>(args.This());
+    return scope.Close(Integer::New(pool->height_));
+}
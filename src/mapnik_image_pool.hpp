@@ -0,0 +1,45 @@
+#ifndef __NODE_MAPNIK_IMAGE_POOL_H__
+#define __NODE_MAPNIK_IMAGE_POOL_H__
+
+#include <v8.h>
+#include <node_object_wrap.h>
+
+#include "mapnik_image.hpp"
+
+// stl
+#include <stdint.h>
+#include <vector>
+
+using namespace v8;
+
+// Keeps the pixel buffers of released Images of one size so new Images
+// can reuse them instead of allocating. Only used from the main thread.
+class ImagePool: public node::ObjectWrap {
+public:
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> target);
+    static Handle<Value> New(const Arguments &args);
+
+    static Handle<Value> acquire(const Arguments &args);
+    static Handle<Value> release(const Arguments &args);
+    static Handle<Value> stats(const Arguments &args);
+    static Handle<Value> width(const Arguments &args);
+    static Handle<Value> height(const Arguments &args);
+
+    ImagePool(unsigned width, unsigned height, unsigned max_size);
+
+private:
+    ~ImagePool();
+    // pixel bytes of one image, 64 bit so totals past 2GB do not overflow
+    int64_t image_bytes() const { return static_cast<int64_t>(width_) * height_ * 4; }
+    unsigned width_;
+    unsigned height_;
+    unsigned max_size_;
+    std::vector<image_ptr> images_;
+    double hits_;
+    double misses_;
+    double released_;
+    double dropped_;
+};
+
+#endif
@@ -20,6 +20,14 @@
 #include "mapnik_image_view.hpp"
 #include "mapnik_color.hpp"
 #include "mapnik_palette.hpp"
+#include "pixel_kernels.hpp"
+#include "alpha_copy.hpp"
+#include "encode_buffer.hpp"
+#include "image_profile.hpp"
+#include "solid_tile_cache.hpp"
+#include "encode_pixels.hpp"
+#include "pixel_access.hpp"
+#include "image_stats.hpp"
 #include "utils.hpp"
 
 // std
@@ -43,6 +51,10 @@ void ImageView::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(constructor, "isSolid", isSolid);
     NODE_SET_PROTOTYPE_METHOD(constructor, "isSolidSync", isSolidSync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "getPixel", getPixel);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "getPixels", getPixels);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "readPixels", readPixels);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "stats", stats);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "setGrayScaleToAlpha", setGrayScaleToAlpha);
 
     target->Set(String::NewSymbol("ImageView"),constructor->GetFunction());
 }
@@ -143,14 +155,10 @@ void ImageView::EIO_IsSolid(uv_work_t* req)
         closure->pixel = first_pixel;
         for (unsigned y = 0; y < view->height(); ++y)
         {
-            pixel_type const * row = view->getRow(y);
-            for (unsigned x = 0; x < view->width(); ++x)
+            if (!node_mapnik::is_solid_row(view->getRow(y), view->width(), first_pixel))
             {
-                if (first_pixel != row[x])
-                {
-                    closure->result = false;
-                    return;
-                }
+                closure->result = false;
+                return;
             }
         }
     }
@@ -209,13 +217,9 @@ Handle<Value> ImageView::isSolidSync(const Arguments& args)
         mapnik::image_view<mapnik::image_data_32>::pixel_type const first_pixel = first_row[0];
         for (unsigned y = 0; y < view->height(); ++y)
         {
-            mapnik::image_view<mapnik::image_data_32>::pixel_type const * row = view->getRow(y);
-            for (unsigned x = 0; x < view->width(); ++x)
+            if (!node_mapnik::is_solid_row(view->getRow(y), view->width(), first_pixel))
             {
-                if (first_pixel != row[x])
-                {
-                    return scope.Close(False());
-                }
+                return scope.Close(False());
             }
         }
     }
@@ -260,6 +264,177 @@ Handle<Value> ImageView::getPixel(const Arguments& args)
     return Undefined();
 }
 
+Handle<Value> ImageView::getPixels(const Arguments& args)
+{
+    HandleScope scope;
+    std::size_t length = 0;
+    int const* coords = args.Length() > 0 ?
+        static_cast<int const*>(node_mapnik::typed_array_data(args[0], kExternalIntArray, length)) : 0;
+    if (!coords || length % 2 != 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("expects an Int32Array of x,y pairs")));
+    ImageView* im = node::ObjectWrap::Unwrap<ImageView>(args.This());
+    Local<Object> pixels = node_mapnik::new_uint32_array(length / 2);
+    node_mapnik::get_pixels(*im->get(), coords, length / 2,
+                            static_cast<unsigned *>(pixels->GetIndexedPropertiesExternalArrayData()));
+    return scope.Close(pixels);
+}
+
+Handle<Value> ImageView::readPixels(const Arguments& args)
+{
+    HandleScope scope;
+    ImageView* im = node::ObjectWrap::Unwrap<ImageView>(args.This());
+    image_view_ptr view = im->get();
+    int region[4];
+    if (!node_mapnik::parse_pixel_region(args, *view, region))
+        return Undefined();
+    std::size_t count = static_cast<std::size_t>(region[2]) * region[3];
+    Local<Object> pixels;
+    if (args.Length() > 4)
+    {
+        std::size_t length = 0;
+        if (!node_mapnik::typed_array_data(args[4], kExternalUnsignedIntArray, length) || length < count)
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional fifth argument must be a Uint32Array of at least width * height pixels")));
+        pixels = args[4]->ToObject();
+    }
+    else
+    {
+        pixels = node_mapnik::new_uint32_array(count);
+    }
+    node_mapnik::read_region(*view, region[0], region[1], region[2], region[3],
+                             static_cast<unsigned *>(pixels->GetIndexedPropertiesExternalArrayData()));
+    return scope.Close(pixels);
+}
+
+typedef struct {
+    uv_work_t request;
+    ImageView* im;
+    unsigned rgb;
+    // the alpha state of the image when queued
+    bool premultiplied;
+    Persistent<Function> cb;
+} gray_to_alpha_view_baton_t;
+
+void ImageView::gray_to_alpha(unsigned rgb, bool demultiply)
+{
+    mapnik::image_data_32 & data = JSImage_->get()->data();
+    if (demultiply)
+    {
+        node_mapnik::demultiply(data.getBytes(), data.width() * data.height());
+    }
+    for (unsigned y = 0; y < this_->height(); ++y)
+    {
+        node_mapnik::gray_to_alpha_row(data.getRow(this_->y() + y) + this_->x(), this_->width(), rgb);
+    }
+}
+
+Handle<Value> ImageView::setGrayScaleToAlpha(const Arguments& args)
+{
+    HandleScope scope;
+
+    ImageView* im = node::ObjectWrap::Unwrap<ImageView>(args.This());
+    bool async = args.Length() > 0 && args[args.Length()-1]->IsFunction();
+    unsigned rgb;
+    if (!Image::gray_to_alpha_color(args, async ? args.Length() - 1 : args.Length(), rgb))
+        return Undefined();
+
+    // the rest of the image must agree with the straight alpha written here
+    if (!async)
+    {
+        im->JSImage_->ensure_demultiplied();
+        im->gray_to_alpha(rgb, false);
+        return Undefined();
+    }
+
+    gray_to_alpha_view_baton_t *closure = new gray_to_alpha_view_baton_t();
+    closure->request.data = closure;
+    closure->im = im;
+    closure->rgb = rgb;
+    closure->premultiplied = im->JSImage_->premultiplied();
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_GrayScaleToAlpha, (uv_after_work_cb)EIO_AfterGrayScaleToAlpha);
+    im->Ref();
+    return Undefined();
+}
+
+void ImageView::EIO_GrayScaleToAlpha(uv_work_t* req)
+{
+    gray_to_alpha_view_baton_t *closure = static_cast<gray_to_alpha_view_baton_t *>(req->data);
+    closure->im->gray_to_alpha(closure->rgb, closure->premultiplied);
+}
+
+void ImageView::EIO_AfterGrayScaleToAlpha(uv_work_t* req)
+{
+    HandleScope scope;
+    gray_to_alpha_view_baton_t *closure = static_cast<gray_to_alpha_view_baton_t *>(req->data);
+    closure->im->JSImage_->set_premultiplied(false);
+    TryCatch try_catch;
+    Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->im->handle_) };
+    closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught())
+    {
+        node::FatalException(try_catch);
+    }
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
+typedef struct {
+    uv_work_t request;
+    ImageView* im;
+    bool premultiplied;
+    unsigned max_colors;
+    node_mapnik::image_stats stats;
+    Persistent<Function> cb;
+} image_view_stats_baton_t;
+
+Handle<Value> ImageView::stats(const Arguments& args)
+{
+    HandleScope scope;
+
+    // ensure callback is a function
+    if (args.Length() == 0 || !args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    unsigned max_colors;
+    if (!Image::stats_max_colors(args, max_colors))
+        return Undefined();
+
+    image_view_stats_baton_t *closure = new image_view_stats_baton_t();
+    closure->request.data = closure;
+    closure->im = node::ObjectWrap::Unwrap<ImageView>(args.This());
+    closure->premultiplied = closure->im->JSImage_->premultiplied();
+    closure->max_colors = max_colors;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_Stats, (uv_after_work_cb)EIO_AfterStats);
+    closure->im->Ref();
+    return Undefined();
+}
+
+void ImageView::EIO_Stats(uv_work_t* req)
+{
+    image_view_stats_baton_t *closure = static_cast<image_view_stats_baton_t *>(req->data);
+    node_mapnik::stats_image(*closure->im->get(), closure->premultiplied, closure->max_colors, closure->stats);
+}
+
+void ImageView::EIO_AfterStats(uv_work_t* req)
+{
+    HandleScope scope;
+    image_view_stats_baton_t *closure = static_cast<image_view_stats_baton_t *>(req->data);
+    TryCatch try_catch;
+    Local<Value> argv[2] = { Local<Value>::New(Null()), Image::stats_object(closure->stats) };
+    closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    if (try_catch.HasCaught())
+    {
+        node::FatalException(try_catch);
+    }
+    closure->im->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
 
 Handle<Value> ImageView::width(const Arguments& args)
 {
@@ -278,6 +453,18 @@ Handle<Value> ImageView::height(const Arguments& args)
 }
 
 
+// The view's pixels with straight alpha: the view itself, or a view of a
+// demultiplied copy kept alive by scratch when its image is premultiplied.
+// The image is shared with its other views, it is never converted here.
+static mapnik::image_view<mapnik::image_data_32> straight_view(mapnik::image_view<mapnik::image_data_32> const& view,
+                                                               bool premultiplied,
+                                                               boost::shared_ptr<mapnik::image_data_32> & scratch)
+{
+    if (!premultiplied) return view;
+    scratch = node_mapnik::demultiplied_copy(view);
+    return mapnik::image_view<mapnik::image_data_32>(0, 0, scratch->width(), scratch->height(), *scratch);
+}
+
 Handle<Value> ImageView::encodeSync(const Arguments& args)
 {
     HandleScope scope;
@@ -286,6 +473,7 @@ Handle<Value> ImageView::encodeSync(const Arguments& args)
 
     std::string format = "png";
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
 
     // accept custom format
     if (args.Length() >= 1) {
@@ -315,25 +503,16 @@ Handle<Value> ImageView::encodeSync(const Arguments& args)
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
 
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
     }
 
     try {
-        std::string s;
-        mapnik::image_view<mapnik::image_data_32> const& image = *(im->this_);
-        if (palette.get())
-        {
-            s = save_to_string(image, format, *palette);
-        }
-        else {
-            s = save_to_string(image, format);
-        }
-
-        #if NODE_VERSION_AT_LEAST(0, 11, 0)
-        return scope.Close(node::Buffer::New((char*)s.data(),s.size()));
-        #else
-        return scope.Close(node::Buffer::New((char*)s.data(),s.size())->handle_);
-        #endif
+        // the view shares pixels with its image, encode straight alpha
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        node_mapnik::encode_buffer out;
+        node_mapnik::encode_pixels(straight_view(*(im->this_), im->JSImage_->premultiplied(), scratch), format, palette, lookup, 1, out);
+        return scope.Close(out.to_node_buffer());
     }
     catch (std::exception const& ex)
     {
@@ -347,10 +526,13 @@ typedef struct {
     ImageView* im;
     std::string format;
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
-    std::string result;
+    node_mapnik::encode_buffer result;
+    bool auto_format;
+    bool premultiplied;
 } encode_image_view_baton_t;
 
 
@@ -362,6 +544,7 @@ Handle<Value> ImageView::encode(const Arguments& args)
 
     std::string format = "png";
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
 
     // accept custom format
     if (args.Length() > 1){
@@ -391,9 +574,16 @@ Handle<Value> ImageView::encode(const Arguments& args)
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
 
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
     }
 
+    // 'auto' picks the format from the pixels and hands it to the callback
+    bool auto_format = (format == "auto");
+    if (auto_format && palette.get())
+        return ThrowException(Exception::TypeError(
+                                  String::New("'auto' format does not accept a palette")));
+
     // ensure callback is a function
     Local<Value> callback = args[args.Length()-1];
     if (!args[args.Length()-1]->IsFunction())
@@ -405,6 +595,9 @@ Handle<Value> ImageView::encode(const Arguments& args)
     closure->im = im;
     closure->format = format;
     closure->palette = palette;
+    closure->lookup = lookup;
+    closure->auto_format = auto_format;
+    closure->premultiplied = im->JSImage_->premultiplied();
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Encode, (uv_after_work_cb)EIO_AfterEncode);
@@ -417,15 +610,13 @@ void ImageView::EIO_Encode(uv_work_t* req)
     encode_image_view_baton_t *closure = static_cast<encode_image_view_baton_t *>(req->data);
 
     try {
-        mapnik::image_view<mapnik::image_data_32> const& im = *(closure->im->this_);
-        if (closure->palette.get())
-        {
-            closure->result = save_to_string(im, closure->format, *closure->palette);
-        }
-        else
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        mapnik::image_view<mapnik::image_data_32> im = straight_view(*(closure->im->this_), closure->premultiplied, scratch);
+        if (closure->auto_format)
         {
-            closure->result = save_to_string(im, closure->format);
+            closure->format = node_mapnik::choose_format(node_mapnik::profile_image(im));
         }
+        node_mapnik::encode_pixels(im, closure->format, closure->palette, closure->lookup, 1, closure->result);
     }
     catch (std::exception const& ex)
     {
@@ -446,13 +637,16 @@ void ImageView::EIO_AfterEncode(uv_work_t* req)
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
     }
+    else if (closure->auto_format)
+    {
+        Local<Value> argv[3] = { Local<Value>::New(Null()),
+                                 Local<Value>::New(closure->result.to_node_buffer()),
+                                 String::New(closure->format.c_str()) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
+    }
     else
     {
-        #if NODE_VERSION_AT_LEAST(0, 11, 0)
-        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(node::Buffer::New((char*)closure->result.data(),closure->result.size())) };
-        #else
-        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(node::Buffer::New((char*)closure->result.data(),closure->result.size())->handle_) };
-        #endif
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->result.to_node_buffer()) };
         closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
     }
 
@@ -496,7 +690,8 @@ Handle<Value> ImageView::save(const Arguments& args)
     ImageView* im = node::ObjectWrap::Unwrap<ImageView>(args.This());
     try
     {
-        save_to_file(*im->get(),filename);
+        boost::shared_ptr<mapnik::image_data_32> scratch;
+        save_to_file(straight_view(*im->get(), im->JSImage_->premultiplied(), scratch),filename);
     }
     catch (std::exception const& ex)
     {
@@ -35,9 +35,20 @@ public:
     static void EIO_AfterIsSolid(uv_work_t* req);
     static Handle<Value> isSolidSync(const Arguments &args);
     static Handle<Value> getPixel(const Arguments &args);
+    static Handle<Value> getPixels(const Arguments &args);
+    static Handle<Value> readPixels(const Arguments &args);
+    static Handle<Value> stats(const Arguments &args);
+    static void EIO_Stats(uv_work_t* req);
+    static void EIO_AfterStats(uv_work_t* req);
+    static Handle<Value> setGrayScaleToAlpha(const Arguments &args);
+    static void EIO_GrayScaleToAlpha(uv_work_t* req);
+    static void EIO_AfterGrayScaleToAlpha(uv_work_t* req);
 
     ImageView(Image * JSImage);
     inline image_view_ptr get() { return this_; }
+    // setGrayScaleToAlpha on the pixels of the view, written through to
+    // the image, which is demultiplied first when `demultiply` is set
+    void gray_to_alpha(unsigned rgb, bool demultiply);
 
 private:
     ~ImageView();
@@ -4,12 +4,19 @@
 #include "mapnik_color.hpp"             // for Color, Color::constructor
 #include "mapnik_featureset.hpp"        // for Featureset
 #include "mapnik_grid.hpp"              // for Grid, Grid::constructor
+#include "js_grid_utils.hpp"            // for grid_layer_merger
 #include "mapnik_image.hpp"             // for Image, Image::constructor
 #include "mapnik_layer.hpp"             // for Layer, Layer::constructor
 #include "mapnik_palette.hpp"           // for palette_ptr, Palette, etc
 #include "vector_tile_processor.hpp"
 #include "vector_tile_backend_pbf.hpp"
+#include "vector_tile_projection.hpp"
 #include "mapnik_vector_tile.hpp"
+#include "render_context.hpp"
+#include "encode_buffer.hpp"
+#include "png_strip_encoder.hpp"
+#include "image_profile.hpp"
+#include "encode_pixels.hpp"
 
 // node
 #include <node.h>
@@ -24,6 +31,7 @@
 #endif
 #include <mapnik/color.hpp>             // for color
 #include <mapnik/datasource.hpp>        // for featureset_ptr
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
 #include <mapnik/feature_type_style.hpp>  // for rules, feature_type_style
 #include <mapnik/graphics.hpp>          // for image_32
 #include <mapnik/grid/grid.hpp>         // for hit_grid, grid
@@ -31,6 +39,7 @@
 #include <mapnik/image_data.hpp>        // for image_data_32
 #include <mapnik/image_util.hpp>        // for save_to_file, guess_type, etc
 #include <mapnik/layer.hpp>             // for layer
+#include <mapnik/memory_datasource.hpp>  // for memory_datasource
 #include <mapnik/line_pattern_symbolizer.hpp>
 #include <mapnik/line_symbolizer.hpp>   // for line_symbolizer
 #include <mapnik/load_map.hpp>          // for load_map, load_map_string
@@ -40,7 +49,11 @@
 #include <mapnik/point_symbolizer.hpp>  // for point_symbolizer
 #include <mapnik/polygon_pattern_symbolizer.hpp>
 #include <mapnik/polygon_symbolizer.hpp>  // for polygon_symbolizer
+#include <mapnik/projection.hpp>        // for projection
+#include <mapnik/proj_transform.hpp>    // for proj_transform
+#include <mapnik/query.hpp>             // for query
 #include <mapnik/raster_symbolizer.hpp>  // for raster_symbolizer
+#include <mapnik/request.hpp>           // for request
 #include <mapnik/rule.hpp>              // for rule, rule::symbolizers, etc
 #include <mapnik/save_map.hpp>          // for save_map, etc
 #include <mapnik/shield_symbolizer.hpp>  // for shield_symbolizer
@@ -53,9 +66,14 @@
 #endif
 
 // stl
+#include <algorithm>                    // for max_element
+#include <cmath>                        // for fabs, log, tan
 #include <exception>                    // for exception
+#include <fstream>                      // for ofstream
+#include <stdexcept>                    // for runtime_error
 #include <iosfwd>                       // for ostringstream, ostream
 #include <iostream>                     // for clog
+#include <map>                          // for map
 #include <ostream>                      // for operator<<, basic_ostream, etc
 #include <sstream>                      // for basic_ostringstream, etc
 
@@ -93,9 +111,11 @@ void Map::Initialize(Handle<Object> target) {
 
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "render", render);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "renderTile", renderTile);
     NODE_SET_PROTOTYPE_METHOD(constructor, "renderSync", renderSync);
     NODE_SET_PROTOTYPE_METHOD(constructor, "renderFile", renderFile);
     NODE_SET_PROTOTYPE_METHOD(constructor, "renderFileSync", renderFileSync);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "renderScales", renderScales);
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "zoomAll", zoomAll);
     NODE_SET_PROTOTYPE_METHOD(constructor, "zoomToBox", zoomToBox); //setExtent
@@ -119,6 +139,7 @@ void Map::Initialize(Handle<Object> target) {
     ATTR(constructor, "maximumExtent", get_prop, set_prop);
     ATTR(constructor, "background", get_prop, set_prop);
     ATTR(constructor, "parameters", get_prop, set_prop);
+    ATTR(constructor, "renderContext", get_prop, set_prop);
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "size", size);
 
@@ -128,14 +149,20 @@ void Map::Initialize(Handle<Object> target) {
 Map::Map(int width, int height) :
     ObjectWrap(),
     map_(boost::make_shared<mapnik::Map>(width,height)),
+    render_context_(),
     in_use_(0),
-    estimated_size_(0) {}
+    estimated_size_(0),
+    merc_srs_(),
+    merc_(false) {}
 
 Map::Map(int width, int height, std::string const& srs) :
     ObjectWrap(),
     map_(boost::make_shared<mapnik::Map>(width,height,srs)),
+    render_context_(),
     in_use_(0),
-    estimated_size_(0) {}
+    estimated_size_(0),
+    merc_srs_(),
+    merc_(false) {}
 
 Map::~Map()
 {
@@ -365,6 +392,8 @@ Handle<Value> Map::get_prop(Local<String> property,
 #endif
         return scope.Close(ds);
     }
+    else if (a == "renderContext")
+        return scope.Close(Boolean::New(m->render_context_ ? true : false));
     return Undefined();
 }
 
@@ -477,6 +506,16 @@ void Map::set_prop(Local<String> property,
         m->map_->set_extra_parameters(params);
 #endif
     }
+    else if (a == "renderContext") {
+        if (!value->IsBoolean()) {
+            ThrowException(Exception::TypeError(
+                               String::New("'renderContext' must be a boolean")));
+        } else if (!value->BooleanValue()) {
+            m->render_context_.reset();
+        } else if (!m->render_context_) {
+            m->render_context_ = boost::make_shared<node_mapnik::render_context>();
+        }
+    }
 }
 
 Handle<Value> Map::scale(const Arguments& args)
@@ -1291,24 +1330,122 @@ Handle<Value> Map::zoomToBox(const Arguments& args)
     return Undefined();
 }
 
+template <typename Renderer>
+static void render_layers(Renderer & ren,
+                          mapnik::Map const& map,
+                          mapnik::request const& m_req,
+                          mapnik::projection const& map_proj,
+                          std::vector<mapnik::layer> const& layers,
+                          double scale_denom,
+                          std::set<std::string> const& attributes = std::set<std::string>())
+{
+    ren.start_map_processing(map);
+    BOOST_FOREACH ( mapnik::layer const& lyr, layers )
+    {
+        if (lyr.visible(scale_denom))
+        {
+            std::set<std::string> names(attributes);
+            ren.apply_to_layer(lyr,
+                               ren,
+                               map_proj,
+                               m_req.scale(),
+                               scale_denom,
+                               m_req.width(),
+                               m_req.height(),
+                               m_req.extent(),
+                               m_req.buffer_size(),
+                               names);
+        }
+    }
+    ren.end_map_processing(map);
+}
+
+// Cheap test run before rendering: returns false only when no visible
+// layer has an active style rule and data intersecting the request, in
+// which case the render can only produce the map background.
+static bool map_can_paint(mapnik::Map const& map,
+                          mapnik::request const& m_req,
+                          mapnik::projection const& map_proj,
+                          double scale_denom)
+{
+#if MAPNIK_VERSION >= 200100
+    if (map.background_image())
+    {
+        return true;
+    }
+#endif
+    mapnik::box2d<double> query_ext = m_req.extent();
+    query_ext.pad(m_req.buffer_size() * m_req.extent().width() / m_req.width());
+    BOOST_FOREACH ( mapnik::layer const& lyr, map.layers() )
+    {
+        if (!lyr.visible(scale_denom) || !lyr.datasource())
+        {
+            continue;
+        }
+        bool active_rule = false;
+        BOOST_FOREACH ( std::string const& style_name, lyr.styles() )
+        {
+            boost::optional<mapnik::feature_type_style const&> style = map.find_style(style_name);
+            if (!style)
+            {
+                continue;
+            }
+            BOOST_FOREACH ( mapnik::rule const& r, style->get_rules() )
+            {
+                if (r.active(scale_denom))
+                {
+                    active_rule = true;
+                    break;
+                }
+            }
+            if (active_rule)
+            {
+                break;
+            }
+        }
+        if (!active_rule)
+        {
+            continue;
+        }
+        mapnik::projection layer_proj(lyr.srs(),true);
+        mapnik::proj_transform prj_trans(map_proj,layer_proj);
+        mapnik::box2d<double> layer_ext = lyr.datasource()->envelope();
+        // 20 points per edge, same as the renderer uses for reprojected extents
+        if (!prj_trans.backward(layer_ext,20) || layer_ext.intersects(query_ext))
+        {
+            // an envelope we cannot reproject is assumed to overlap
+            return true;
+        }
+    }
+    return false;
+}
+
 struct image_baton_t {
     uv_work_t request;
     Map *m;
     Image *im;
+    render_context_ptr context;
+    boost::optional<mapnik::box2d<double> > tile_extent;
     int buffer_size; // TODO - no effect until mapnik::request is used
     double scale_factor;
     double scale_denominator;
     unsigned offset_x;
     unsigned offset_y;
+    bool skip_empty;
+    bool empty;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
     image_baton_t() :
+      context(),
+      tile_extent(),
       buffer_size(0),
       scale_factor(1.0),
       scale_denominator(0.0),
       offset_x(0),
       offset_y(0),
+      skip_empty(false),
+      empty(false),
       error(false),
       error_name() {}
 };
@@ -1317,7 +1454,8 @@ struct grid_baton_t {
     uv_work_t request;
     Map *m;
     Grid *g;
-    std::size_t layer_idx;
+    std::vector<std::size_t> layer_indexes;
+    boost::optional<mapnik::box2d<double> > tile_extent;
     int buffer_size; // TODO - no effect until mapnik::request is used
     double scale_factor;
     double scale_denominator;
@@ -1327,7 +1465,8 @@ struct grid_baton_t {
     std::string error_name;
     Persistent<Function> cb;
     grid_baton_t() :
-      layer_idx(-1),
+      layer_indexes(),
+      tile_extent(),
       buffer_size(0),
       scale_factor(1.0),
       scale_denominator(0.0),
@@ -1341,6 +1480,7 @@ struct vector_tile_baton_t {
     uv_work_t request;
     Map *m;
     VectorTile *d;
+    boost::optional<mapnik::box2d<double> > tile_extent;
     unsigned tolerance;
     unsigned path_multiplier;
     int buffer_size;
@@ -1352,6 +1492,7 @@ struct vector_tile_baton_t {
     std::string error_name;
     Persistent<Function> cb;
     vector_tile_baton_t() :
+        tile_extent(),
         tolerance(1),
         path_multiplier(16),
         scale_factor(1.0),
@@ -1361,18 +1502,182 @@ struct vector_tile_baton_t {
         error(false) {}
 };
 
+// an index named twice in a 'layer' array renders once
+static void add_layer_index(std::vector<std::size_t> & layer_indexes, std::size_t idx)
+{
+    if (std::find(layer_indexes.begin(), layer_indexes.end(), idx) == layer_indexes.end())
+    {
+        layer_indexes.push_back(idx);
+    }
+}
+
+bool Map::grid_layer_indexes(Local<Value> layer_id,
+                             std::vector<mapnik::layer> const& layers,
+                             std::vector<std::size_t> & layer_indexes,
+                             std::string & error_msg)
+{
+    // an array renders several layers into the same grid in a single pass
+    if (layer_id->IsArray())
+    {
+        Local<Array> a = Local<Array>::Cast(layer_id);
+        unsigned int num_layers = a->Length();
+        if (num_layers == 0)
+        {
+            error_msg = "'layer' array must contain at least one layer name or index";
+            return false;
+        }
+        for (unsigned int i = 0; i < num_layers; ++i)
+        {
+            Local<Value> item = a->Get(i);
+            if (item->IsArray() || !grid_layer_indexes(item,layers,layer_indexes,error_msg))
+            {
+                if (error_msg.empty())
+                {
+                    error_msg = "'layer' array must only contain layer names(string) or layer indexes (integer)";
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (layer_id->IsString()) {
+        std::string const & layer_name = TOSTR(layer_id);
+        unsigned int idx(0);
+        BOOST_FOREACH ( mapnik::layer const& lyr, layers )
+        {
+            if (lyr.name() == layer_name)
+            {
+                add_layer_index(layer_indexes, idx);
+                return true;
+            }
+            ++idx;
+        }
+        std::ostringstream s;
+        s << "Layer name '" << layer_name << "' not found";
+        error_msg = s.str();
+        return false;
+    } else if (layer_id->IsNumber()) {
+        std::size_t layer_idx = layer_id->IntegerValue();
+        std::size_t layer_num = layers.size();
+
+        if (layer_idx >= layer_num) {
+            std::ostringstream s;
+            s << "Zero-based layer index '" << layer_idx << "' not valid, ";
+            if (layer_num > 0)
+            {
+                s << "only '" << layer_num << "' layers exist in map";
+            }
+            else
+            {
+                s << "no layers found in map";
+            }
+            error_msg = s.str();
+            return false;
+        }
+        add_layer_index(layer_indexes, layer_idx);
+        return true;
+    }
+    error_msg = "'layer' option required for grid rendering and must be either a layer name(string), layer index (integer), or an array of either";
+    return false;
+}
+
+// True when srs projects longitude and latitude where spherical mercator
+// does, whatever its spelling (+init=epsg:3857, the full proj4 string, ...).
+static bool is_spherical_mercator(std::string const& srs)
+{
+    try
+    {
+        mapnik::projection proj(srs);
+        if (proj.is_geographic()) return false;
+        // MSVC does not define M_PI
+        double const pi = 3.14159265358979323846;
+        double const R = 6378137.0;
+        double const lonlat[2][2] = { { -120.0, -60.0 }, { 45.0, 70.0 } };
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            double x = lonlat[i][0];
+            double y = lonlat[i][1];
+            proj.forward(x,y);
+            double merc_x = R * lonlat[i][0] * pi / 180.0;
+            double merc_y = R * std::log(std::tan(pi / 4.0 + lonlat[i][1] * pi / 360.0));
+            if (std::fabs(x - merc_x) > 0.01 || std::fabs(y - merc_y) > 0.01) return false;
+        }
+        return true;
+    }
+    catch (std::exception const&)
+    {
+        return false;
+    }
+}
+
+// Building a projection is too slow to repeat on every renderTile, so the
+// answer is kept until the srs changes (set directly or by a load).
+bool Map::spherical_mercator()
+{
+    std::string const& srs = map_->srs();
+    if (srs != merc_srs_)
+    {
+        merc_ = is_spherical_mercator(srs);
+        merc_srs_ = srs;
+    }
+    return merc_;
+}
+
 Handle<Value> Map::render(const Arguments& args)
+{
+    return abstractRender(args,false);
+}
+
+Handle<Value> Map::renderTile(const Arguments& args)
+{
+    return abstractRender(args,true);
+}
+
+Handle<Value> Map::abstractRender(const Arguments& args, bool tile)
 {
     HandleScope scope;
 
+    // renderTile takes z,x,y ahead of the usual render arguments
+    int first = tile ? 3 : 0;
+    boost::optional<mapnik::box2d<double> > tile_extent;
+    if (tile) {
+        if (args.Length() < 5) {
+            return ThrowException(Exception::TypeError(
+                                      String::New("requires at least five arguments: z, x, y, a renderable mapnik object, and a callback")));
+        }
+        if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber()) {
+            return ThrowException(Exception::TypeError(
+                                      String::New("z, x, y must be integers")));
+        }
+        int z = args[0]->IntegerValue();
+        int x = args[1]->IntegerValue();
+        int y = args[2]->IntegerValue();
+        if (z < 0 || z > 30) {
+            return ThrowException(Exception::TypeError(
+                                      String::New("z must be an integer between 0 and 30")));
+        }
+        int num_tiles = 1 << z;
+        if (x < 0 || x >= num_tiles || y < 0 || y >= num_tiles) {
+            std::ostringstream s;
+            s << "x and y must be between 0 and " << (num_tiles - 1) << " at zoom level " << z;
+            return ThrowException(Exception::TypeError(String::New(s.str().c_str())));
+        }
+        // the extent depends only on z/x/y so the tile size here is arbitrary
+        mapnik::vector::spherical_mercator merc(256);
+        double minx,miny,maxx,maxy;
+        merc.xyz(x,y,z,minx,miny,maxx,maxy);
+        tile_extent = mapnik::box2d<double>(minx,miny,maxx,maxy);
+    }
+
     // ensure at least 2 args
-    if (args.Length() < 2) {
+    if (args.Length() - first < 2) {
         return ThrowException(Exception::TypeError(
                                   String::New("requires at least two arguments, a renderable mapnik object, and a callback")));
     }
 
     // ensure renderable object
-    if (!args[0]->IsObject()) {
+    if (!args[first]->IsObject()) {
         return ThrowException(Exception::TypeError(
                                   String::New("requires a renderable mapnik object to be passed as first argument")));
     }
@@ -1384,9 +1689,14 @@ Handle<Value> Map::render(const Arguments& args)
 
     Map* m = node::ObjectWrap::Unwrap<Map>(args.This());
 
+    if (tile && !m->spherical_mercator()) {
+        return ThrowException(Exception::TypeError(
+                                  String::New("renderTile requires the map srs to be spherical mercator (EPSG:3857)")));
+    }
+
     if (m->active() != 0) {
         std::ostringstream s;
-        s << "render: this map appears to be in use by "
+        s << (tile ? "renderTile" : "render") << ": this map appears to be in use by "
           << m->active()
           << " other thread(s) which is not allowed."
           << " You need to use a map pool to avoid sharing map objects between concurrent rendering";
@@ -1401,17 +1711,18 @@ Handle<Value> Map::render(const Arguments& args)
     double scale_denominator = 0.0;
     unsigned offset_x = 0;
     unsigned offset_y = 0;
+    bool skip_empty = false;
 
     Local<Object> options = Object::New();
 
-    if (args.Length() > 2) {
+    if (args.Length() - first > 2) {
 
         // options object
-        if (!args[1]->IsObject())
+        if (!args[first+1]->IsObject())
             return ThrowException(Exception::TypeError(
                                       String::New("optional second argument must be an options object")));
 
-        options = args[1]->ToObject();
+        options = args[first+1]->ToObject();
 
         if (options->Has(String::New("buffer_size"))) {
             Local<Value> bind_opt = options->Get(String::New("buffer_size"));
@@ -1457,9 +1768,18 @@ Handle<Value> Map::render(const Arguments& args)
 
             offset_y = bind_opt->IntegerValue();
         }
+
+        if (options->Has(String::New("skip_empty"))) {
+            Local<Value> bind_opt = options->Get(String::New("skip_empty"));
+            if (!bind_opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("optional arg 'skip_empty' must be a boolean")));
+
+            skip_empty = bind_opt->BooleanValue();
+        }
     }
 
-    Local<Object> obj = args[0]->ToObject();
+    Local<Object> obj = args[first]->ToObject();
     if (obj->IsNull() || obj->IsUndefined())
         return ThrowException(Exception::TypeError(String::New("first argument is invalid, must be a renderable mapnik object, not null/undefined")));
 
@@ -1470,73 +1790,41 @@ Handle<Value> Map::render(const Arguments& args)
         closure->m = m;
         closure->im = node::ObjectWrap::Unwrap<Image>(obj);
         closure->im->_ref();
+        closure->context = m->render_context_;
+        closure->tile_extent = tile_extent;
         closure->buffer_size = buffer_size;
         closure->scale_factor = scale_factor;
         closure->scale_denominator = scale_denominator;
         closure->offset_x = offset_x;
         closure->offset_y = offset_y;
+        closure->skip_empty = skip_empty;
         closure->error = false;
         closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
         uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderImage, (uv_after_work_cb)EIO_AfterRenderImage);
 
     } else if (Grid::constructor->HasInstance(obj)) {
 
+        if (skip_empty) {
+            return ThrowException(Exception::TypeError(
+                                      String::New("'skip_empty' is only supported when rendering to an Image")));
+        }
+
         Grid * g = node::ObjectWrap::Unwrap<Grid>(obj);
 
-        std::size_t layer_idx = 0;
+        std::vector<std::size_t> layer_indexes;
 
         // grid requires special options for now
         if (!options->Has(String::New("layer"))) {
             return ThrowException(Exception::TypeError(
-                                      String::New("'layer' option required for grid rendering and must be either a layer name(string) or layer index (integer)")));
+                                      String::New("'layer' option required for grid rendering and must be either a layer name(string), layer index (integer), or an array of either")));
         } else {
-
-            std::vector<mapnik::layer> const& layers = m->map_->layers();
-
-            Local<Value> layer_id = options->Get(String::New("layer"));
-            if (! (layer_id->IsString() || layer_id->IsNumber()) )
-                return ThrowException(Exception::TypeError(
-                                          String::New("'layer' option required for grid rendering and must be either a layer name(string) or layer index (integer)")));
-
-            if (layer_id->IsString()) {
-                bool found = false;
-                unsigned int idx(0);
-                std::string const & layer_name = TOSTR(layer_id);
-                BOOST_FOREACH ( mapnik::layer const& lyr, layers )
-                {
-                    if (lyr.name() == layer_name)
-                    {
-                        found = true;
-                        layer_idx = idx;
-                        break;
-                    }
-                    ++idx;
-                }
-                if (!found)
-                {
-                    std::ostringstream s;
-                    s << "Layer name '" << layer_name << "' not found";
-                    return ThrowException(Exception::TypeError(String::New(s.str().c_str())));
-                }
-            } else if (layer_id->IsNumber()) {
-                layer_idx = layer_id->IntegerValue();
-                std::size_t layer_num = layers.size();
-
-                if (layer_idx >= layer_num) {
-                    std::ostringstream s;
-                    s << "Zero-based layer index '" << layer_idx << "' not valid, ";
-                    if (layer_num > 0)
-                    {
-                        s << "only '" << layer_num << "' layers exist in map";
-                    }
-                    else
-                    {
-                        s << "no layers found in map";
-                    }
-                    return ThrowException(Exception::TypeError(String::New(s.str().c_str())));
-                }
-            } else {
-                return ThrowException(Exception::TypeError(String::New("layer id must be a string or index number")));
+            std::string error_msg;
+            if (!grid_layer_indexes(options->Get(String::New("layer")),
+                                    m->map_->layers(),
+                                    layer_indexes,
+                                    error_msg))
+            {
+                return ThrowException(Exception::TypeError(String::New(error_msg.c_str())));
             }
         }
 
@@ -1563,7 +1851,8 @@ Handle<Value> Map::render(const Arguments& args)
         closure->m = m;
         closure->g = g;
         closure->g->_ref();
-        closure->layer_idx = layer_idx;
+        closure->layer_indexes = layer_indexes;
+        closure->tile_extent = tile_extent;
         closure->buffer_size = buffer_size;
         closure->scale_factor = scale_factor;
         closure->scale_denominator = scale_denominator;
@@ -1574,6 +1863,11 @@ Handle<Value> Map::render(const Arguments& args)
         uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderGrid, (uv_after_work_cb)EIO_AfterRenderGrid);
     } else if (VectorTile::constructor->HasInstance(obj)) {
 
+        if (skip_empty) {
+            return ThrowException(Exception::TypeError(
+                                      String::New("'skip_empty' is only supported when rendering to an Image")));
+        }
+
         vector_tile_baton_t *closure = new vector_tile_baton_t();
         VectorTile * vector_tile_obj = node::ObjectWrap::Unwrap<VectorTile>(obj);
 
@@ -1599,6 +1893,7 @@ Handle<Value> Map::render(const Arguments& args)
         closure->m = m;
         closure->d = vector_tile_obj;
         closure->d->_ref();
+        closure->tile_extent = tile_extent;
         closure->buffer_size = buffer_size;
         closure->scale_factor = scale_factor;
         closure->scale_denominator = scale_denominator;
@@ -1626,7 +1921,7 @@ void Map::EIO_RenderVectorTile(uv_work_t* req)
         backend_type backend(closure->d->get_tile_nonconst(),
                              closure->path_multiplier);
         mapnik::Map const& map = *closure->m->get();
-        mapnik::request m_req(map.width(),map.height(),map.get_current_extent());
+        mapnik::request m_req(map.width(),map.height(),closure->tile_extent ? *closure->tile_extent : map.get_current_extent());
         m_req.set_buffer_size(closure->buffer_size);
         renderer_type ren(backend,
                           map,
@@ -1699,13 +1994,74 @@ void Map::EIO_RenderGrid(uv_work_t* req)
             attributes.insert(join_field);
         }
 
-        mapnik::grid_renderer<mapnik::grid> ren(*closure->m->map_,
-                                                *closure->g->get(),
-                                                closure->scale_factor,
-                                                closure->offset_x,
-                                                closure->offset_y);
-        mapnik::layer const& layer = layers[closure->layer_idx];
-        ren.apply(layer,attributes,closure->scale_denominator);
+        if (closure->tile_extent)
+        {
+            mapnik::Map const& map = *closure->m->map_;
+            mapnik::request m_req(map.width(),map.height(),*closure->tile_extent);
+            m_req.set_buffer_size(map.buffer_size());
+            mapnik::projection map_proj(map.srs(),true);
+            double scale_denom = closure->scale_denominator;
+            if (scale_denom <= 0.0)
+            {
+                scale_denom = mapnik::scale_denominator(m_req.scale(),map_proj.is_geographic());
+            }
+            scale_denom *= closure->scale_factor;
+            std::vector<mapnik::layer> selected;
+            BOOST_FOREACH ( std::size_t layer_idx, closure->layer_indexes )
+            {
+                selected.push_back(layers[layer_idx]);
+            }
+            mapnik::grid_renderer<mapnik::grid> ren(map,
+                                                    m_req,
+                                                    *closure->g->get(),
+                                                    closure->scale_factor,
+                                                    closure->offset_x,
+                                                    closure->offset_y);
+            node_mapnik::grid_layer_merger<mapnik::grid> merger(*closure->g->get());
+            for (std::size_t i = 0; i < selected.size(); ++i)
+            {
+                std::vector<mapnik::layer> one(1, selected[i]);
+                if (i == 0)
+                {
+                    render_layers(ren,map,m_req,map_proj,one,scale_denom,attributes);
+                    continue;
+                }
+                mapnik::grid_renderer<mapnik::grid> layer_ren(map,
+                                                              m_req,
+                                                              merger.scratch(),
+                                                              closure->scale_factor,
+                                                              closure->offset_x,
+                                                              closure->offset_y);
+                render_layers(layer_ren,map,m_req,map_proj,one,scale_denom,attributes);
+                merger.merge(i);
+            }
+        }
+        else
+        {
+            mapnik::grid_renderer<mapnik::grid> ren(*closure->m->map_,
+                                                    *closure->g->get(),
+                                                    closure->scale_factor,
+                                                    closure->offset_x,
+                                                    closure->offset_y);
+            node_mapnik::grid_layer_merger<mapnik::grid> merger(*closure->g->get());
+            for (std::size_t i = 0; i < closure->layer_indexes.size(); ++i)
+            {
+                mapnik::layer const& lyr = layers[closure->layer_indexes[i]];
+                std::set<std::string> layer_attributes(attributes);
+                if (i == 0)
+                {
+                    ren.apply(lyr,layer_attributes,closure->scale_denominator);
+                    continue;
+                }
+                mapnik::grid_renderer<mapnik::grid> layer_ren(*closure->m->map_,
+                                                              merger.scratch(),
+                                                              closure->scale_factor,
+                                                              closure->offset_x,
+                                                              closure->offset_y);
+                layer_ren.apply(lyr,layer_attributes,closure->scale_denominator);
+                merger.merge(i);
+            }
+        }
 
     }
     catch (std::exception const& ex)
@@ -1751,12 +2107,53 @@ void Map::EIO_RenderImage(uv_work_t* req)
 
     try
     {
-        mapnik::agg_renderer<mapnik::image_32> ren(*closure->m->map_,
-                                                   *closure->im->get(),
-                                                   closure->scale_factor,
-                                                   closure->offset_x,
-                                                   closure->offset_y);
-        ren.apply(closure->scale_denominator);
+        if (closure->context || closure->tile_extent || closure->skip_empty)
+        {
+            // same as agg_renderer::apply but with the map projection
+            // borrowed from the render context and the extent taken from
+            // the tile when rendering by z/x/y
+            node_mapnik::render_scratch scratch(closure->context);
+            mapnik::Map const& map = *closure->m->map_;
+            mapnik::request m_req(map.width(),
+                                  map.height(),
+                                  closure->tile_extent ? *closure->tile_extent : map.get_current_extent());
+            m_req.set_buffer_size(map.buffer_size());
+            mapnik::projection const& map_proj = scratch.projection(map.srs());
+            double scale_denom = closure->scale_denominator;
+            if (scale_denom <= 0.0)
+            {
+                scale_denom = mapnik::scale_denominator(m_req.scale(),map_proj.is_geographic());
+            }
+            scale_denom *= closure->scale_factor;
+            if (closure->skip_empty && !map_can_paint(map,m_req,map_proj,scale_denom))
+            {
+                closure->empty = true;
+                if (map.background())
+                {
+                    closure->im->get()->set_background(*map.background());
+                }
+                closure->im->set_premultiplied(false);
+                return;
+            }
+            mapnik::agg_renderer<mapnik::image_32> ren(map,
+                                                       m_req,
+                                                       *closure->im->get(),
+                                                       closure->scale_factor,
+                                                       closure->offset_x,
+                                                       closure->offset_y);
+            render_layers(ren,map,m_req,map_proj,map.layers(),scale_denom);
+        }
+        else
+        {
+            mapnik::agg_renderer<mapnik::image_32> ren(*closure->m->map_,
+                                                       *closure->im->get(),
+                                                       closure->scale_factor,
+                                                       closure->offset_x,
+                                                       closure->offset_y);
+            ren.apply(closure->scale_denominator);
+        }
+        // agg demultiplies its output when the render finishes
+        closure->im->set_premultiplied(false);
     }
     catch (std::exception const& ex)
     {
@@ -1777,8 +2174,11 @@ void Map::EIO_AfterRenderImage(uv_work_t* req)
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
     } else {
-        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(closure->im->handle_) };
-        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+        // empty is only ever true with skip_empty
+        Local<Value> argv[3] = { Local<Value>::New(Null()),
+                                 Local<Value>::New(closure->im->handle_),
+                                 Local<Value>::New(Boolean::New(closure->empty)) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
     }
 
     if (try_catch.HasCaught()) {
@@ -1792,15 +2192,323 @@ void Map::EIO_AfterRenderImage(uv_work_t* req)
     delete closure;
 }
 
+struct render_scales_baton_t {
+    uv_work_t request;
+    Map *m;
+    render_context_ptr context;
+    std::string format;
+    palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
+    std::vector<double> scales;
+    int buffer_size;
+    double scale_denominator;
+    std::vector<boost::shared_ptr<node_mapnik::encode_buffer> > results;
+    // the format picked for each result when format is 'auto'
+    std::vector<std::string> formats;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+    render_scales_baton_t() :
+      context(),
+      buffer_size(0),
+      scale_denominator(0.0),
+      error(false),
+      error_name() {}
+};
+
+Handle<Value> Map::renderScales(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 3 || !args[0]->IsString())
+        return ThrowException(Exception::TypeError(
+                                  String::New("requires three arguments: a format string, an options object with 'scales', and a callback")));
+
+    if (!args[1]->IsObject())
+        return ThrowException(Exception::TypeError(
+                                  String::New("second argument must be an options object, eg. {scales: [1,2]}")));
+
+    Local<Value> callback = args[args.Length()-1];
+    if (!callback->IsFunction())
+        return ThrowException(Exception::TypeError(
+                                  String::New("last argument must be a callback function")));
+
+    Map* m = node::ObjectWrap::Unwrap<Map>(args.This());
+
+    if (m->active() != 0) {
+        std::ostringstream s;
+        s << "renderScales: this map appears to be in use by "
+          << m->active()
+          << " other thread(s) which is not allowed."
+          << " You need to use a map pool to avoid sharing map objects between concurrent rendering";
+        std::clog << s.str() << "\n";
+    }
+
+    std::vector<double> scales;
+    int buffer_size = 0;
+    double scale_denominator = 0.0;
+    palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
+
+    Local<Object> options = args[1]->ToObject();
+    if (!options->Has(String::New("scales")))
+        return ThrowException(Exception::TypeError(
+                                  String::New("'scales' option required, eg. {scales: [1,2]}")));
+
+    Local<Value> scales_opt = options->Get(String::New("scales"));
+    if (!scales_opt->IsArray())
+        return ThrowException(Exception::TypeError(
+                                  String::New("'scales' must be an array of numbers")));
+
+    Local<Array> a = Local<Array>::Cast(scales_opt);
+    unsigned int num_scales = a->Length();
+    if (num_scales == 0)
+        return ThrowException(Exception::TypeError(
+                                  String::New("'scales' must contain at least one scale factor")));
+
+    for (unsigned int i = 0; i < num_scales; ++i) {
+        Local<Value> scale = a->Get(i);
+        if (!scale->IsNumber() || scale->NumberValue() <= 0)
+            return ThrowException(Exception::TypeError(
+                                      String::New("'scales' must only contain positive numbers")));
+        scales.push_back(scale->NumberValue());
+    }
+
+    if (options->Has(String::New("buffer_size"))) {
+        Local<Value> bind_opt = options->Get(String::New("buffer_size"));
+        if (!bind_opt->IsNumber())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional arg 'buffer_size' must be a number")));
+
+        buffer_size = bind_opt->IntegerValue();
+    }
+
+    if (options->Has(String::New("scale_denominator"))) {
+        Local<Value> bind_opt = options->Get(String::New("scale_denominator"));
+        if (!bind_opt->IsNumber())
+            return ThrowException(Exception::TypeError(
+                                      String::New("optional arg 'scale_denominator' must be a number")));
+
+        scale_denominator = bind_opt->NumberValue();
+    }
+
+    if (options->Has(String::New("palette")))
+    {
+        Local<Value> format_opt = options->Get(String::New("palette"));
+        if (!format_opt->IsObject())
+            return ThrowException(Exception::TypeError(
+                                      String::New("'palette' must be an object")));
+
+        Local<Object> obj = format_opt->ToObject();
+        if (obj->IsNull() || obj->IsUndefined() || !Palette::constructor->HasInstance(obj))
+            return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as 'palette' option")));
+
+        palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+        lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
+    }
+
+    if (palette.get() && TOSTR(args[0]) == std::string("auto"))
+        return ThrowException(Exception::TypeError(
+                                  String::New("'auto' format does not accept a palette")));
+
+    render_scales_baton_t *closure = new render_scales_baton_t();
+    closure->request.data = closure;
+    closure->m = m;
+    closure->context = m->render_context_;
+    closure->format = TOSTR(args[0]);
+    closure->palette = palette;
+    closure->lookup = lookup;
+    closure->scales = scales;
+    closure->buffer_size = buffer_size;
+    closure->scale_denominator = scale_denominator;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
+    uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderScales, (uv_after_work_cb)EIO_AfterRenderScales);
+    m->acquire();
+    m->Ref();
+    return Undefined();
+}
+
+// Copies of the map layers whose vector datasources are replaced by the
+// features they return for the buffered extent at scale_denom, so several
+// renders can share one query.
+static void cache_layers(mapnik::Map const& map,
+                         mapnik::projection const& map_proj,
+                         mapnik::box2d<double> const& buffered_extent,
+                         mapnik::query::resolution_type const& res,
+                         double scale_denom,
+                         std::vector<mapnik::layer> & cached_layers)
+{
+    BOOST_FOREACH ( mapnik::layer const& lyr, map.layers() )
+    {
+        cached_layers.push_back(lyr);
+        mapnik::datasource_ptr ds = lyr.datasource();
+        // raster datasources resample to the query resolution, so they
+        // are left to be queried per scale
+        if (!ds || ds->type() == mapnik::datasource::Raster || !lyr.visible(scale_denom))
+        {
+            continue;
+        }
+        mapnik::projection layer_proj(lyr.srs(),true);
+        mapnik::proj_transform prj_trans(map_proj,layer_proj);
+        mapnik::box2d<double> query_ext = buffered_extent;
+        // 20 points per side, as the renderer uses to reproject envelopes
+        if (!prj_trans.forward(query_ext,20))
+        {
+            continue;
+        }
+        mapnik::query q(query_ext,res,scale_denom);
+        mapnik::layer_descriptor ld = ds->get_descriptor();
+        BOOST_FOREACH ( mapnik::attribute_descriptor const& desc, ld.get_descriptors() )
+        {
+            q.add_property_name(desc.get_name());
+        }
+        boost::shared_ptr<mapnik::memory_datasource> cache = boost::make_shared<mapnik::memory_datasource>();
+        mapnik::featureset_ptr fs = ds->features(q);
+        if (fs)
+        {
+            mapnik::feature_ptr feature;
+            while ((feature = fs->next()))
+            {
+                cache->push(feature);
+            }
+        }
+        cached_layers.back().set_datasource(cache);
+    }
+}
+
+void Map::EIO_RenderScales(uv_work_t* req)
+{
+    render_scales_baton_t *closure = static_cast<render_scales_baton_t *>(req->data);
+
+    try
+    {
+        node_mapnik::render_scratch scratch(closure->context);
+        mapnik::Map const& map = *closure->m->map_;
+        mapnik::projection const& map_proj = scratch.projection(map.srs());
+        mapnik::box2d<double> const& extent = map.get_current_extent();
+        double max_scale = *std::max_element(closure->scales.begin(),closure->scales.end());
+
+        // The buffer is scaled along with the image so every scale shares the
+        // same buffered extent, and growing the image together with the scale
+        // factor leaves the scale denominator unchanged. Unless an explicit
+        // scale_denominator is scaled along, each layer can therefore be
+        // queried once and its features replayed for every scale.
+        mapnik::request base_req(map.width(),map.height(),extent);
+        base_req.set_buffer_size(closure->buffer_size);
+        mapnik::box2d<double> buffered_extent = base_req.get_buffered_extent();
+        std::vector<double> scale_denoms;
+        BOOST_FOREACH ( double scale, closure->scales )
+        {
+            if (closure->scale_denominator > 0.0)
+            {
+                scale_denoms.push_back(closure->scale_denominator * scale);
+            }
+            else
+            {
+                scale_denoms.push_back(mapnik::scale_denominator(base_req.scale(),map_proj.is_geographic()));
+            }
+        }
+
+        // every distinct scale denominator queries its own features, since
+        // datasources may select by it, and all scales that share one
+        // replay the same cache
+        mapnik::query::resolution_type res(map.width() * max_scale / extent.width(),
+                                           map.height() * max_scale / extent.height());
+        std::map<double, std::vector<mapnik::layer> > cached_layers;
+        BOOST_FOREACH ( double scale_denom, scale_denoms )
+        {
+            if (cached_layers.find(scale_denom) == cached_layers.end())
+            {
+                cache_layers(map,map_proj,buffered_extent,res,scale_denom,cached_layers[scale_denom]);
+            }
+        }
+
+        for (unsigned i = 0; i < closure->scales.size(); ++i)
+        {
+            double scale = closure->scales[i];
+            mapnik::image_32 im(static_cast<unsigned>(map.width() * scale + 0.5),
+                                static_cast<unsigned>(map.height() * scale + 0.5));
+            mapnik::request m_req(im.width(),im.height(),extent);
+            m_req.set_buffer_size(static_cast<int>(closure->buffer_size * scale + 0.5));
+            mapnik::agg_renderer<mapnik::image_32> ren(map,m_req,im,scale);
+            render_layers(ren,map,m_req,map_proj,cached_layers[scale_denoms[i]],scale_denoms[i]);
+            boost::shared_ptr<node_mapnik::encode_buffer> out = boost::make_shared<node_mapnik::encode_buffer>();
+            if (closure->format == "auto")
+            {
+                closure->formats.push_back(node_mapnik::choose_format(node_mapnik::profile_image(im.data())));
+                node_mapnik::encode_pixels(im.data(), closure->formats.back(), palette_ptr(),
+                                           node_mapnik::palette_lookup_ptr(), 1, *out);
+            }
+            else
+            {
+                node_mapnik::encode_pixels(im.data(), closure->format, closure->palette,
+                                           closure->lookup, 1, *out);
+            }
+            closure->results.push_back(out);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Map::EIO_AfterRenderScales(uv_work_t* req)
+{
+    HandleScope scope;
+
+    render_scales_baton_t *closure = static_cast<render_scales_baton_t *>(req->data);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Array> buffers = Array::New(closure->results.size());
+        for (unsigned i = 0; i < closure->results.size(); ++i)
+        {
+            buffers->Set(i, closure->results[i]->to_node_buffer());
+        }
+        if (closure->format == "auto")
+        {
+            Local<Array> formats = Array::New(closure->formats.size());
+            for (unsigned i = 0; i < closure->formats.size(); ++i)
+            {
+                formats->Set(i, String::New(closure->formats[i].c_str()));
+            }
+            Local<Value> argv[3] = { Local<Value>::New(Null()), buffers, formats };
+            closure->cb->Call(Context::GetCurrent()->Global(), 3, argv);
+        }
+        else
+        {
+            Local<Value> argv[2] = { Local<Value>::New(Null()), buffers };
+            closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+        }
+    }
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    closure->m->release();
+    closure->m->Unref();
+    closure->cb.Dispose();
+    delete closure;
+}
+
 typedef struct {
     uv_work_t request;
     Map *m;
+    render_context_ptr context;
     std::string format;
     std::string output;
     palette_ptr palette;
     double scale_factor;
     double scale_denominator;
     bool use_cairo;
+    unsigned threads;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -1819,6 +2527,7 @@ Handle<Value> Map::renderFile(const Arguments& args)
     double scale_factor = 1.0;
     double scale_denominator = 0.0;
     palette_ptr palette;
+    unsigned threads = 1;
 
     Local<Value> callback = args[args.Length()-1];
 
@@ -1869,6 +2578,15 @@ Handle<Value> Map::renderFile(const Arguments& args)
             scale_denominator = bind_opt->NumberValue();
         }
 
+        if (options->Has(String::New("threads"))) {
+            Local<Value> bind_opt = options->Get(String::New("threads"));
+            if (!bind_opt->IsNumber() || bind_opt->IntegerValue() < 1)
+                return ThrowException(Exception::TypeError(
+                                          String::New("optional arg 'threads' must be a positive integer")));
+
+            threads = bind_opt->IntegerValue();
+        }
+
     } else if (!args[1]->IsFunction()) {
         return ThrowException(Exception::TypeError(
                                   String::New("optional argument must be an object")));
@@ -1907,8 +2625,10 @@ Handle<Value> Map::renderFile(const Arguments& args)
     closure->request.data = closure;
 
     closure->m = m;
+    closure->context = m->render_context_;
     closure->scale_factor = scale_factor;
     closure->scale_denominator = scale_denominator;
+    closure->threads = threads;
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
 
@@ -1947,11 +2667,27 @@ void Map::EIO_RenderFile(uv_work_t* req)
         }
         else
         {
-            mapnik::image_32 im(closure->m->map_->width(),closure->m->map_->height());
+            // the render context lets the pixel buffer be recycled between files
+            node_mapnik::render_scratch scratch(closure->context);
+            mapnik::image_32 & im = scratch.image(closure->m->map_->width(),closure->m->map_->height());
             mapnik::agg_renderer<mapnik::image_32> ren(*closure->m->map_,im,closure->scale_factor);
             ren.apply(closure->scale_denominator);
 
-            if (closure->palette.get()) {
+            if (closure->threads > 1 && !closure->palette.get() &&
+                node_mapnik::png_strips_support(closure->format))
+            {
+                std::ofstream file(closure->output.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+                if (!file)
+                {
+                    throw std::runtime_error("failed to open file for writing: " + closure->output);
+                }
+                node_mapnik::save_to_png_strips(im.data(), file, closure->threads);
+                file.close();
+                if (!file)
+                {
+                    throw std::runtime_error("failed to write file: " + closure->output);
+                }
+            } else if (closure->palette.get()) {
                 mapnik::save_to_file<mapnik::image_data_32>(im.data(),closure->output,*closure->palette);
             } else {
                 mapnik::save_to_file<mapnik::image_data_32>(im.data(),closure->output);
@@ -2003,8 +2739,10 @@ Handle<Value> Map::renderSync(const Arguments& args)
 
     std::string format = TOSTR(args[0]);
     palette_ptr palette;
+    node_mapnik::palette_lookup_ptr lookup;
     double scale_factor = 1.0;
     double scale_denominator = 0.0;
+    bool skip_empty = false;
 
     if (args.Length() >= 2){
         if (!args[1]->IsObject())
@@ -2034,6 +2772,7 @@ Handle<Value> Map::renderSync(const Arguments& args)
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
 
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
         if (options->Has(String::New("scale"))) {
             Local<Value> bind_opt = options->Get(String::New("scale"));
@@ -2051,6 +2790,14 @@ Handle<Value> Map::renderSync(const Arguments& args)
 
             scale_denominator = bind_opt->NumberValue();
         }
+        if (options->Has(String::New("skip_empty"))) {
+            Local<Value> bind_opt = options->Get(String::New("skip_empty"));
+            if (!bind_opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                                          String::New("optional arg 'skip_empty' must be a boolean")));
+
+            skip_empty = bind_opt->BooleanValue();
+        }
     }
 
     // options hash
@@ -2073,35 +2820,49 @@ Handle<Value> Map::renderSync(const Arguments& args)
                 return ThrowException(Exception::TypeError(String::New("mapnik.Palette expected as second arg")));
 
             palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+            lookup = node::ObjectWrap::Unwrap<Palette>(obj)->lookup();
         }
     }
 
     Map* m = node::ObjectWrap::Unwrap<Map>(args.This());
-    std::string s;
+    node_mapnik::encode_buffer out;
     try
     {
+        if (skip_empty)
+        {
+            mapnik::Map const& map = *m->map_;
+            mapnik::request m_req(map.width(),map.height(),map.get_current_extent());
+            m_req.set_buffer_size(map.buffer_size());
+            mapnik::projection map_proj(map.srs(),true);
+            double scale_denom = scale_denominator;
+            if (scale_denom <= 0.0)
+            {
+                scale_denom = mapnik::scale_denominator(m_req.scale(),map_proj.is_geographic());
+            }
+            scale_denom *= scale_factor;
+            if (!map_can_paint(map,m_req,map_proj,scale_denom))
+            {
+                // blank tiles share the solid tile cache of the image encoders
+                mapnik::image_32 im(map.width(),map.height());
+                if (map.background())
+                {
+                    im.set_background(*map.background());
+                }
+                node_mapnik::encode_pixels(im.data(), format, palette, lookup, 1, out);
+                return scope.Close(out.to_node_buffer());
+            }
+        }
         mapnik::image_32 im(m->map_->width(),m->map_->height());
         mapnik::agg_renderer<mapnik::image_32> ren(*m->map_,im,scale_factor);
         ren.apply(scale_denominator);
-
-        if (palette.get())
-        {
-            s = save_to_string(im, format, *palette);
-        }
-        else {
-            s = save_to_string(im, format);
-        }
+        node_mapnik::encode_pixels(im.data(), format, palette, lookup, 1, out);
     }
     catch (std::exception const& ex)
     {
         return ThrowException(Exception::Error(
                                   String::New(ex.what())));
     }
-    #if NODE_VERSION_AT_LEAST(0, 11, 0)
-    return scope.Close(node::Buffer::New((char*)s.data(),s.size()));
-    #else
-    return scope.Close(node::Buffer::New((char*)s.data(),s.size())->handle_);
-    #endif
+    return scope.Close(out.to_node_buffer());
 }
 
 Handle<Value> Map::renderFileSync(const Arguments& args)
@@ -8,12 +8,18 @@
 // boost
 #include <boost/shared_ptr.hpp>
 
+// stl
+#include <string>
+#include <vector>
+
 
 using namespace v8;
 
-namespace mapnik { class Map; }
+namespace mapnik { class Map; class layer; }
+namespace node_mapnik { class render_context; }
 
 typedef boost::shared_ptr<mapnik::Map> map_ptr;
+typedef boost::shared_ptr<node_mapnik::render_context> render_context_ptr;
 
 class Map: public node::ObjectWrap {
 public:
@@ -34,12 +40,22 @@ public:
 
     // async rendering
     static Handle<Value> render(const Arguments &args);
+    static Handle<Value> renderTile(const Arguments &args);
+    static Handle<Value> abstractRender(const Arguments &args, bool tile);
     static void EIO_RenderImage(uv_work_t* req);
     static void EIO_AfterRenderImage(uv_work_t* req);
     static void EIO_RenderGrid(uv_work_t* req);
     static void EIO_AfterRenderGrid(uv_work_t* req);
     static void EIO_RenderVectorTile(uv_work_t* req);
     static void EIO_AfterRenderVectorTile(uv_work_t* req);
+    static bool grid_layer_indexes(Local<Value> layer_id,
+                                   std::vector<mapnik::layer> const& layers,
+                                   std::vector<std::size_t> & layer_indexes,
+                                   std::string & error_msg);
+
+    static Handle<Value> renderScales(const Arguments &args);
+    static void EIO_RenderScales(uv_work_t* req);
+    static void EIO_AfterRenderScales(uv_work_t* req);
 
     static Handle<Value> renderFile(const Arguments &args);
     static void EIO_RenderFile(uv_work_t* req);
@@ -83,16 +99,22 @@ public:
     void release();
     int active() const;
     int estimate_map_size();
+    bool spherical_mercator();
     void _ref() { Ref(); }
     void _unref() { Unref(); }
 
     inline map_ptr get() { return map_; }
+    inline render_context_ptr render_context() { return render_context_; }
 
 private:
     ~Map();
     map_ptr map_;
+    render_context_ptr render_context_;
     int in_use_;
     int estimated_size_;
+    // srs that merc_ was computed for
+    std::string merc_srs_;
+    bool merc_;
 };
 
 #endif
@@ -32,7 +32,8 @@ void Palette::Initialize(Handle<Object> target) {
 
 Palette::Palette(std::string const& palette, mapnik::rgba_palette::palette_type type) :
     ObjectWrap(),
-    palette_(boost::make_shared<mapnik::rgba_palette>(palette, type)) {}
+    palette_(boost::make_shared<mapnik::rgba_palette>(palette, type)),
+    lookup_(boost::make_shared<node_mapnik::palette_lookup>(*palette_)) {}
 
 Palette::~Palette() {
 }
@@ -9,6 +9,8 @@
 
 #include <mapnik/palette.hpp>
 
+#include "palette_lookup.hpp"
+
 using namespace v8;
 
 typedef boost::shared_ptr<mapnik::rgba_palette> palette_ptr;
@@ -25,9 +27,12 @@ public:
     static Handle<Value> ToBuffer(const Arguments& args);
 
     inline palette_ptr palette() { return palette_; }
+    // nearest color lookup shared by every encode that uses this palette
+    inline node_mapnik::palette_lookup_ptr lookup() { return lookup_; }
 private:
     ~Palette();
     palette_ptr palette_;
+    node_mapnik::palette_lookup_ptr lookup_;
 };
 
 #endif
@@ -6,8 +6,10 @@
 #include "mapnik_map.hpp"
 #include "mapnik_image.hpp"
 #include "mapnik_grid.hpp"
+#include "js_grid_utils.hpp"
 #include "mapnik_feature.hpp"
 #include "mapnik_cairo_surface.hpp"
+#include "render_context.hpp"
 #ifdef SVG_RENDERER
 #include <mapnik/svg/output/svg_renderer.hpp>
 #endif
@@ -917,11 +919,12 @@ Handle<Value> VectorTile::getData(const Arguments& args)
 struct vector_tile_render_baton_t {
     uv_work_t request;
     Map* m;
+    render_context_ptr context;
     VectorTile* d;
     Image * im;
     CairoSurface * c;
     Grid * g;
-    std::size_t layer_idx;
+    std::vector<std::size_t> layer_indexes;
     int z;
     int x;
     int y;
@@ -937,11 +940,12 @@ struct vector_tile_render_baton_t {
     vector_tile_render_baton_t() :
         request(),
         m(NULL),
+        context(),
         d(NULL),
         im(NULL),
         c(NULL),
         g(NULL),
-        layer_idx(0),
+        layer_indexes(),
         z(0),
         x(0),
         y(0),
@@ -1039,7 +1043,6 @@ Handle<Value> VectorTile::render(const Arguments& args)
         }
     }
 
-    closure->layer_idx = 0;
     if (Image::constructor->HasInstance(im_obj))
     {
         Image *im = node::ObjectWrap::Unwrap<Image>(im_obj);
@@ -1081,67 +1084,21 @@ Handle<Value> VectorTile::render(const Arguments& args)
         closure->g = g;
         closure->g->_ref();
 
-        std::size_t layer_idx = 0;
-
         // grid requires special options for now
         if (!options->Has(String::New("layer")))
         {
             delete closure;
             return ThrowException(Exception::TypeError(
-                                      String::New("'layer' option required for grid rendering and must be either a layer name(string) or layer index (integer)")));
+                                      String::New("'layer' option required for grid rendering and must be either a layer name(string), layer index (integer), or an array of either")));
         } else {
-            std::vector<mapnik::layer> const& layers = m->get()->layers();
-
-            Local<Value> layer_id = options->Get(String::New("layer"));
-            if (! (layer_id->IsString() || layer_id->IsNumber()) )
+            std::string error_msg;
+            if (!Map::grid_layer_indexes(options->Get(String::New("layer")),
+                                         m->get()->layers(),
+                                         closure->layer_indexes,
+                                         error_msg))
             {
                 delete closure;
-                return ThrowException(Exception::TypeError(
-                                          String::New("'layer' option required for grid rendering and must be either a layer name(string) or layer index (integer)")));
-            }
-
-            if (layer_id->IsString()) {
-                bool found = false;
-                unsigned int idx(0);
-                std::string layer_name = TOSTR(layer_id);
-                BOOST_FOREACH ( mapnik::layer const& lyr, layers )
-                {
-                    if (lyr.name() == layer_name)
-                    {
-                        found = true;
-                        layer_idx = idx;
-                        break;
-                    }
-                    ++idx;
-                }
-                if (!found)
-                {
-                    std::ostringstream s;
-                    s << "Layer name '" << layer_name << "' not found";
-                    delete closure;
-                    return ThrowException(Exception::TypeError(String::New(s.str().c_str())));
-                }
-            } else if (layer_id->IsNumber()) {
-                layer_idx = layer_id->IntegerValue();
-                std::size_t layer_num = layers.size();
-
-                if (layer_idx >= layer_num) {
-                    std::ostringstream s;
-                    s << "Zero-based layer index '" << layer_idx << "' not valid, ";
-                    if (layer_num > 0)
-                    {
-                        s << "only '" << layers.size() << "' layers exist in map";
-                    }
-                    else
-                    {
-                        s << "no layers found in map";
-                    }
-                    delete closure;
-                    return ThrowException(Exception::TypeError(String::New(s.str().c_str())));
-                }
-            } else {
-                delete closure;
-                return ThrowException(Exception::TypeError(String::New("layer id must be a string or index number")));
+                return ThrowException(Exception::TypeError(String::New(error_msg.c_str())));
             }
         }
         if (options->Has(String::New("fields"))) {
@@ -1164,7 +1121,6 @@ Handle<Value> VectorTile::render(const Arguments& args)
                 i++;
             }
         }
-        closure->layer_idx = layer_idx;
     }
     else
     {
@@ -1174,6 +1130,7 @@ Handle<Value> VectorTile::render(const Arguments& args)
     closure->request.data = closure;
     closure->d = d;
     closure->m = m;
+    closure->context = m->render_context();
     closure->error = false;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderTile, (uv_after_work_cb)EIO_AfterRenderTile);
@@ -1254,7 +1211,8 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
         mapnik::box2d<double> map_extent(minx,miny,maxx,maxy);
         mapnik::request m_req(map_in.width(),map_in.height(),map_extent);
         m_req.set_buffer_size(closure->buffer_size);
-        mapnik::projection map_proj(map_in.srs(),true);
+        node_mapnik::render_scratch scratch(closure->context);
+        mapnik::projection const& map_proj = scratch.projection(map_in.srs());
         double scale_denom = closure->scale_denominator;
         if (scale_denom <= 0.0)
         {
@@ -1263,7 +1221,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
         scale_denom *= closure->scale_factor;
         std::vector<mapnik::layer> const& layers = map_in.layers();
         mapnik::vector::tile const& tiledata = closure->d->get_tile();
-        // render grid for layer
+        // render grid for layers
         if (closure->g)
         {
             mapnik::grid_renderer<mapnik::grid> ren(map_in,
@@ -1272,9 +1230,31 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                                                     closure->scale_factor);
             ren.start_map_processing(map_in);
 
-            mapnik::layer const& lyr = layers[closure->layer_idx];
-            if (lyr.visible(scale_denom))
+            // copy property names
+            std::set<std::string> attributes = closure->g->get()->property_names();
+            // todo - make this a static constant
+            std::string known_id_key = "__id__";
+            if (attributes.find(known_id_key) != attributes.end())
+            {
+                attributes.erase(known_id_key);
+            }
+            std::string join_field = closure->g->get()->get_key();
+            if (known_id_key != join_field &&
+                attributes.find(join_field) == attributes.end())
+            {
+                attributes.insert(join_field);
+            }
+
+            // all requested layers are rendered into the same grid
+            node_mapnik::grid_layer_merger<mapnik::grid> merger(*closure->g->get());
+            std::size_t rendered = 0;
+            BOOST_FOREACH ( std::size_t layer_idx, closure->layer_indexes )
             {
+                mapnik::layer const& lyr = layers[layer_idx];
+                if (!lyr.visible(scale_denom))
+                {
+                    continue;
+                }
                 int tile_layer_idx = -1;
                 for (int j=0; j < tiledata.layers_size(); ++j)
                 {
@@ -1285,40 +1265,29 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                         break;
                     }
                 }
-                if (tile_layer_idx > -1)
+                if (tile_layer_idx < 0)
+                {
+                    continue;
+                }
+                mapnik::vector::tile_layer const& layer = tiledata.layers(tile_layer_idx);
+                if (layer.features_size() <= 0)
+                {
+                    continue;
+                }
+                mapnik::layer lyr_copy(lyr);
+                boost::shared_ptr<mapnik::vector::tile_datasource> ds = boost::make_shared<
+                                                mapnik::vector::tile_datasource>(
+                                                    layer,
+                                                    closure->d->x_,
+                                                    closure->d->y_,
+                                                    closure->d->z_,
+                                                    closure->d->width_
+                                                    );
+                ds->set_envelope(m_req.get_buffered_extent());
+                lyr_copy.set_datasource(ds);
+                std::set<std::string> layer_attributes(attributes);
+                if (rendered == 0)
                 {
-                    mapnik::vector::tile_layer const& layer = tiledata.layers(tile_layer_idx);
-                    if (layer.features_size() <= 0)
-                    {
-                        return;
-                    }
-
-                    // copy property names
-                    std::set<std::string> attributes = closure->g->get()->property_names();
-                    // todo - make this a static constant
-                    std::string known_id_key = "__id__";
-                    if (attributes.find(known_id_key) != attributes.end())
-                    {
-                        attributes.erase(known_id_key);
-                    }
-                    std::string join_field = closure->g->get()->get_key();
-                    if (known_id_key != join_field &&
-                        attributes.find(join_field) == attributes.end())
-                    {
-                        attributes.insert(join_field);
-                    }
-
-                    mapnik::layer lyr_copy(lyr);
-                    boost::shared_ptr<mapnik::vector::tile_datasource> ds = boost::make_shared<
-                                                    mapnik::vector::tile_datasource>(
-                                                        layer,
-                                                        closure->d->x_,
-                                                        closure->d->y_,
-                                                        closure->d->z_,
-                                                        closure->d->width_
-                                                        );
-                    ds->set_envelope(m_req.get_buffered_extent());
-                    lyr_copy.set_datasource(ds);
                     ren.apply_to_layer(lyr_copy,
                                        ren,
                                        map_proj,
@@ -1328,10 +1297,29 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                                        m_req.height(),
                                        m_req.extent(),
                                        m_req.buffer_size(),
-                                       attributes);
+                                       layer_attributes);
                 }
-                ren.end_map_processing(map_in);
+                else
+                {
+                    mapnik::grid_renderer<mapnik::grid> layer_ren(map_in,
+                                                                  m_req,
+                                                                  merger.scratch(),
+                                                                  closure->scale_factor);
+                    layer_ren.apply_to_layer(lyr_copy,
+                                             layer_ren,
+                                             map_proj,
+                                             m_req.scale(),
+                                             scale_denom,
+                                             m_req.width(),
+                                             m_req.height(),
+                                             m_req.extent(),
+                                             m_req.buffer_size(),
+                                             layer_attributes);
+                    merger.merge(rendered);
+                }
+                ++rendered;
             }
+            ren.end_map_processing(map_in);
         }
         else if (closure->c)
         {
@@ -1342,7 +1330,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                 // TODO - support any surface type
                 surface = mapnik::cairo_surface_ptr(cairo_svg_surface_create_for_stream(
                                                        (cairo_write_func_t)closure->c->write_callback,
-                                                       (void*)(&closure->c->ss_),
+                                                       (void*)(&closure->c->ss_.stream()),
                                                        static_cast<double>(closure->c->width()),
                                                        static_cast<double>(closure->c->height())
                                                     ),mapnik::cairo_surface_closer());
@@ -1360,7 +1348,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
             {
 #if defined(SVG_RENDERER)
                 typedef mapnik::svg_renderer<std::ostream_iterator<char> > svg_ren;
-                std::ostream_iterator<char> output_stream_iterator(closure->c->ss_);
+                std::ostream_iterator<char> output_stream_iterator(closure->c->ss_.stream());
                 svg_ren ren(map_in, m_req, output_stream_iterator, closure->scale_factor);
                 ren.start_map_processing(map_in);
                 process_layers(ren,m_req,map_proj,layers,scale_denom,tiledata,closure,map_extent);
@@ -1378,6 +1366,8 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
             ren.start_map_processing(map_in);
             process_layers(ren,m_req,map_proj,layers,scale_denom,tiledata,closure,map_extent);
             ren.end_map_processing(map_in);
+            // agg demultiplies its output when the render finishes
+            closure->im->set_premultiplied(false);
         }
     }
     catch (std::exception const& ex)
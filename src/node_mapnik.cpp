@@ -23,10 +23,13 @@
 #include "mapnik_memory_datasource.hpp"
 #include "mapnik_image.hpp"
 #include "mapnik_image_view.hpp"
+#include "mapnik_image_pool.hpp"
 #include "mapnik_grid.hpp"
 #include "mapnik_cairo_surface.hpp"
 #include "mapnik_grid_view.hpp"
 #include "mapnik_expression.hpp"
+#include "pixel_kernels.hpp"
+#include "solid_tile_cache.hpp"
 #include "utils.hpp"
 
 #ifdef MAPNIK_DEBUG
@@ -95,9 +98,24 @@ static Handle<Value> clearCache(const Arguments& args)
         #endif
     #endif
 #endif
+    node_mapnik::solid_tile_cache::instance().clear();
     return Undefined();
 }
 
+static Handle<Value> solidTileCacheStats(const Arguments& args)
+{
+    HandleScope scope;
+    node_mapnik::solid_tile_cache_stats stats = node_mapnik::solid_tile_cache::instance().stats();
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+    result->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+    result->Set(String::NewSymbol("evicted"), Number::New(stats.evicted));
+    result->Set(String::NewSymbol("entries"), Number::New(stats.entries));
+    result->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+    result->Set(String::NewSymbol("max"), Number::New(stats.max_entries));
+    return scope.Close(result);
+}
+
 static Handle<Value> shutdown(const Arguments& args)
 {
     HandleScope scope;
@@ -116,6 +134,10 @@ extern "C" {
         HandleScope scope;
         GOOGLE_PROTOBUF_VERIFY_VERSION;
 
+        // create the solid tile cache now, on the main thread, rather than
+        // from whichever encode first reaches it
+        node_mapnik::solid_tile_cache::instance();
+
         // module level functions
         NODE_SET_METHOD(target, "register_datasources", node_mapnik::register_datasources);
         NODE_SET_METHOD(target, "datasources", node_mapnik::available_input_plugins);
@@ -123,6 +145,7 @@ extern "C" {
         NODE_SET_METHOD(target, "fonts", node_mapnik::available_font_faces);
         NODE_SET_METHOD(target, "fontFiles", node_mapnik::available_font_files);
         NODE_SET_METHOD(target, "clearCache", clearCache);
+        NODE_SET_METHOD(target, "solidTileCacheStats", solidTileCacheStats);
         NODE_SET_METHOD(target, "gc", gc);
         NODE_SET_METHOD(target, "shutdown",shutdown);
 
@@ -134,6 +157,7 @@ extern "C" {
         Feature::Initialize(target);
         Image::Initialize(target);
         ImageView::Initialize(target);
+        ImagePool::Initialize(target);
         Palette::Initialize(target);
         Projection::Initialize(target);
         ProjTransform::Initialize(target);
@@ -230,6 +254,9 @@ extern "C" {
         supports->Set(String::NewSymbol("threadsafe"), False());
 #endif
 
+        // instruction set used by the image pixel kernels
+        supports->Set(String::NewSymbol("simd"), String::New(node_mapnik::pixel_kernels_isa()));
+
         target->Set(String::NewSymbol("supports"), supports);
 
 #if MAPNIK_VERSION >= 200100
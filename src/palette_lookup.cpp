@@ -0,0 +1,302 @@
+#include "palette_lookup.hpp"
+#include "png_strip_encoder.hpp"        // for filter_row, write_png_header, write_png_chunk
+
+#include <zlib.h>
+
+// stl
+#include <algorithm>
+#include <stdexcept>
+
+namespace node_mapnik {
+
+namespace {
+
+// the grid has 16 levels per channel, 65536 cells in total
+unsigned const cell_bits = 4;
+unsigned const levels = 1 << cell_bits;
+unsigned const num_cells = levels * levels * levels * levels;
+
+inline unsigned cell_of(unsigned rgba)
+{
+    return ((rgba >> 4) & 0xf) |
+           ((rgba >> 8) & 0xf0) |
+           ((rgba >> 12) & 0xf00) |
+           ((rgba >> 16) & 0xf000);
+}
+
+inline unsigned distance(unsigned char const* c, unsigned rgba)
+{
+    int dr = c[0] - static_cast<int>(rgba & 0xff);
+    int dg = c[1] - static_cast<int>((rgba >> 8) & 0xff);
+    int db = c[2] - static_cast<int>((rgba >> 16) & 0xff);
+    int da = c[3] - static_cast<int>(rgba >> 24);
+    return dr * dr + dg * dg + db * db + da * da;
+}
+
+}
+
+palette_lookup::palette_lookup(mapnik::rgba_palette const& palette) :
+    colors_(),
+    exact_(),
+    offsets_(),
+    candidates_(),
+    built_(false)
+{
+    std::vector<mapnik::rgb> const& rgb = palette.palette();
+    std::vector<unsigned> const& alpha = palette.alphaTable();
+    colors_.reserve(rgb.size() * 4);
+    for (std::size_t i = 0; i < rgb.size(); ++i)
+    {
+        colors_.push_back(rgb[i].r);
+        colors_.push_back(rgb[i].g);
+        colors_.push_back(rgb[i].b);
+        colors_.push_back(i < alpha.size() ? static_cast<unsigned char>(alpha[i]) : 0xff);
+    }
+    uv_mutex_init(&mutex_);
+}
+
+palette_lookup::~palette_lookup()
+{
+    uv_mutex_destroy(&mutex_);
+}
+
+void palette_lookup::prepare() const
+{
+    uv_mutex_lock(&mutex_);
+    try
+    {
+        if (!built_)
+        {
+            build();
+            built_ = true;
+        }
+    }
+    catch (...)
+    {
+        uv_mutex_unlock(&mutex_);
+        throw;
+    }
+    uv_mutex_unlock(&mutex_);
+}
+
+void palette_lookup::build() const
+{
+    std::size_t n = size();
+    if (n == 0 || n > 256)
+    {
+        throw std::runtime_error("palette must have between 1 and 256 colors");
+    }
+    for (std::size_t e = 0; e < n; ++e)
+    {
+        unsigned char const* c = &colors_[e * 4];
+        unsigned key = c[0] | (c[1] << 8) | (c[2] << 16) | (static_cast<unsigned>(c[3]) << 24);
+        // insert keeps the first, lowest, index for duplicate colors
+        exact_.insert(std::make_pair(key, static_cast<unsigned char>(e)));
+    }
+
+    // smallest and largest squared distance along one channel between an
+    // entry and any value of a grid level, indexed [channel][level][entry]
+    std::vector<unsigned> near_d(4 * levels * n);
+    std::vector<unsigned> far_d(4 * levels * n);
+    for (unsigned ch = 0; ch < 4; ++ch)
+    {
+        for (unsigned l = 0; l < levels; ++l)
+        {
+            int lo = l << cell_bits;
+            int hi = lo + (1 << cell_bits) - 1;
+            for (std::size_t e = 0; e < n; ++e)
+            {
+                int v = colors_[e * 4 + ch];
+                int d_near = v < lo ? lo - v : (v > hi ? v - hi : 0);
+                int d_far = std::max(v - lo, hi - v);
+                near_d[(ch * levels + l) * n + e] = d_near * d_near;
+                far_d[(ch * levels + l) * n + e] = d_far * d_far;
+            }
+        }
+    }
+
+    // an entry can only be nearest for some color in the cell if its
+    // closest possible distance is within the best guaranteed distance
+    offsets_.assign(num_cells + 1, 0);
+    candidates_.clear();
+    std::vector<unsigned> near_gba(n);
+    std::vector<unsigned> far_gba(n);
+    for (unsigned cell_gba = 0; cell_gba < num_cells / levels; ++cell_gba)
+    {
+        unsigned lg = cell_gba & 0xf;
+        unsigned lb = (cell_gba >> 4) & 0xf;
+        unsigned la = cell_gba >> 8;
+        unsigned const* ng = &near_d[(1 * levels + lg) * n];
+        unsigned const* nb = &near_d[(2 * levels + lb) * n];
+        unsigned const* na = &near_d[(3 * levels + la) * n];
+        unsigned const* fg = &far_d[(1 * levels + lg) * n];
+        unsigned const* fb = &far_d[(2 * levels + lb) * n];
+        unsigned const* fa = &far_d[(3 * levels + la) * n];
+        for (std::size_t e = 0; e < n; ++e)
+        {
+            near_gba[e] = ng[e] + nb[e] + na[e];
+            far_gba[e] = fg[e] + fb[e] + fa[e];
+        }
+        for (unsigned lr = 0; lr < levels; ++lr)
+        {
+            unsigned cell = lr | (cell_gba << cell_bits);
+            unsigned const* nr = &near_d[lr * n];
+            unsigned const* fr = &far_d[lr * n];
+            unsigned bound = ~0u;
+            for (std::size_t e = 0; e < n; ++e)
+            {
+                bound = std::min(bound, far_gba[e] + fr[e]);
+            }
+            offsets_[cell] = static_cast<unsigned>(candidates_.size());
+            for (std::size_t e = 0; e < n; ++e)
+            {
+                if (near_gba[e] + nr[e] <= bound)
+                {
+                    candidates_.push_back(static_cast<unsigned char>(e));
+                }
+            }
+        }
+    }
+    offsets_[num_cells] = static_cast<unsigned>(candidates_.size());
+}
+
+unsigned char palette_lookup::quantize(unsigned rgba) const
+{
+    // fully transparent pixels take the first entry, as in mapnik
+    if (rgba == 0)
+    {
+        return 0;
+    }
+    boost::unordered_map<unsigned, unsigned char>::const_iterator it = exact_.find(rgba);
+    if (it != exact_.end())
+    {
+        return it->second;
+    }
+    unsigned cell = cell_of(rgba);
+    unsigned char const* c = candidates_.empty() ? 0 : &candidates_[0];
+    unsigned char best = c[offsets_[cell]];
+    unsigned best_d = distance(&colors_[best * 4], rgba);
+    for (unsigned i = offsets_[cell] + 1; i < offsets_[cell + 1]; ++i)
+    {
+        unsigned d = distance(&colors_[c[i] * 4], rgba);
+        // candidates are in index order so a tie keeps the lower index
+        if (d < best_d)
+        {
+            best_d = d;
+            best = c[i];
+        }
+    }
+    return best;
+}
+
+void save_to_png8(unsigned const* pixels,
+                  std::size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  palette_lookup const& lookup,
+                  std::ostream & out)
+{
+    if (width == 0 || height == 0)
+    {
+        throw std::runtime_error("png8 encoder: image has no pixels");
+    }
+    lookup.prepare();
+
+    std::size_t n = lookup.size();
+    unsigned bit_depth = 8;
+    if (n <= 2) bit_depth = 1;
+    else if (n <= 4) bit_depth = 2;
+    else if (n <= 16) bit_depth = 4;
+
+    write_png_header(out, width, height, bit_depth, 3);
+
+    std::vector<unsigned char> const& colors = lookup.colors();
+    std::string plte;
+    std::string trns;
+    std::size_t trns_length = 0;
+    for (std::size_t e = 0; e < n; ++e)
+    {
+        plte.append(reinterpret_cast<char const*>(&colors[e * 4]), 3);
+        trns.push_back(static_cast<char>(colors[e * 4 + 3]));
+        if (colors[e * 4 + 3] != 0xff) trns_length = e + 1;
+    }
+    std::string const* plte_pieces[] = { &plte };
+    write_png_chunk(out, "PLTE", plte_pieces, 1);
+    if (trns_length > 0)
+    {
+        // entries after the last translucent one default to opaque
+        trns.resize(trns_length);
+        std::string const* trns_pieces[] = { &trns };
+        write_png_chunk(out, "tRNS", trns_pieces, 1);
+    }
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        throw std::runtime_error("png8 encoder: deflateInit failed");
+    }
+
+    std::size_t row_bytes = (static_cast<std::size_t>(width) * bit_depth + 7) / 8;
+    std::vector<unsigned char> row(row_bytes);
+    std::vector<unsigned char> prev_row(row_bytes);
+    std::vector<unsigned char> filtered(row_bytes + 1);
+    std::vector<unsigned char> scratch;
+    std::string idat;
+    unsigned char chunk[65536];
+    unsigned last_pixel = 0;
+    unsigned char last_index = lookup.quantize(0);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned const* src = pixels + y * stride;
+        std::fill(row.begin(), row.end(), 0);  // clear packing bits
+        unsigned char * dst = &row[0];
+        for (unsigned x = 0; x < width; ++x)
+        {
+            // neighbouring pixels are usually the same color
+            if (src[x] != last_pixel)
+            {
+                last_pixel = src[x];
+                last_index = lookup.quantize(last_pixel);
+            }
+            std::size_t bit = static_cast<std::size_t>(x) * bit_depth;
+            dst[bit >> 3] |= static_cast<unsigned char>(last_index << (8 - bit_depth - (bit & 7)));
+        }
+        filter_row(y > 0 ? &prev_row[0] : 0, &row[0], row_bytes, 1, scratch, &filtered[0]);
+        row.swap(prev_row);
+        strm.next_in = &filtered[0];
+        strm.avail_in = static_cast<uInt>(filtered.size());
+        int flush = (y + 1 == height) ? Z_FINISH : Z_NO_FLUSH;
+        do
+        {
+            strm.next_out = chunk;
+            strm.avail_out = sizeof(chunk);
+            if (deflate(&strm, flush) == Z_STREAM_ERROR)
+            {
+                deflateEnd(&strm);
+                throw std::runtime_error("png8 encoder: deflate failed");
+            }
+            idat.append(reinterpret_cast<char *>(chunk), sizeof(chunk) - strm.avail_out);
+        }
+        while (strm.avail_out == 0);
+        if (idat.size() >= sizeof(chunk))
+        {
+            std::string const* pieces[] = { &idat };
+            write_png_chunk(out, "IDAT", pieces, 1);
+            idat.clear();
+        }
+    }
+    deflateEnd(&strm);
+    if (!idat.empty())
+    {
+        std::string const* pieces[] = { &idat };
+        write_png_chunk(out, "IDAT", pieces, 1);
+    }
+    std::string const empty;
+    std::string const* iend_pieces[] = { &empty };
+    write_png_chunk(out, "IEND", iend_pieces, 1);
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef __NODE_MAPNIK_PALETTE_LOOKUP_H__
+#define __NODE_MAPNIK_PALETTE_LOOKUP_H__
+
+#include <uv.h>
+
+#include "pixel_scan.hpp"
+
+// mapnik
+#include <mapnik/palette.hpp>           // for rgba_palette
+
+// boost
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+// stl
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace node_mapnik {
+
+// Nearest color search for one palette, built once and then shared by
+// every encode that uses the palette, from any thread. Colors that are in
+// the palette resolve through a hash; anything else is looked up in a
+// grid of 16 levels per rgba channel whose cells list the only palette
+// entries that can be nearest to a color inside the cell.
+class palette_lookup : private boost::noncopyable
+{
+public:
+    explicit palette_lookup(mapnik::rgba_palette const& palette);
+    ~palette_lookup();
+
+    // builds the tables on first use, safe to call concurrently
+    void prepare() const;
+
+    // index of the entry with the smallest squared rgba distance to the
+    // pixel (lowest index on ties); prepare() must have been called
+    unsigned char quantize(unsigned rgba) const;
+
+    std::size_t size() const { return colors_.size() / 4; }
+    std::vector<unsigned char> const& colors() const { return colors_; }
+
+private:
+    void build() const;
+
+    // r,g,b,a per entry
+    std::vector<unsigned char> colors_;
+    mutable boost::unordered_map<unsigned, unsigned char> exact_;
+    // candidates for cell i are candidates_[offsets_[i] .. offsets_[i+1])
+    mutable std::vector<unsigned> offsets_;
+    mutable std::vector<unsigned char> candidates_;
+    mutable bool built_;
+    mutable uv_mutex_t mutex_;
+};
+
+typedef boost::shared_ptr<palette_lookup> palette_lookup_ptr;
+
+// formats mapnik writes as a plain 8 bit paletted png when given a palette
+inline bool png8_lookup_support(std::string const& format)
+{
+    return format == "png" || format == "png8" || format == "png256";
+}
+
+// Writes rows of 32 bit pixels as a paletted png with the smallest bit
+// depth that holds the palette, like mapnik's png8 writer. `stride` is the
+// distance between rows in pixels so image views can be written too.
+void save_to_png8(unsigned const* pixels,
+                  std::size_t stride,
+                  unsigned width,
+                  unsigned height,
+                  palette_lookup const& lookup,
+                  std::ostream & out);
+
+template <typename T>
+void save_to_png8(T const& image, palette_lookup const& lookup, std::ostream & out)
+{
+    save_to_png8(image.getRow(0), row_stride(image), image.width(), image.height(), lookup, out);
+}
+
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef __NODE_MAPNIK_PIXEL_ACCESS_H__
+#define __NODE_MAPNIK_PIXEL_ACCESS_H__
+
+// v8
+#include <v8.h>
+
+// stl
+#include <cstddef>
+#include <cstring>
+
+using namespace v8;
+
+// Bulk pixel access between images (image_data_32 or an image_view of
+// one) and typed arrays. Pixels are the raw 32 bit values, 0xAABBGGRR as
+// a Uint32Array element on little endian machines, in whatever
+// premultiplied state the image is in.
+namespace node_mapnik {
+
+// The elements of a typed array of the given type (kExternalIntArray for
+// an Int32Array, kExternalUnsignedIntArray for a Uint32Array), 0 if value
+// is not one.
+inline void * typed_array_data(Handle<Value> value, ExternalArrayType type, std::size_t & length)
+{
+    if (!value->IsObject()) return 0;
+    Local<Object> obj = value->ToObject();
+    if (!obj->HasIndexedPropertiesInExternalArrayData() ||
+        obj->GetIndexedPropertiesExternalArrayDataType() != type)
+    {
+        return 0;
+    }
+    length = obj->GetIndexedPropertiesExternalArrayDataLength();
+    return obj->GetIndexedPropertiesExternalArrayData();
+}
+
+// new Uint32Array(length), through the global constructor
+inline Local<Object> new_uint32_array(std::size_t length)
+{
+    Local<Function> ctor = Local<Function>::Cast(Context::GetCurrent()->Global()->Get(String::NewSymbol("Uint32Array")));
+    Local<Value> argv[1] = { Integer::NewFromUnsigned(static_cast<unsigned>(length)) };
+    return ctor->NewInstance(1, argv);
+}
+
+// out[i] is the pixel at (coords[2i], coords[2i + 1]), 0 outside the image
+template <typename T>
+void get_pixels(T const& image, int const* coords, std::size_t count, unsigned * out)
+{
+    int width = static_cast<int>(image.width());
+    int height = static_cast<int>(image.height());
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        int x = coords[2 * i];
+        int y = coords[2 * i + 1];
+        out[i] = (x >= 0 && x < width && y >= 0 && y < height) ? image.getRow(y)[x] : 0;
+    }
+}
+
+// true when every (x, y) pair of coords is inside the image
+template <typename T>
+bool pixels_inside(T const& image, int const* coords, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        int x = coords[2 * i];
+        int y = coords[2 * i + 1];
+        if (x < 0 || y < 0 || x >= static_cast<int>(image.width()) || y >= static_cast<int>(image.height()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void set_pixels(T & image, int const* coords, std::size_t count, unsigned const* values)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        image.getRow(coords[2 * i + 1])[coords[2 * i]] = values[i];
+    }
+}
+
+// true when the width x height region at (x, y) is non empty and inside
+template <typename T>
+bool region_inside(T const& image, int x, int y, int width, int height)
+{
+    return x >= 0 && y >= 0 && width > 0 && height > 0 &&
+        width <= static_cast<int>(image.width()) - x &&
+        height <= static_cast<int>(image.height()) - y;
+}
+
+// x, y, width and height of readPixels/writePixels, throws and returns
+// false unless they are integers describing a region inside the image
+template <typename T>
+bool parse_pixel_region(const Arguments& args, T const& image, int region[4])
+{
+    if (args.Length() < 4)
+    {
+        ThrowException(Exception::TypeError(String::New("expects x, y, width and height")));
+        return false;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!args[i]->IsNumber())
+        {
+            ThrowException(Exception::TypeError(String::New("x, y, width and height must be integers")));
+            return false;
+        }
+        region[i] = args[i]->IntegerValue();
+    }
+    if (!region_inside(image, region[0], region[1], region[2], region[3]))
+    {
+        ThrowException(Exception::TypeError(String::New("region must be non empty and inside the image")));
+        return false;
+    }
+    return true;
+}
+
+// copies the region row by row into out, width * height pixels
+template <typename T>
+void read_region(T const& image, unsigned x, unsigned y, unsigned width, unsigned height, unsigned * out)
+{
+    for (unsigned row = 0; row < height; ++row)
+    {
+        std::memcpy(out + static_cast<std::size_t>(row) * width, image.getRow(y + row) + x, width * 4);
+    }
+}
+
+template <typename T>
+void write_region(T & image, unsigned x, unsigned y, unsigned width, unsigned height, unsigned const* in)
+{
+    for (unsigned row = 0; row < height; ++row)
+    {
+        std::memcpy(image.getRow(y + row) + x, in + static_cast<std::size_t>(row) * width, width * 4);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,1022 @@
+#include "pixel_kernels.hpp"
+
+// stl
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NODE_MAPNIK_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is compiled per function with a target attribute and only used when
+// the cpu reports support, so the addon still loads on older machines.
+// gcc < 4.9 does not expose avx2 intrinsics without -mavx2.
+#if defined(NODE_MAPNIK_SSE2) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define NODE_MAPNIK_AVX2
+#include <immintrin.h>
+#define NODE_MAPNIK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define NODE_MAPNIK_NEON
+#include <arm_neon.h>
+#endif
+
+namespace node_mapnik {
+
+void premultiply_scalar(unsigned char * data, std::size_t num_pixels)
+{
+    for (std::size_t i = 0; i < num_pixels; ++i, data += 4)
+    {
+        unsigned a = data[3];
+        if (a == 255) continue;
+        if (a == 0)
+        {
+            data[0] = data[1] = data[2] = 0;
+            continue;
+        }
+        data[0] = static_cast<unsigned char>((data[0] * a + 255) >> 8);
+        data[1] = static_cast<unsigned char>((data[1] * a + 255) >> 8);
+        data[2] = static_cast<unsigned char>((data[2] * a + 255) >> 8);
+    }
+}
+
+void demultiply_scalar(unsigned char * data, std::size_t num_pixels)
+{
+    for (std::size_t i = 0; i < num_pixels; ++i, data += 4)
+    {
+        unsigned a = data[3];
+        if (a == 255) continue;
+        if (a == 0)
+        {
+            data[0] = data[1] = data[2] = 0;
+            continue;
+        }
+        for (unsigned c = 0; c < 3; ++c)
+        {
+            unsigned v = data[c] * 255 / a;
+            data[c] = static_cast<unsigned char>(v > 255 ? 255 : v);
+        }
+    }
+}
+
+#if defined(NODE_MAPNIK_SSE2)
+
+static inline __m128i premultiply_4_sse2(__m128i v)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    __m128i const bias = _mm_set1_epi16(255);
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+    __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+    // c * a + 255 <= 65280 so 16 bit lanes never overflow
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, alo), bias), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, ahi), bias), 8);
+    __m128i res = _mm_packus_epi16(lo, hi);
+    return _mm_or_si128(_mm_andnot_si128(alpha_mask, res), _mm_and_si128(alpha_mask, v));
+}
+
+// c * 255 / a in single precision truncates to the same integer as the
+// integer division: the quotient is never closer than 1/a to the next
+// integer, far more than the rounding error of one float division.
+static inline __m128i demultiply_1_sse2(__m128i p)
+{
+    __m128 const max = _mm_set1_ps(255.0f);
+    __m128 c = _mm_cvtepi32_ps(p);
+    __m128 a = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3,3,3,3));
+    __m128 r = _mm_min_ps(_mm_div_ps(_mm_mul_ps(c, max), a), max);
+    return _mm_cvttps_epi32(r);
+}
+
+static inline __m128i demultiply_4_sse2(__m128i v)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i p0 = demultiply_1_sse2(_mm_unpacklo_epi16(lo, zero));
+    __m128i p1 = demultiply_1_sse2(_mm_unpackhi_epi16(lo, zero));
+    __m128i p2 = demultiply_1_sse2(_mm_unpacklo_epi16(hi, zero));
+    __m128i p3 = demultiply_1_sse2(_mm_unpackhi_epi16(hi, zero));
+    __m128i res = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    // fully transparent pixels come out of the division as garbage
+    __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(v, alpha_mask), zero);
+    res = _mm_andnot_si128(transparent, res);
+    return _mm_or_si128(_mm_andnot_si128(alpha_mask, res), _mm_and_si128(alpha_mask, v));
+}
+
+static void premultiply_sse2(unsigned char * data, std::size_t num_pixels)
+{
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        __m128i * p = reinterpret_cast<__m128i *>(data + i * 4);
+        __m128i v = _mm_loadu_si128(p);
+        // opaque pixels are unchanged, skip the store
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha_mask), alpha_mask)) == 0xffff) continue;
+        _mm_storeu_si128(p, premultiply_4_sse2(v));
+    }
+    premultiply_scalar(data + i * 4, num_pixels - i);
+}
+
+static void demultiply_sse2(unsigned char * data, std::size_t num_pixels)
+{
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        __m128i * p = reinterpret_cast<__m128i *>(data + i * 4);
+        __m128i v = _mm_loadu_si128(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha_mask), alpha_mask)) == 0xffff) continue;
+        _mm_storeu_si128(p, demultiply_4_sse2(v));
+    }
+    demultiply_scalar(data + i * 4, num_pixels - i);
+}
+
+#endif // NODE_MAPNIK_SSE2
+
+#if defined(NODE_MAPNIK_AVX2)
+
+NODE_MAPNIK_TARGET_AVX2
+static inline __m256i premultiply_8_avx2(__m256i v)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const alpha_mask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    __m256i const bias = _mm256_set1_epi16(255);
+    // unpack and pack both work within 128 bit lanes so pixel order survives
+    __m256i lo = _mm256_unpacklo_epi8(v, zero);
+    __m256i hi = _mm256_unpackhi_epi8(v, zero);
+    __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+    __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, alo), bias), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, ahi), bias), 8);
+    __m256i res = _mm256_packus_epi16(lo, hi);
+    return _mm256_or_si256(_mm256_andnot_si256(alpha_mask, res), _mm256_and_si256(alpha_mask, v));
+}
+
+NODE_MAPNIK_TARGET_AVX2
+static inline __m256i demultiply_2_avx2(__m128i px)
+{
+    __m256 const max = _mm256_set1_ps(255.0f);
+    __m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(px));
+    __m256 a = _mm256_shuffle_ps(c, c, _MM_SHUFFLE(3,3,3,3));
+    __m256 r = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(c, max), a), max);
+    return _mm256_cvttps_epi32(r);
+}
+
+NODE_MAPNIK_TARGET_AVX2
+static inline __m256i demultiply_8_avx2(__m256i v)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const alpha_mask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    __m128i lo = _mm256_castsi256_si128(v);
+    __m128i hi = _mm256_extracti128_si256(v, 1);
+    __m256i p01 = demultiply_2_avx2(lo);
+    __m256i p23 = demultiply_2_avx2(_mm_srli_si128(lo, 8));
+    __m256i p45 = demultiply_2_avx2(hi);
+    __m256i p67 = demultiply_2_avx2(_mm_srli_si128(hi, 8));
+    // lane-wise packing leaves the pixels as 0,2,4,6,1,3,5,7
+    __m256i res = _mm256_packus_epi16(_mm256_packs_epi32(p01, p23), _mm256_packs_epi32(p45, p67));
+    res = _mm256_permutevar8x32_epi32(res, _mm256_setr_epi32(0,4,1,5,2,6,3,7));
+    __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(v, alpha_mask), zero);
+    res = _mm256_andnot_si256(transparent, res);
+    return _mm256_or_si256(_mm256_andnot_si256(alpha_mask, res), _mm256_and_si256(alpha_mask, v));
+}
+
+NODE_MAPNIK_TARGET_AVX2
+static void premultiply_avx2(unsigned char * data, std::size_t num_pixels)
+{
+    __m256i const alpha_mask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        __m256i * p = reinterpret_cast<__m256i *>(data + i * 4);
+        __m256i v = _mm256_loadu_si256(p);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(v, alpha_mask), alpha_mask)) == -1) continue;
+        _mm256_storeu_si256(p, premultiply_8_avx2(v));
+    }
+    premultiply_sse2(data + i * 4, num_pixels - i);
+}
+
+NODE_MAPNIK_TARGET_AVX2
+static void demultiply_avx2(unsigned char * data, std::size_t num_pixels)
+{
+    __m256i const alpha_mask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    std::size_t i = 0;
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        __m256i * p = reinterpret_cast<__m256i *>(data + i * 4);
+        __m256i v = _mm256_loadu_si256(p);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(v, alpha_mask), alpha_mask)) == -1) continue;
+        _mm256_storeu_si256(p, demultiply_8_avx2(v));
+    }
+    demultiply_sse2(data + i * 4, num_pixels - i);
+}
+
+#endif // NODE_MAPNIK_AVX2
+
+#if defined(NODE_MAPNIK_NEON)
+
+static inline uint8x16_t premultiply_channel_neon(uint8x16_t c, uint8x16_t a)
+{
+    uint16x8_t const bias = vdupq_n_u16(255);
+    uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(c), vget_low_u8(a)), bias);
+    uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(c), vget_high_u8(a)), bias);
+    return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+static void premultiply_neon(unsigned char * data, std::size_t num_pixels)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= num_pixels; i += 16)
+    {
+        unsigned char * p = data + i * 4;
+        uint8x16x4_t px = vld4q_u8(p);
+        px.val[0] = premultiply_channel_neon(px.val[0], px.val[3]);
+        px.val[1] = premultiply_channel_neon(px.val[1], px.val[3]);
+        px.val[2] = premultiply_channel_neon(px.val[2], px.val[3]);
+        vst4q_u8(p, px);
+    }
+    premultiply_scalar(data + i * 4, num_pixels - i);
+}
+
+#if defined(__aarch64__)
+
+// armv7 NEON has no exact float division, so only aarch64 gets this one
+static inline uint32x4_t demultiply_4_neon(uint32x4_t c, float32x4_t a)
+{
+    float32x4_t const max = vdupq_n_f32(255.0f);
+    float32x4_t r = vminq_f32(vdivq_f32(vmulq_f32(vcvtq_f32_u32(c), max), a), max);
+    return vcvtq_u32_f32(r);
+}
+
+static inline uint8x16_t demultiply_channel_neon(uint8x16_t c, uint8x16_t a)
+{
+    uint16x8_t c_lo = vmovl_u8(vget_low_u8(c));
+    uint16x8_t c_hi = vmovl_u8(vget_high_u8(c));
+    uint16x8_t a_lo = vmovl_u8(vget_low_u8(a));
+    uint16x8_t a_hi = vmovl_u8(vget_high_u8(a));
+    uint32x4_t r0 = demultiply_4_neon(vmovl_u16(vget_low_u16(c_lo)), vcvtq_f32_u32(vmovl_u16(vget_low_u16(a_lo))));
+    uint32x4_t r1 = demultiply_4_neon(vmovl_u16(vget_high_u16(c_lo)), vcvtq_f32_u32(vmovl_u16(vget_high_u16(a_lo))));
+    uint32x4_t r2 = demultiply_4_neon(vmovl_u16(vget_low_u16(c_hi)), vcvtq_f32_u32(vmovl_u16(vget_low_u16(a_hi))));
+    uint32x4_t r3 = demultiply_4_neon(vmovl_u16(vget_high_u16(c_hi)), vcvtq_f32_u32(vmovl_u16(vget_high_u16(a_hi))));
+    uint8x8_t lo = vmovn_u16(vcombine_u16(vmovn_u32(r0), vmovn_u32(r1)));
+    uint8x8_t hi = vmovn_u16(vcombine_u16(vmovn_u32(r2), vmovn_u32(r3)));
+    // zero alpha divides by zero, force those pixels to 0
+    return vandq_u8(vcombine_u8(lo, hi), vtstq_u8(a, a));
+}
+
+static void demultiply_neon(unsigned char * data, std::size_t num_pixels)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= num_pixels; i += 16)
+    {
+        unsigned char * p = data + i * 4;
+        uint8x16x4_t px = vld4q_u8(p);
+        if (vminvq_u8(px.val[3]) == 255) continue;
+        px.val[0] = demultiply_channel_neon(px.val[0], px.val[3]);
+        px.val[1] = demultiply_channel_neon(px.val[1], px.val[3]);
+        px.val[2] = demultiply_channel_neon(px.val[2], px.val[3]);
+        vst4q_u8(p, px);
+    }
+    demultiply_scalar(data + i * 4, num_pixels - i);
+}
+
+#endif // __aarch64__
+
+#endif // NODE_MAPNIK_NEON
+
+// agg comp_op_rgba_src_over, comp_op_rgba_multiply and comp_op_rgba_screen
+// on premultiplied rgba8. Results are truncated to 8 bits like agg's
+// value_type casts so even out of range input gives identical output.
+void blend_row_scalar(blend_mode mode,
+                      unsigned char * dst,
+                      unsigned char const* src,
+                      std::size_t num_pixels,
+                      unsigned cover)
+{
+    for (std::size_t i = 0; i < num_pixels; ++i, dst += 4, src += 4)
+    {
+        unsigned sr = src[0];
+        unsigned sg = src[1];
+        unsigned sb = src[2];
+        unsigned sa = src[3];
+        if (cover < 255)
+        {
+            sr = (sr * cover + 255) >> 8;
+            sg = (sg * cover + 255) >> 8;
+            sb = (sb * cover + 255) >> 8;
+            sa = (sa * cover + 255) >> 8;
+        }
+        unsigned dr = dst[0];
+        unsigned dg = dst[1];
+        unsigned db = dst[2];
+        unsigned da = dst[3];
+        switch (mode)
+        {
+        case BLEND_SRC_OVER:
+        {
+            unsigned s1a = 255 - sa;
+            dst[0] = static_cast<unsigned char>(sr + ((dr * s1a + 255) >> 8));
+            dst[1] = static_cast<unsigned char>(sg + ((dg * s1a + 255) >> 8));
+            dst[2] = static_cast<unsigned char>(sb + ((db * s1a + 255) >> 8));
+            dst[3] = static_cast<unsigned char>(sa + da - ((sa * da + 255) >> 8));
+            break;
+        }
+        case BLEND_MULTIPLY:
+        {
+            if (!sa) break;
+            unsigned s1a = 255 - sa;
+            unsigned d1a = 255 - da;
+            dst[0] = static_cast<unsigned char>((sr * dr + sr * d1a + dr * s1a + 255) >> 8);
+            dst[1] = static_cast<unsigned char>((sg * dg + sg * d1a + dg * s1a + 255) >> 8);
+            dst[2] = static_cast<unsigned char>((sb * db + sb * d1a + db * s1a + 255) >> 8);
+            dst[3] = static_cast<unsigned char>(sa + da - ((sa * da + 255) >> 8));
+            break;
+        }
+        case BLEND_SCREEN:
+        {
+            if (!sa) break;
+            dst[0] = static_cast<unsigned char>(sr + dr - ((sr * dr + 255) >> 8));
+            dst[1] = static_cast<unsigned char>(sg + dg - ((sg * dg + 255) >> 8));
+            dst[2] = static_cast<unsigned char>(sb + db - ((sb * db + 255) >> 8));
+            dst[3] = static_cast<unsigned char>(sa + da - ((sa * da + 255) >> 8));
+            break;
+        }
+        }
+    }
+}
+
+enum row_class
+{
+    ROW_MIXED = 0,
+    ROW_TRANSPARENT,
+    ROW_OPAQUE
+};
+
+// stops at the first pixel that rules out both fast paths
+static row_class classify_row(unsigned char const* src, std::size_t num_pixels)
+{
+    bool transparent = true;
+    bool opaque = true;
+    std::size_t i = 0;
+#if defined(NODE_MAPNIK_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    for (; i + 4 <= num_pixels && (transparent || opaque); i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 4));
+        transparent = transparent && _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff;
+        opaque = opaque && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha_mask), alpha_mask)) == 0xffff;
+    }
+#endif
+    for (; i < num_pixels && (transparent || opaque); ++i)
+    {
+        unsigned char const* p = src + i * 4;
+        transparent = transparent && (p[0] | p[1] | p[2] | p[3]) == 0;
+        opaque = opaque && p[3] == 255;
+    }
+    if (transparent) return ROW_TRANSPARENT;
+    if (opaque) return ROW_OPAQUE;
+    return ROW_MIXED;
+}
+
+#if defined(NODE_MAPNIK_SSE2)
+
+static inline __m128i alpha_16_sse2(__m128i v)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+}
+
+static inline __m128i select_16_sse2(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// blends two pixels held as 16 bit lanes
+template <blend_mode Mode>
+static inline __m128i blend_2_sse2(__m128i s, __m128i d, __m128i cover, bool partial)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const c255 = _mm_set1_epi16(255);
+    __m128i const alpha_lanes = _mm_set_epi16(-1,0,0,0,-1,0,0,0);
+    if (partial)
+    {
+        s = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, cover), c255), 8);
+    }
+    __m128i sa = alpha_16_sse2(s);
+    // Da' = Sa + Da - Sa.Da is shared by all three modes
+    __m128i alpha = _mm_sub_epi16(_mm_add_epi16(s, d),
+                                  _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(sa, d), c255), 8));
+    __m128i res;
+    if (Mode == BLEND_SRC_OVER)
+    {
+        __m128i s1a = _mm_sub_epi16(c255, sa);
+        __m128i rgb = _mm_add_epi16(s, _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d, s1a), c255), 8));
+        res = select_16_sse2(alpha_lanes, alpha, rgb);
+    }
+    else if (Mode == BLEND_MULTIPLY)
+    {
+        // Sca.Dca + Sca.(1 - Da) + Dca.(1 - Sa) needs more than 16 bits,
+        // regroup as Sca.(Dca + 1 - Da) + Dca.(1 - Sa) for madd
+        __m128i const c255_32 = _mm_set1_epi32(255);
+        __m128i s1a = _mm_sub_epi16(c255, sa);
+        __m128i x = _mm_add_epi16(d, _mm_sub_epi16(c255, alpha_16_sse2(d)));
+        __m128i p0 = _mm_madd_epi16(_mm_unpacklo_epi16(s, d), _mm_unpacklo_epi16(x, s1a));
+        __m128i p1 = _mm_madd_epi16(_mm_unpackhi_epi16(s, d), _mm_unpackhi_epi16(x, s1a));
+        p0 = _mm_srli_epi32(_mm_add_epi32(p0, c255_32), 8);
+        p1 = _mm_srli_epi32(_mm_add_epi32(p1, c255_32), 8);
+        res = select_16_sse2(alpha_lanes, alpha, _mm_packs_epi32(p0, p1));
+        res = select_16_sse2(_mm_cmpeq_epi16(sa, zero), d, res);
+    }
+    else
+    {
+        res = _mm_sub_epi16(_mm_add_epi16(s, d),
+                            _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, d), c255), 8));
+        res = select_16_sse2(_mm_cmpeq_epi16(sa, zero), d, res);
+    }
+    // agg stores through value_type, keep the low 8 bits
+    return _mm_and_si128(res, c255);
+}
+
+template <blend_mode Mode>
+static void blend_row_sse2(unsigned char * dst,
+                           unsigned char const* src,
+                           std::size_t num_pixels,
+                           unsigned cover)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    __m128i const cover16 = _mm_set1_epi16(static_cast<short>(cover));
+    bool const partial = cover < 255;
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(s, zero)) == 0xffff) continue;
+        __m128i * p = reinterpret_cast<__m128i *>(dst + i * 4);
+        if (Mode == BLEND_SRC_OVER && !partial &&
+            _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha_mask), alpha_mask)) == 0xffff)
+        {
+            _mm_storeu_si128(p, s);
+            continue;
+        }
+        __m128i d = _mm_loadu_si128(p);
+        __m128i lo = blend_2_sse2<Mode>(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), cover16, partial);
+        __m128i hi = blend_2_sse2<Mode>(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), cover16, partial);
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    blend_row_scalar(Mode, dst + i * 4, src + i * 4, num_pixels - i, cover);
+}
+
+#endif // NODE_MAPNIK_SSE2
+
+bool is_solid_row_scalar(unsigned const* row, std::size_t num_pixels, unsigned value)
+{
+    for (std::size_t i = 0; i < num_pixels; ++i)
+    {
+        if (row[i] != value) return false;
+    }
+    return true;
+}
+
+#if defined(NODE_MAPNIK_SSE2)
+
+// 32 bytes per iteration
+static bool is_solid_row_sse2(unsigned const* row, std::size_t num_pixels, unsigned value)
+{
+    __m128i const v = _mm_set1_epi32(static_cast<int>(value));
+    std::size_t i = 0;
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i)), v);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i + 4)), v);
+        if (_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xffff) return false;
+    }
+    return is_solid_row_scalar(row + i, num_pixels - i, value);
+}
+
+#endif // NODE_MAPNIK_SSE2
+
+#if defined(NODE_MAPNIK_AVX2)
+
+NODE_MAPNIK_TARGET_AVX2
+static bool is_solid_row_avx2(unsigned const* row, std::size_t num_pixels, unsigned value)
+{
+    __m256i const v = _mm256_set1_epi32(static_cast<int>(value));
+    std::size_t i = 0;
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        __m256i a = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row + i)), v);
+        if (static_cast<unsigned>(_mm256_movemask_epi8(a)) != 0xffffffffu) return false;
+    }
+    return is_solid_row_scalar(row + i, num_pixels - i, value);
+}
+
+#endif // NODE_MAPNIK_AVX2
+
+#if defined(NODE_MAPNIK_NEON)
+
+static bool is_solid_row_neon(unsigned const* row, std::size_t num_pixels, unsigned value)
+{
+    uint32x4_t const v = vdupq_n_u32(value);
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        uint32x4_t eq = vceqq_u32(vld1q_u32(row + i), v);
+        uint32x2_t folded = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+        if ((vget_lane_u32(folded, 0) & vget_lane_u32(folded, 1)) != 0xffffffffu) return false;
+    }
+    return is_solid_row_scalar(row + i, num_pixels - i, value);
+}
+
+#endif // NODE_MAPNIK_NEON
+
+static inline unsigned char clamp_fixed(int sum)
+{
+    // 1.14 fixed point, rounded
+    sum = (sum + (1 << 13)) >> 14;
+    return static_cast<unsigned char>(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+}
+
+void convolve_row_scalar(unsigned char * dst,
+                         unsigned char const* src,
+                         std::size_t num_out,
+                         int const* starts,
+                         short const* weights,
+                         unsigned taps)
+{
+    for (std::size_t i = 0; i < num_out; ++i, dst += 4, weights += taps)
+    {
+        unsigned char const* s = src + starts[i] * 4;
+        int sum[4] = { 0, 0, 0, 0 };
+        for (unsigned t = 0; t < taps; ++t, s += 4)
+        {
+            for (unsigned c = 0; c < 4; ++c) sum[c] += weights[t] * s[c];
+        }
+        for (unsigned c = 0; c < 4; ++c) dst[c] = clamp_fixed(sum[c]);
+    }
+}
+
+void convolve_rows_scalar(unsigned char * dst,
+                          unsigned char const* const* rows,
+                          short const* weights,
+                          unsigned taps,
+                          std::size_t num_pixels)
+{
+    for (std::size_t i = 0; i < num_pixels * 4; ++i)
+    {
+        int sum = 0;
+        for (unsigned t = 0; t < taps; ++t) sum += weights[t] * rows[t][i];
+        dst[i] = clamp_fixed(sum);
+    }
+}
+
+void downsample_2x_scalar(unsigned char * dst,
+                          unsigned char const* row0,
+                          unsigned char const* row1,
+                          std::size_t num_out)
+{
+    for (std::size_t i = 0; i < num_out * 4; ++i)
+    {
+        std::size_t j = (i & ~std::size_t(3)) * 2 + (i & 3);
+        dst[i] = static_cast<unsigned char>((row0[j] + row0[j + 4] + row1[j] + row1[j + 4] + 2) >> 2);
+    }
+}
+
+void gray_to_alpha_row_scalar(unsigned * row, std::size_t num_pixels, unsigned rgb)
+{
+    rgb &= 0xffffff;
+    for (std::size_t i = 0; i < num_pixels; ++i)
+    {
+        unsigned p = row[i];
+        unsigned gray = (30 * (p & 0xff) + 59 * ((p >> 8) & 0xff) + 11 * ((p >> 16) & 0xff)) / 100;
+        row[i] = (gray << 24) | rgb;
+    }
+}
+
+std::size_t compare_row_scalar(unsigned const* a,
+                               unsigned const* b,
+                               std::size_t num_pixels,
+                               unsigned threshold,
+                               bool compare_alpha,
+                               unsigned * diff,
+                               unsigned & max_delta)
+{
+    unsigned const channels = compare_alpha ? 4 : 3;
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < num_pixels; ++i)
+    {
+        unsigned largest = 0;
+        for (unsigned c = 0; c < channels; ++c)
+        {
+            int delta = static_cast<int>((a[i] >> (c * 8)) & 0xff) - static_cast<int>((b[i] >> (c * 8)) & 0xff);
+            largest = std::max(largest, static_cast<unsigned>(delta < 0 ? -delta : delta));
+        }
+        max_delta = std::max(max_delta, largest);
+        bool differs = largest > threshold;
+        if (differs) ++count;
+        if (diff) diff[i] = differs ? 0xff0000ff : 0;
+    }
+    return count;
+}
+
+#if defined(NODE_MAPNIK_SSE2)
+
+static inline __m128i load_pixel_16_sse2(unsigned char const* p)
+{
+    int v;
+    std::memcpy(&v, p, 4);
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128());
+}
+
+// rounds and shifts four 1.14 sums and packs them into unsigned bytes
+static inline __m128i pack_fixed_sse2(__m128i a, __m128i b)
+{
+    __m128i const round = _mm_set1_epi32(1 << 13);
+    a = _mm_srai_epi32(_mm_add_epi32(a, round), 14);
+    b = _mm_srai_epi32(_mm_add_epi32(b, round), 14);
+    return _mm_packs_epi32(a, b);
+}
+
+// two taps per madd: pixels are interleaved per channel (r0 r1 g0 g1 ..)
+// against (w0 w1) pairs
+static void convolve_row_sse2(unsigned char * dst,
+                              unsigned char const* src,
+                              std::size_t num_out,
+                              int const* starts,
+                              short const* weights,
+                              unsigned taps)
+{
+    for (std::size_t i = 0; i < num_out; ++i, dst += 4, weights += taps)
+    {
+        unsigned char const* s = src + starts[i] * 4;
+        __m128i sum = _mm_setzero_si128();
+        unsigned t = 0;
+        for (; t + 2 <= taps; t += 2, s += 8)
+        {
+            __m128i px = _mm_unpacklo_epi16(load_pixel_16_sse2(s), load_pixel_16_sse2(s + 4));
+            int w = (static_cast<unsigned short>(weights[t + 1]) << 16) | static_cast<unsigned short>(weights[t]);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(px, _mm_set1_epi32(w)));
+        }
+        if (t < taps)
+        {
+            __m128i px = _mm_unpacklo_epi16(load_pixel_16_sse2(s), _mm_setzero_si128());
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(px, _mm_set1_epi32(static_cast<unsigned short>(weights[t]))));
+        }
+        __m128i packed = _mm_packus_epi16(pack_fixed_sse2(sum, sum), _mm_setzero_si128());
+        int v = _mm_cvtsi128_si32(packed);
+        std::memcpy(dst, &v, 4);
+    }
+}
+
+// four pixels (16 channels) per iteration, two rows per madd
+static void convolve_rows_sse2(unsigned char * dst,
+                               unsigned char const* const* rows,
+                               short const* weights,
+                               unsigned taps,
+                               std::size_t num_pixels)
+{
+    __m128i const zero = _mm_setzero_si128();
+    std::size_t n = num_pixels * 4;
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+        for (unsigned t = 0; t < taps; t += 2)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rows[t] + i));
+            __m128i b = zero;
+            int w = static_cast<unsigned short>(weights[t]);
+            if (t + 1 < taps)
+            {
+                b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rows[t + 1] + i));
+                w |= static_cast<unsigned short>(weights[t + 1]) << 16;
+            }
+            __m128i wv = _mm_set1_epi32(w);
+            __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+            __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+            __m128i b_lo = _mm_unpacklo_epi8(b, zero);
+            __m128i b_hi = _mm_unpackhi_epi8(b, zero);
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), wv));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), wv));
+            sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), wv));
+            sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), wv));
+        }
+        __m128i out = _mm_packus_epi16(pack_fixed_sse2(sum0, sum1), pack_fixed_sse2(sum2, sum3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+    for (; i < n; ++i)
+    {
+        int sum = 0;
+        for (unsigned t = 0; t < taps; ++t) sum += weights[t] * rows[t][i];
+        dst[i] = clamp_fixed(sum);
+    }
+}
+
+// two output pixels per iteration
+static void downsample_2x_sse2(unsigned char * dst,
+                               unsigned char const* row0,
+                               unsigned char const* row1,
+                               std::size_t num_out)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const two = _mm_set1_epi16(2);
+    std::size_t i = 0;
+    for (; i + 2 <= num_out; i += 2)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + i * 8));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + i * 8));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        // add each pixel's channels to its right neighbour's, then keep
+        // the low half of each register
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i * 4), _mm_packus_epi16(sum, zero));
+    }
+    downsample_2x_scalar(dst + i * 4, row0 + i * 8, row1 + i * 8, num_out - i);
+}
+
+// four pixels per iteration: r and b share a madd as the two 16 bit
+// halves of each lane, g takes a second one
+static void gray_to_alpha_row_sse2(unsigned * row, std::size_t num_pixels, unsigned rgb)
+{
+    __m128i const low_bytes = _mm_set1_epi32(0x00ff00ff);
+    __m128i const rb_weights = _mm_set1_epi32((11 << 16) | 30);
+    __m128i const g_weights = _mm_set1_epi32(59);
+    // x * 41944 >> 22 == x / 100 for every x up to 25500
+    __m128i const div100 = _mm_set1_epi32(41944);
+    __m128i const color = _mm_set1_epi32(static_cast<int>(rgb & 0xffffff));
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        __m128i * p = reinterpret_cast<__m128i *>(row + i);
+        __m128i v = _mm_loadu_si128(p);
+        __m128i rb = _mm_madd_epi16(_mm_and_si128(v, low_bytes), rb_weights);
+        __m128i g = _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xff)), g_weights);
+        __m128i gray = _mm_srli_epi32(_mm_mulhi_epu16(_mm_add_epi32(rb, g), div100), 6);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_slli_epi32(gray, 24), color));
+    }
+    gray_to_alpha_row_scalar(row + i, num_pixels - i, rgb);
+}
+
+// four pixels per iteration, byte deltas as max - min
+static std::size_t compare_row_sse2(unsigned const* a,
+                                    unsigned const* b,
+                                    std::size_t num_pixels,
+                                    unsigned threshold,
+                                    bool compare_alpha,
+                                    unsigned * diff,
+                                    unsigned & max_delta)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const channels = _mm_set1_epi32(compare_alpha ? -1 : 0x00ffffff);
+    __m128i const limit = _mm_set1_epi8(static_cast<char>(std::min(threshold, 255u)));
+    __m128i const red = _mm_set1_epi32(static_cast<int>(0xff0000ff));
+    __m128i largest = zero;
+    std::size_t count = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+        __m128i delta = _mm_and_si128(_mm_sub_epi8(_mm_max_epu8(va, vb), _mm_min_epu8(va, vb)), channels);
+        largest = _mm_max_epu8(largest, delta);
+        // lanes with no byte above the threshold are all ones
+        __m128i same = _mm_cmpeq_epi32(_mm_subs_epu8(delta, limit), zero);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(same));
+        count += 4 - ((mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1));
+        if (diff)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(diff + i), _mm_andnot_si128(same, red));
+        }
+    }
+    unsigned char bytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes), largest);
+    for (unsigned k = 0; k < 16; ++k) max_delta = std::max(max_delta, static_cast<unsigned>(bytes[k]));
+    return count + compare_row_scalar(a + i, b + i, num_pixels - i, threshold, compare_alpha,
+                                      diff ? diff + i : 0, max_delta);
+}
+
+#endif // NODE_MAPNIK_SSE2
+
+enum pixel_isa
+{
+    ISA_SCALAR = 0,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_NEON
+};
+
+static pixel_isa detect_isa()
+{
+#if defined(NODE_MAPNIK_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return ISA_AVX2;
+    }
+#endif
+#if defined(NODE_MAPNIK_SSE2)
+    return ISA_SSE2;
+#elif defined(NODE_MAPNIK_NEON)
+    return ISA_NEON;
+#else
+    return ISA_SCALAR;
+#endif
+}
+
+// resolved once at load time, before any threadpool work can run
+static pixel_isa const active_isa = detect_isa();
+
+void premultiply(unsigned char * data, std::size_t num_pixels)
+{
+    switch (active_isa)
+    {
+#if defined(NODE_MAPNIK_AVX2)
+    case ISA_AVX2:
+        premultiply_avx2(data, num_pixels);
+        return;
+#endif
+#if defined(NODE_MAPNIK_SSE2)
+    case ISA_SSE2:
+        premultiply_sse2(data, num_pixels);
+        return;
+#endif
+#if defined(NODE_MAPNIK_NEON)
+    case ISA_NEON:
+        premultiply_neon(data, num_pixels);
+        return;
+#endif
+    default:
+        premultiply_scalar(data, num_pixels);
+    }
+}
+
+void demultiply(unsigned char * data, std::size_t num_pixels)
+{
+    switch (active_isa)
+    {
+#if defined(NODE_MAPNIK_AVX2)
+    case ISA_AVX2:
+        demultiply_avx2(data, num_pixels);
+        return;
+#endif
+#if defined(NODE_MAPNIK_SSE2)
+    case ISA_SSE2:
+        demultiply_sse2(data, num_pixels);
+        return;
+#endif
+#if defined(NODE_MAPNIK_NEON) && defined(__aarch64__)
+    case ISA_NEON:
+        demultiply_neon(data, num_pixels);
+        return;
+#endif
+    default:
+        demultiply_scalar(data, num_pixels);
+    }
+}
+
+void blend_row(blend_mode mode,
+               unsigned char * dst,
+               unsigned char const* src,
+               std::size_t num_pixels,
+               unsigned cover)
+{
+    // a zero cover scales every source pixel to transparent
+    if (cover == 0) return;
+    switch (classify_row(src, num_pixels))
+    {
+    case ROW_TRANSPARENT:
+        return;
+    case ROW_OPAQUE:
+        if (mode == BLEND_SRC_OVER && cover == 255)
+        {
+            std::memcpy(dst, src, num_pixels * 4);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+#if defined(NODE_MAPNIK_SSE2)
+    switch (mode)
+    {
+    case BLEND_SRC_OVER:
+        blend_row_sse2<BLEND_SRC_OVER>(dst, src, num_pixels, cover);
+        return;
+    case BLEND_MULTIPLY:
+        blend_row_sse2<BLEND_MULTIPLY>(dst, src, num_pixels, cover);
+        return;
+    case BLEND_SCREEN:
+        blend_row_sse2<BLEND_SCREEN>(dst, src, num_pixels, cover);
+        return;
+    }
+#endif
+    blend_row_scalar(mode, dst, src, num_pixels, cover);
+}
+
+bool is_solid_row(unsigned const* row, std::size_t num_pixels, unsigned value)
+{
+    switch (active_isa)
+    {
+#if defined(NODE_MAPNIK_AVX2)
+    case ISA_AVX2:
+        return is_solid_row_avx2(row, num_pixels, value);
+#endif
+#if defined(NODE_MAPNIK_SSE2)
+    case ISA_SSE2:
+        return is_solid_row_sse2(row, num_pixels, value);
+#endif
+#if defined(NODE_MAPNIK_NEON)
+    case ISA_NEON:
+        return is_solid_row_neon(row, num_pixels, value);
+#endif
+    default:
+        return is_solid_row_scalar(row, num_pixels, value);
+    }
+}
+
+void convolve_row(unsigned char * dst,
+                  unsigned char const* src,
+                  std::size_t num_out,
+                  int const* starts,
+                  short const* weights,
+                  unsigned taps)
+{
+#if defined(NODE_MAPNIK_SSE2)
+    convolve_row_sse2(dst, src, num_out, starts, weights, taps);
+#else
+    convolve_row_scalar(dst, src, num_out, starts, weights, taps);
+#endif
+}
+
+void convolve_rows(unsigned char * dst,
+                   unsigned char const* const* rows,
+                   short const* weights,
+                   unsigned taps,
+                   std::size_t num_pixels)
+{
+#if defined(NODE_MAPNIK_SSE2)
+    convolve_rows_sse2(dst, rows, weights, taps, num_pixels);
+#else
+    convolve_rows_scalar(dst, rows, weights, taps, num_pixels);
+#endif
+}
+
+void downsample_2x(unsigned char * dst,
+                   unsigned char const* row0,
+                   unsigned char const* row1,
+                   std::size_t num_out)
+{
+#if defined(NODE_MAPNIK_SSE2)
+    downsample_2x_sse2(dst, row0, row1, num_out);
+#else
+    downsample_2x_scalar(dst, row0, row1, num_out);
+#endif
+}
+
+void gray_to_alpha_row(unsigned * row, std::size_t num_pixels, unsigned rgb)
+{
+#if defined(NODE_MAPNIK_SSE2)
+    gray_to_alpha_row_sse2(row, num_pixels, rgb);
+#else
+    gray_to_alpha_row_scalar(row, num_pixels, rgb);
+#endif
+}
+
+std::size_t compare_row(unsigned const* a,
+                        unsigned const* b,
+                        std::size_t num_pixels,
+                        unsigned threshold,
+                        bool compare_alpha,
+                        unsigned * diff,
+                        unsigned & max_delta)
+{
+#if defined(NODE_MAPNIK_SSE2)
+    return compare_row_sse2(a, b, num_pixels, threshold, compare_alpha, diff, max_delta);
+#else
+    return compare_row_scalar(a, b, num_pixels, threshold, compare_alpha, diff, max_delta);
+#endif
+}
+
+char const* pixel_kernels_isa()
+{
+    switch (active_isa)
+    {
+    case ISA_AVX2: return "avx2";
+    case ISA_SSE2: return "sse2";
+    case ISA_NEON: return "neon";
+    default: return "scalar";
+    }
+}
+
+}
@@ -0,0 +1,129 @@
+#ifndef __NODE_MAPNIK_PIXEL_KERNELS_H__
+#define __NODE_MAPNIK_PIXEL_KERNELS_H__
+
+// stl
+#include <cstddef>
+
+// Whole-buffer pixel operations on 32 bit RGBA data (mapnik::image_data_32
+// memory layout). Each function picks the widest implementation the CPU
+// supports at runtime and produces results bit-identical to the scalar
+// agg formulas used by mapnik.
+namespace node_mapnik {
+
+// agg::multiplier_rgba::premultiply: c = (c * a + 255) >> 8
+void premultiply(unsigned char * data, std::size_t num_pixels);
+
+// agg::multiplier_rgba::demultiply: c = min(255, c * 255 / a), 0 when a == 0
+void demultiply(unsigned char * data, std::size_t num_pixels);
+
+// scalar reference versions, always available
+void premultiply_scalar(unsigned char * data, std::size_t num_pixels);
+void demultiply_scalar(unsigned char * data, std::size_t num_pixels);
+
+// composite operations with a vectorized implementation, values match
+// the agg comp_op_rgba_* blenders
+enum blend_mode
+{
+    BLEND_SRC_OVER = 0,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN
+};
+
+// Blends one row of premultiplied source pixels onto premultiplied
+// destination pixels with the given cover (0-255), bit-identical to
+// agg::pixfmt_custom_blend_rgba::blend_from. A source row that is fully
+// transparent is skipped and a fully opaque one is copied for src_over.
+void blend_row(blend_mode mode,
+               unsigned char * dst,
+               unsigned char const* src,
+               std::size_t num_pixels,
+               unsigned cover);
+
+void blend_row_scalar(blend_mode mode,
+                      unsigned char * dst,
+                      unsigned char const* src,
+                      std::size_t num_pixels,
+                      unsigned cover);
+
+// true when every pixel of the row equals value, stops at the first
+// difference
+bool is_solid_row(unsigned const* row, std::size_t num_pixels, unsigned value);
+bool is_solid_row_scalar(unsigned const* row, std::size_t num_pixels, unsigned value);
+
+// Resampling, with weights in 1.14 fixed point and results rounded and
+// clamped to 0-255 (filters with negative lobes can overshoot).
+//
+// convolve_row: output pixel i is the sum over t < taps of
+// weights[i * taps + t] * src[starts[i] + t]
+void convolve_row(unsigned char * dst,
+                  unsigned char const* src,
+                  std::size_t num_out,
+                  int const* starts,
+                  short const* weights,
+                  unsigned taps);
+
+void convolve_row_scalar(unsigned char * dst,
+                         unsigned char const* src,
+                         std::size_t num_out,
+                         int const* starts,
+                         short const* weights,
+                         unsigned taps);
+
+// convolve_rows: output pixel x is the sum over t < taps of
+// weights[t] * rows[t][x]
+void convolve_rows(unsigned char * dst,
+                   unsigned char const* const* rows,
+                   short const* weights,
+                   unsigned taps,
+                   std::size_t num_pixels);
+
+void convolve_rows_scalar(unsigned char * dst,
+                          unsigned char const* const* rows,
+                          short const* weights,
+                          unsigned taps,
+                          std::size_t num_pixels);
+
+// 2:1 box filter: output pixel i is the rounded mean of pixels 2i and
+// 2i + 1 of both rows
+void downsample_2x(unsigned char * dst,
+                   unsigned char const* row0,
+                   unsigned char const* row1,
+                   std::size_t num_out);
+
+void downsample_2x_scalar(unsigned char * dst,
+                          unsigned char const* row0,
+                          unsigned char const* row1,
+                          std::size_t num_out);
+
+// Replaces every pixel with rgb (0x00bbggrr) under an alpha equal to
+// the pixel's gray level, (30 * r + 59 * g + 11 * b) / 100 truncated.
+void gray_to_alpha_row(unsigned * row, std::size_t num_pixels, unsigned rgb);
+void gray_to_alpha_row_scalar(unsigned * row, std::size_t num_pixels, unsigned rgb);
+
+// Counts the pixels of a and b whose largest channel difference is above
+// threshold, ignoring alpha unless compare_alpha is set, and raises
+// max_delta to the largest difference seen. When diff is given it gets
+// opaque red (0xff0000ff) for each differing pixel and 0 elsewhere.
+std::size_t compare_row(unsigned const* a,
+                        unsigned const* b,
+                        std::size_t num_pixels,
+                        unsigned threshold,
+                        bool compare_alpha,
+                        unsigned * diff,
+                        unsigned & max_delta);
+
+std::size_t compare_row_scalar(unsigned const* a,
+                               unsigned const* b,
+                               std::size_t num_pixels,
+                               unsigned threshold,
+                               bool compare_alpha,
+                               unsigned * diff,
+                               unsigned & max_delta);
+
+// name of the instruction set used by the dispatched kernels
+// ("avx2", "sse2", "neon" or "scalar")
+char const* pixel_kernels_isa();
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __NODE_MAPNIK_PIXEL_SCAN_H__
+#define __NODE_MAPNIK_PIXEL_SCAN_H__
+
+// boost
+#include <boost/unordered_set.hpp>
+
+// stl
+#include <cstddef>
+
+namespace node_mapnik {
+
+// distance in pixels between the rows of an image_data_32 or an image_view
+// of one, so scans can walk either through a pointer
+template <typename T>
+std::size_t row_stride(T const& image)
+{
+    return image.height() > 1 ? image.getRow(1) - image.getRow(0) : image.width();
+}
+
+// Distinct pixel values seen by a scan, counting stops once more than
+// max_colors were seen.
+class color_counter
+{
+public:
+    explicit color_counter(unsigned max_colors) :
+        seen_(),
+        max_colors_(max_colors),
+        last_(0) {}
+
+    // counts p and returns true unless it repeats the previous pixel:
+    // runs are common and add nothing new
+    inline bool add(unsigned p)
+    {
+        if (p == last_ && !seen_.empty()) return false;
+        last_ = p;
+        if (seen_.size() <= max_colors_) seen_.insert(p);
+        return true;
+    }
+
+    // more than max_colors distinct values were seen
+    bool capped() const { return seen_.size() > max_colors_; }
+
+    // distinct values seen, max_colors + 1 once capped
+    unsigned colors() const { return static_cast<unsigned>(seen_.size()); }
+
+private:
+    boost::unordered_set<unsigned> seen_;
+    unsigned max_colors_;
+    unsigned last_;
+};
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include "png_strip_encoder.hpp"
+
+#include <uv.h>
+#include <zlib.h>
+
+// stl
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace node_mapnik {
+
+namespace {
+
+// rows are filtered four bytes per pixel
+unsigned const rgba_bytes = 4;
+
+// largest dictionary deflate can use
+std::size_t const window_size = 32768;
+
+// don't split an image into strips smaller than this many rows
+unsigned const min_strip_rows = 32;
+
+// never run more strips at once than this, whatever the cpu count
+unsigned const max_strip_threads = 16;
+
+// the number of cpus libuv reports, 1 if it can't tell
+unsigned cpu_count()
+{
+    uv_cpu_info_t * cpu_infos = 0;
+    int count = 0;
+    uv_cpu_info(&cpu_infos, &count);
+    if (cpu_infos) uv_free_cpu_info(cpu_infos, count);
+    return count > 0 ? static_cast<unsigned>(count) : 1;
+}
+
+inline unsigned char paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+}
+
+// keeps the filter with the smallest sum of absolute values, the
+// heuristic libpng uses
+void filter_row(unsigned char const* prev,
+                unsigned char const* row,
+                std::size_t row_bytes,
+                unsigned bpp,
+                std::vector<unsigned char> & scratch,
+                unsigned char * out)
+{
+    scratch.resize(row_bytes * 5);
+    unsigned char * sub = &scratch[0];
+    unsigned char * up = sub + row_bytes;
+    unsigned char * avg = up + row_bytes;
+    unsigned char * pth = avg + row_bytes;
+    unsigned long sums[5] = { 0, 0, 0, 0, 0 };
+    for (std::size_t i = 0; i < row_bytes; ++i)
+    {
+        unsigned char a = i >= bpp ? row[i - bpp] : 0;
+        unsigned char b = prev ? prev[i] : 0;
+        unsigned char c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+        unsigned char x = row[i];
+        sub[i] = static_cast<unsigned char>(x - a);
+        up[i] = static_cast<unsigned char>(x - b);
+        avg[i] = static_cast<unsigned char>(x - ((a + b) >> 1));
+        pth[i] = static_cast<unsigned char>(x - paeth(a, b, c));
+        sums[0] += std::abs(static_cast<signed char>(x));
+        sums[1] += std::abs(static_cast<signed char>(sub[i]));
+        sums[2] += std::abs(static_cast<signed char>(up[i]));
+        sums[3] += std::abs(static_cast<signed char>(avg[i]));
+        sums[4] += std::abs(static_cast<signed char>(pth[i]));
+    }
+    unsigned best = 0;
+    for (unsigned f = 1; f < 5; ++f)
+    {
+        if (sums[f] < sums[best]) best = f;
+    }
+    out[0] = static_cast<unsigned char>(best);
+    std::copy(best == 0 ? row : &scratch[(best - 1) * row_bytes],
+              (best == 0 ? row : &scratch[(best - 1) * row_bytes]) + row_bytes,
+              out + 1);
+}
+
+namespace {
+
+struct strip_job
+{
+    mapnik::image_data_32 const* image;
+    unsigned y0;
+    unsigned y1;
+    int level;
+    bool last;
+    std::string deflated;
+    uLong adler;
+    uLong length;
+    std::string error;
+};
+
+unsigned char const* row_bytes_at(mapnik::image_data_32 const& image, unsigned y)
+{
+    return reinterpret_cast<unsigned char const*>(image.getRow(y));
+}
+
+void deflate_strip(strip_job & job)
+{
+    mapnik::image_data_32 const& image = *job.image;
+    std::size_t row_bytes = static_cast<std::size_t>(image.width()) * rgba_bytes;
+    std::size_t filtered_bytes = row_bytes + 1;
+    std::vector<unsigned char> scratch;
+    std::vector<unsigned char> filtered(filtered_bytes);
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    // raw deflate, the zlib header and trailer are written once for all strips
+    if (deflateInit2(&strm, job.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("png strip encoder: deflateInit2 failed");
+    }
+
+    // prime the window with the filtered rows just above the strip so the
+    // strip compresses about as well as it would in a single stream
+    if (job.y0 > 0)
+    {
+        unsigned rows = static_cast<unsigned>(std::min<std::size_t>(job.y0, (window_size + filtered_bytes - 1) / filtered_bytes));
+        std::vector<unsigned char> dictionary(rows * filtered_bytes);
+        for (unsigned i = 0; i < rows; ++i)
+        {
+            unsigned y = job.y0 - rows + i;
+            filter_row(y > 0 ? row_bytes_at(image, y - 1) : 0, row_bytes_at(image, y), row_bytes, rgba_bytes, scratch, &dictionary[i * filtered_bytes]);
+        }
+        std::size_t size = std::min(dictionary.size(), window_size);
+        deflateSetDictionary(&strm, &dictionary[dictionary.size() - size], static_cast<uInt>(size));
+    }
+
+    job.adler = adler32(0L, Z_NULL, 0);
+    job.length = 0;
+    unsigned char chunk[65536];
+    for (unsigned y = job.y0; y < job.y1; ++y)
+    {
+        filter_row(y > 0 ? row_bytes_at(image, y - 1) : 0, row_bytes_at(image, y), row_bytes, rgba_bytes, scratch, &filtered[0]);
+        job.adler = adler32(job.adler, &filtered[0], static_cast<uInt>(filtered_bytes));
+        job.length += filtered_bytes;
+        int flush = Z_NO_FLUSH;
+        if (y + 1 == job.y1)
+        {
+            // a sync flush ends on a byte boundary without the final-block
+            // bit so the next strip can follow directly
+            flush = job.last ? Z_FINISH : Z_SYNC_FLUSH;
+        }
+        strm.next_in = &filtered[0];
+        strm.avail_in = static_cast<uInt>(filtered_bytes);
+        do
+        {
+            strm.next_out = chunk;
+            strm.avail_out = sizeof(chunk);
+            int ret = deflate(&strm, flush);
+            if (ret == Z_STREAM_ERROR)
+            {
+                deflateEnd(&strm);
+                throw std::runtime_error("png strip encoder: deflate failed");
+            }
+            job.deflated.append(reinterpret_cast<char *>(chunk), sizeof(chunk) - strm.avail_out);
+        }
+        while (strm.avail_out == 0);
+    }
+    deflateEnd(&strm);
+}
+
+void run_strip(void * arg)
+{
+    strip_job * job = static_cast<strip_job *>(arg);
+    try
+    {
+        deflate_strip(*job);
+    }
+    catch (std::exception const& ex)
+    {
+        job->error = ex.what();
+    }
+}
+
+void put_uint32(std::string & s, uLong v)
+{
+    s.push_back(static_cast<char>((v >> 24) & 0xff));
+    s.push_back(static_cast<char>((v >> 16) & 0xff));
+    s.push_back(static_cast<char>((v >> 8) & 0xff));
+    s.push_back(static_cast<char>(v & 0xff));
+}
+
+}
+
+void write_png_chunk(std::ostream & out,
+                     char const* type,
+                     std::string const* pieces[],
+                     unsigned num_pieces)
+{
+    uLong length = 0;
+    for (unsigned i = 0; i < num_pieces; ++i) length += pieces[i]->size();
+    std::string head;
+    put_uint32(head, length);
+    head.append(type, 4);
+    out.write(head.data(), head.size());
+    uLong crc = crc32(0L, reinterpret_cast<Bytef const*>(type), 4);
+    for (unsigned i = 0; i < num_pieces; ++i)
+    {
+        out.write(pieces[i]->data(), pieces[i]->size());
+        crc = crc32(crc, reinterpret_cast<Bytef const*>(pieces[i]->data()), static_cast<uInt>(pieces[i]->size()));
+    }
+    std::string tail;
+    put_uint32(tail, crc);
+    out.write(tail.data(), tail.size());
+}
+
+void write_png_header(std::ostream & out,
+                      unsigned width,
+                      unsigned height,
+                      unsigned bit_depth,
+                      unsigned color_type)
+{
+    static char const signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+    out.write(signature, sizeof(signature));
+
+    std::string ihdr;
+    put_uint32(ihdr, width);
+    put_uint32(ihdr, height);
+    ihdr.push_back(static_cast<char>(bit_depth));
+    ihdr.push_back(static_cast<char>(color_type));
+    ihdr.push_back(0);  // deflate
+    ihdr.push_back(0);  // adaptive filtering
+    ihdr.push_back(0);  // not interlaced
+    std::string const* pieces[] = { &ihdr };
+    write_png_chunk(out, "IHDR", pieces, 1);
+}
+
+void save_to_png_strips(mapnik::image_data_32 const& image,
+                        std::ostream & out,
+                        unsigned threads,
+                        int level)
+{
+    unsigned width = image.width();
+    unsigned height = image.height();
+    if (width == 0 || height == 0)
+    {
+        throw std::runtime_error("png strip encoder: image has no pixels");
+    }
+
+    threads = std::min(threads, std::min(cpu_count(), max_strip_threads));
+    unsigned num_strips = std::max(1u, std::min(threads, height / min_strip_rows));
+    std::vector<strip_job> jobs(num_strips);
+    unsigned rows_per_strip = (height + num_strips - 1) / num_strips;
+    for (unsigned i = 0; i < num_strips; ++i)
+    {
+        strip_job & job = jobs[i];
+        job.image = &image;
+        job.y0 = std::min(height, i * rows_per_strip);
+        job.y1 = std::min(height, job.y0 + rows_per_strip);
+        job.level = level;
+        job.last = (i + 1 == num_strips);
+    }
+    // rounding up can leave trailing strips empty
+    while (jobs.size() > 1 && jobs.back().y0 == jobs.back().y1)
+    {
+        jobs.pop_back();
+        jobs.back().last = true;
+    }
+
+    // the calling thread takes the first strip
+    std::vector<uv_thread_t> workers(jobs.size());
+    std::vector<bool> started(jobs.size(), false);
+    for (std::size_t i = 1; i < jobs.size(); ++i)
+    {
+        started[i] = uv_thread_create(&workers[i], run_strip, &jobs[i]) == 0;
+    }
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (i == 0 || !started[i]) run_strip(&jobs[i]);
+    }
+    for (std::size_t i = 1; i < jobs.size(); ++i)
+    {
+        if (started[i]) uv_thread_join(&workers[i]);
+    }
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (!jobs[i].error.empty()) throw std::runtime_error(jobs[i].error);
+    }
+
+    write_png_header(out, width, height, 8, 6);
+
+    // zlib header with FLEVEL matching the compression level
+    std::string zlib_header("\x78", 1);
+    if (level == 0 || level == 1) zlib_header.push_back('\x01');
+    else if (level >= 2 && level <= 5) zlib_header.push_back('\x5e');
+    else if (level == -1 || level == 6) zlib_header.push_back('\x9c');
+    else zlib_header.push_back('\xda');
+
+    uLong adler = jobs[0].adler;
+    for (std::size_t i = 1; i < jobs.size(); ++i)
+    {
+        adler = adler32_combine(adler, jobs[i].adler, static_cast<z_off_t>(jobs[i].length));
+    }
+    std::string zlib_trailer;
+    put_uint32(zlib_trailer, adler);
+
+    // one IDAT per strip, the first carries the zlib header and the last
+    // the adler32 of the whole stream
+    std::string const empty;
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        std::string const* pieces[] = { i == 0 ? &zlib_header : &empty,
+                                        &jobs[i].deflated,
+                                        i + 1 == jobs.size() ? &zlib_trailer : &empty };
+        write_png_chunk(out, "IDAT", pieces, 3);
+    }
+
+    std::string const* iend_pieces[] = { &empty };
+    write_png_chunk(out, "IEND", iend_pieces, 1);
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef __NODE_MAPNIK_PNG_STRIP_ENCODER_H__
+#define __NODE_MAPNIK_PNG_STRIP_ENCODER_H__
+
+// mapnik
+#include <mapnik/image_data.hpp>        // for image_data_32
+#include <mapnik/version.hpp>           // for MAPNIK_VERSION
+
+// stl
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace node_mapnik {
+
+// Writes the pixels as a 32 bit rgba png using up to `threads` threads,
+// no more than the number of cpus.
+// The rows are split into horizontal strips that are filtered and
+// deflated concurrently (like pigz): each strip is primed with the end of
+// the previous one as its dictionary and ends on a sync flush, so the
+// pieces join into one valid zlib stream spread over the IDAT chunks.
+// `level` is a zlib compression level, -1 for the zlib default.
+void save_to_png_strips(mapnik::image_data_32 const& image,
+                        std::ostream & out,
+                        unsigned threads,
+                        int level = -1);
+
+// Applies the five png filters to a row with `bpp` bytes per pixel (1
+// for bit depths below 8) and writes the filter type byte followed by the
+// filtered row to `out`. `prev` is null for the first row of the image.
+void filter_row(unsigned char const* prev,
+                unsigned char const* row,
+                std::size_t row_bytes,
+                unsigned bpp,
+                std::vector<unsigned char> & scratch,
+                unsigned char * out);
+
+// writes the png signature and IHDR chunk
+void write_png_header(std::ostream & out,
+                      unsigned width,
+                      unsigned height,
+                      unsigned bit_depth,
+                      unsigned color_type);
+
+// writes one png chunk whose data is the concatenation of the pieces
+void write_png_chunk(std::ostream & out,
+                     char const* type,
+                     std::string const* pieces[],
+                     unsigned num_pieces);
+
+// whether mapnik writes this format as plain 32 bit rgba png, the only
+// output the strip encoder reproduces
+inline bool png_strips_support(std::string const& format)
+{
+#if MAPNIK_VERSION >= 200300
+    return format == "png32";
+#else
+    return format == "png" || format == "png32";
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef __NODE_MAPNIK_RENDER_CONTEXT_H__
+#define __NODE_MAPNIK_RENDER_CONTEXT_H__
+
+#include <uv.h>
+
+// mapnik
+#include <mapnik/graphics.hpp>          // for image_32
+#include <mapnik/projection.hpp>        // for projection
+
+// boost
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace node_mapnik {
+
+// State that survives between renders. A slot is only ever used by one
+// worker at a time so nothing in it needs to be threadsafe.
+struct render_slot
+{
+    std::string srs;
+    boost::shared_ptr<mapnik::projection> proj;
+    boost::shared_ptr<mapnik::image_32> image;
+};
+
+typedef boost::shared_ptr<render_slot> render_slot_ptr;
+
+// Pool of render slots kept on a Map. Concurrent renders each take their
+// own slot, so the pool grows to the number of threadpool workers that
+// have rendered with the map.
+class render_context : private boost::noncopyable
+{
+public:
+    render_context()
+    {
+        uv_mutex_init(&mutex_);
+    }
+
+    ~render_context()
+    {
+        uv_mutex_destroy(&mutex_);
+    }
+
+    render_slot_ptr acquire()
+    {
+        uv_mutex_lock(&mutex_);
+        render_slot_ptr slot;
+        if (slots_.empty())
+        {
+            slot = boost::make_shared<render_slot>();
+        }
+        else
+        {
+            slot = slots_.back();
+            slots_.pop_back();
+        }
+        uv_mutex_unlock(&mutex_);
+        return slot;
+    }
+
+    void release(render_slot_ptr const& slot)
+    {
+        uv_mutex_lock(&mutex_);
+        slots_.push_back(slot);
+        uv_mutex_unlock(&mutex_);
+    }
+
+private:
+    uv_mutex_t mutex_;
+    std::vector<render_slot_ptr> slots_;
+};
+
+typedef boost::shared_ptr<render_context> render_context_ptr;
+
+// Scoped access to the per render state: borrows a slot from the context
+// when one is given and otherwise falls back to fresh objects that only
+// live as long as this guard.
+class render_scratch : private boost::noncopyable
+{
+public:
+    explicit render_scratch(render_context_ptr const& context) :
+        context_(context),
+        slot_(context ? context->acquire() : boost::make_shared<render_slot>()) {}
+
+    ~render_scratch()
+    {
+        if (context_)
+        {
+            context_->release(slot_);
+        }
+    }
+
+    mapnik::projection const& projection(std::string const& srs)
+    {
+        if (!slot_->proj || slot_->srs != srs)
+        {
+            slot_->proj = boost::make_shared<mapnik::projection>(srs,true);
+            slot_->srs = srs;
+        }
+        return *slot_->proj;
+    }
+
+    // returns a blank image of the requested size, reusing the pixel
+    // buffer from the previous render when the size matches
+    mapnik::image_32 & image(unsigned width, unsigned height)
+    {
+        boost::shared_ptr<mapnik::image_32> & im = slot_->image;
+        if (!im || im->width() != width || im->height() != height)
+        {
+            im = boost::make_shared<mapnik::image_32>(width,height);
+        }
+        else
+        {
+            std::memset(im->data().getBytes(), 0, width * height * 4);
+            im->painted(false);
+        }
+        return *im;
+    }
+
+private:
+    render_context_ptr context_;
+    render_slot_ptr slot_;
+};
+
+}
+
+#endif
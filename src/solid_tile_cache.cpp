@@ -0,0 +1,118 @@
+#include "solid_tile_cache.hpp"
+
+// stl
+#include <sstream>
+
+namespace node_mapnik {
+
+std::size_t const solid_tile_cache::max_entry_bytes;
+std::size_t const solid_tile_cache::max_entries;
+
+solid_tile_cache & solid_tile_cache::instance()
+{
+    // constructed on the first call, which the module init makes so that
+    // encodes on worker threads never race to create it
+    static solid_tile_cache cache;
+    return cache;
+}
+
+solid_tile_cache::solid_tile_cache() :
+    entries_(),
+    used_(),
+    bytes_(0),
+    hits_(0),
+    misses_(0),
+    evicted_(0)
+{
+    uv_mutex_init(&mutex_);
+}
+
+solid_tile_cache::~solid_tile_cache()
+{
+    uv_mutex_destroy(&mutex_);
+}
+
+bool solid_tile_cache::find(std::string const& key, std::ostream & out)
+{
+    std::string bytes;
+    uv_mutex_lock(&mutex_);
+    boost::unordered_map<std::string, entry>::iterator itr = entries_.find(key);
+    if (itr == entries_.end())
+    {
+        ++misses_;
+        uv_mutex_unlock(&mutex_);
+        return false;
+    }
+    ++hits_;
+    used_.splice(used_.begin(), used_, itr->second.used);
+    bytes = itr->second.bytes;
+    uv_mutex_unlock(&mutex_);
+    // the stream can throw, so write outside the lock
+    out.write(bytes.data(), bytes.size());
+    return true;
+}
+
+void solid_tile_cache::insert(std::string const& key, char const* data, std::size_t size)
+{
+    if (size > max_entry_bytes) return;
+    uv_mutex_lock(&mutex_);
+    if (entries_.find(key) == entries_.end())
+    {
+        while (entries_.size() >= max_entries)
+        {
+            boost::unordered_map<std::string, entry>::iterator oldest = entries_.find(used_.back());
+            bytes_ -= oldest->second.bytes.size();
+            entries_.erase(oldest);
+            used_.pop_back();
+            ++evicted_;
+        }
+        used_.push_front(key);
+        entry & e = entries_[key];
+        e.bytes.assign(data, size);
+        e.used = used_.begin();
+        bytes_ += size;
+    }
+    uv_mutex_unlock(&mutex_);
+}
+
+void solid_tile_cache::clear()
+{
+    uv_mutex_lock(&mutex_);
+    entries_.clear();
+    used_.clear();
+    bytes_ = 0;
+    uv_mutex_unlock(&mutex_);
+}
+
+solid_tile_cache_stats solid_tile_cache::stats()
+{
+    solid_tile_cache_stats s;
+    uv_mutex_lock(&mutex_);
+    s.hits = hits_;
+    s.misses = misses_;
+    s.evicted = evicted_;
+    s.entries = entries_.size();
+    s.bytes = bytes_;
+    s.max_entries = max_entries;
+    uv_mutex_unlock(&mutex_);
+    return s;
+}
+
+std::string solid_tile_key(unsigned width,
+                           unsigned height,
+                           unsigned pixel,
+                           std::string const& format,
+                           palette_lookup const* lookup)
+{
+    std::ostringstream key;
+    key << format << ':' << width << 'x' << height << ':' << std::hex << pixel << ':';
+    if (lookup && lookup->size() > 0)
+    {
+        // by content, a palette object can be freed and its address reused
+        std::vector<unsigned char> const& colors = lookup->colors();
+        key.write(reinterpret_cast<char const*>(&colors[0]), colors.size());
+    }
+    return key.str();
+}
+
+}
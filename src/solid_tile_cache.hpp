@@ -0,0 +1,99 @@
+#ifndef __NODE_MAPNIK_SOLID_TILE_CACHE_H__
+#define __NODE_MAPNIK_SOLID_TILE_CACHE_H__
+
+#include <uv.h>
+
+#include "pixel_kernels.hpp"
+#include "palette_lookup.hpp"
+
+// boost
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+
+// stl
+#include <cstddef>
+#include <list>
+#include <ostream>
+#include <string>
+
+namespace node_mapnik {
+
+struct solid_tile_cache_stats
+{
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t evicted;
+    std::size_t entries;
+    std::size_t bytes;
+    std::size_t max_entries;
+};
+
+// Process wide cache of encoded bytes for images whose pixels all have
+// the same value, keyed by size, pixel, format and palette. Used from the
+// encoders on any thread; the least recently used entry is evicted once
+// max_entries are held.
+class solid_tile_cache : private boost::noncopyable
+{
+public:
+    static solid_tile_cache & instance();
+
+    // writes the cached bytes for key to out, false on a miss
+    bool find(std::string const& key, std::ostream & out);
+    void insert(std::string const& key, char const* data, std::size_t size);
+    void clear();
+    solid_tile_cache_stats stats();
+
+    // outputs larger than this are not kept
+    static std::size_t const max_entry_bytes = 65536;
+    static std::size_t const max_entries = 256;
+
+private:
+    solid_tile_cache();
+    ~solid_tile_cache();
+
+    struct entry
+    {
+        std::string bytes;
+        std::list<std::string>::iterator used;
+    };
+
+    boost::unordered_map<std::string, entry> entries_;
+    // most recently used key first
+    std::list<std::string> used_;
+    std::size_t bytes_;
+    std::size_t hits_;
+    std::size_t misses_;
+    std::size_t evicted_;
+    uv_mutex_t mutex_;
+};
+
+std::string solid_tile_key(unsigned width,
+                           unsigned height,
+                           unsigned pixel,
+                           std::string const& format,
+                           palette_lookup const* lookup);
+
+// Fills key and returns true when every pixel of the image is the same,
+// leaving key empty otherwise.
+template <typename T>
+bool solid_tile_key(T const& image,
+                    std::string const& format,
+                    palette_lookup const* lookup,
+                    std::string & key)
+{
+    key.clear();
+    unsigned width = image.width();
+    unsigned height = image.height();
+    if (width == 0 || height == 0) return false;
+    unsigned const pixel = image.getRow(0)[0];
+    for (unsigned y = 0; y < height; ++y)
+    {
+        if (!is_solid_row(image.getRow(y), width, pixel)) return false;
+    }
+    key = solid_tile_key(width, height, pixel, format, lookup);
+    return true;
+}
+
+}
+
+#endif
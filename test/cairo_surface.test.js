@@ -23,4 +23,22 @@ describe('mapnik.CairoSurface ', function() {
         assert.equal(im.getData(), '');
     });
 
+    it('should return a separate Buffer from each getData call', function(done) {
+        if (!mapnik.supports.cairo) return done();
+        var vtile = new mapnik.VectorTile(0, 0, 0);
+        vtile.setData(fs.readFileSync('./test/data/vector_tile/tile0.vector.pbf'));
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.extent = [-20037508.34, -20037508.34, 20037508.34, 20037508.34];
+        vtile.render(map, new mapnik.CairoSurface('svg', 256, 256), {renderer: 'svg'}, function(err, surface) {
+            if (err) throw err;
+            var first = surface.getData();
+            var expected = first.toString('hex');
+            assert.ok(first.length > 0);
+            first.fill(0);
+            assert.equal(surface.getData().toString('hex'), expected);
+            done();
+        });
+    });
+
 });
@@ -50,3 +50,182 @@ describe('mapnik.compositeOp async multiply', function() {
         })(name);
     }
 });
+
+describe('mapnik.Image premultiplied state when compositing', function() {
+    it('should premultiply inputs automatically', function(done) {
+        var manual_dst = mapnik.Image.open('test/support/b.png');
+        var manual_src = mapnik.Image.open('test/support/a.png');
+        manual_dst.premultiplySync();
+        manual_src.premultiplySync();
+        manual_dst.composite(manual_src, {comp_op:mapnik.compositeOp.multiply}, function(err, manual) {
+            if (err) throw err;
+            manual.demultiplySync();
+            var dst = mapnik.Image.open('test/support/b.png');
+            var src = mapnik.Image.open('test/support/a.png');
+            dst.composite(src, {comp_op:mapnik.compositeOp.multiply}, function(err, auto) {
+                if (err) throw err;
+                assert.equal(auto.premultiplied, true);
+                // the source is premultiplied into scratch, never in place
+                assert.equal(src.premultiplied, false);
+                assert.equal(src.encodeSync('png').toString('hex'), mapnik.Image.open('test/support/a.png').encodeSync('png').toString('hex'));
+                // encode demultiplies on the way out
+                assert.equal(auto.encodeSync('png').toString('hex'), manual.encodeSync('png').toString('hex'));
+                done();
+            });
+        });
+    });
+
+    it('should composite one premultiplied source onto several images at once', function(done) {
+        var src = mapnik.Image.open('test/support/a.png');
+        src.premultiplySync();
+        var before = src.encodeSync('png').toString('hex');
+        var remaining = 4;
+        for (var i = 0; i < 4; ++i) {
+            mapnik.Image.open('test/support/b.png').composite(src, function(err, out) {
+                if (err) throw err;
+                assert.equal(out.premultiplied, true);
+                if (--remaining === 0) {
+                    assert.equal(src.premultiplied, true);
+                    assert.equal(src.encodeSync('png').toString('hex'), before);
+                    done();
+                }
+            });
+        }
+    });
+});
+
+describe('mapnik.Image composite fast paths', function() {
+    // agg comp_op_rgba_* formulas on premultiplied rgba8
+    var blenders = {
+        src_over: function(s, d) {
+            var s1a = 255 - s[3];
+            return [0, 1, 2].map(function(c) {
+                return (s[c] + ((d[c] * s1a + 255) >> 8)) & 255;
+            }).concat([(s[3] + d[3] - ((s[3] * d[3] + 255) >> 8)) & 255]);
+        },
+        multiply: function(s, d) {
+            if (!s[3]) return d;
+            var s1a = 255 - s[3];
+            var d1a = 255 - d[3];
+            return [0, 1, 2].map(function(c) {
+                return ((s[c] * d[c] + s[c] * d1a + d[c] * s1a + 255) >> 8) & 255;
+            }).concat([(s[3] + d[3] - ((s[3] * d[3] + 255) >> 8)) & 255]);
+        },
+        screen: function(s, d) {
+            if (!s[3]) return d;
+            return [0, 1, 2, 3].map(function(c) {
+                return (s[c] + d[c] - ((s[c] * d[c] + 255) >> 8)) & 255;
+            });
+        }
+    };
+
+    // rows 0 and 1 are fully transparent and fully opaque to hit the row
+    // shortcuts, the rest is a premultiplied gradient
+    function sourcePixel(x, y) {
+        if (y === 0) return [0, 0, 0, 0];
+        if (y === 1) return [(x * 20) & 255, 100, 50, 255];
+        var a = (x * 37 + y * 11) & 255;
+        return [Math.floor(a * x / 15), Math.floor(a * y / 15), Math.floor(a / 2), a];
+    }
+
+    function destPixel(x, y) {
+        var a = (x * 13 + y * 29 + 40) & 255;
+        return [Math.floor(a * (15 - x) / 15), Math.floor(a / 3), Math.floor(a * y / 15), a];
+    }
+
+    function fill(fn) {
+        var im = new mapnik.Image(16, 16);
+        for (var y = 0; y < 16; ++y) {
+            for (var x = 0; x < 16; ++x) {
+                var p = fn(x, y);
+                im.setPixel(x, y, new mapnik.Color(p[0], p[1], p[2], p[3]));
+            }
+        }
+        im.premultiplied = true;
+        return im;
+    }
+
+    ['src_over', 'multiply', 'screen'].forEach(function(name) {
+        [[1.0, 0, 0], [0.5, 3, -2]].forEach(function(params) {
+            var opacity = params[0], dx = params[1], dy = params[2];
+            it('should match agg for ' + name + ' at opacity ' + opacity + ' offset ' + dx + ',' + dy, function(done) {
+                var dst = fill(destPixel);
+                var src = fill(sourcePixel);
+                var options = {comp_op: mapnik.compositeOp[name], opacity: opacity, dx: dx, dy: dy};
+                dst.composite(src, options, function(err, out) {
+                    if (err) throw err;
+                    var cover = Math.floor(255 * opacity);
+                    for (var y = 0; y < 16; ++y) {
+                        for (var x = 0; x < 16; ++x) {
+                            var d = destPixel(x, y);
+                            var sx = x - dx, sy = y - dy;
+                            var expected = d;
+                            if (sx >= 0 && sx < 16 && sy >= 0 && sy < 16) {
+                                var s = sourcePixel(sx, sy);
+                                if (cover < 255) {
+                                    s = s.map(function(v) { return (v * cover + 255) >> 8; });
+                                }
+                                expected = blenders[name](s, d);
+                            }
+                            var p = out.getPixel(x, y);
+                            assert.deepEqual([p.r, p.g, p.b, p.a], expected, 'pixel ' + x + ',' + y);
+                        }
+                    }
+                    done();
+                });
+            });
+        });
+    });
+});
+
+describe('mapnik.Image compositeMany', function() {
+    var stack = [
+        {comp_op: mapnik.compositeOp.multiply},
+        {comp_op: mapnik.compositeOp.src_over, opacity: 0.5, dx: 20, dy: -10},
+        {comp_op: mapnik.compositeOp.darken, dx: -5},
+        {comp_op: mapnik.compositeOp.screen, opacity: 0.8}
+    ];
+
+    function sequential(dst, sources, i, callback) {
+        if (i === stack.length) return callback(null, dst);
+        var options = stack[i];
+        dst.composite(sources[i], options, function(err) {
+            if (err) return callback(err);
+            sequential(dst, sources, i + 1, callback);
+        });
+    }
+
+    function sources() {
+        return stack.map(function(options, i) {
+            return mapnik.Image.open(i % 2 ? './test/support/a.png' : './test/support/b.png');
+        });
+    }
+
+    it('should match compositing each layer in turn', function(done) {
+        var expected_dst = mapnik.Image.open('./test/support/a.png');
+        sequential(expected_dst, sources(), 0, function(err, expected) {
+            if (err) throw err;
+            var dst = mapnik.Image.open('./test/support/a.png');
+            var layers = sources().map(function(im, i) {
+                var layer = {image: im};
+                for (var key in stack[i]) layer[key] = stack[i][key];
+                return layer;
+            });
+            dst.compositeMany(layers, function(err, out) {
+                if (err) throw err;
+                assert.equal(out, dst);
+                assert.equal(out.encodeSync('png').toString('hex'), expected.encodeSync('png').toString('hex'));
+                done();
+            });
+        });
+    });
+
+    it('should validate its arguments', function() {
+        var dst = new mapnik.Image(4, 4);
+        assert.throws(function() { dst.compositeMany(function() {}); });
+        assert.throws(function() { dst.compositeMany([{}], function() {}); });
+        assert.throws(function() { dst.compositeMany([{image: {}}], function() {}); });
+        assert.throws(function() { dst.compositeMany([{image: new mapnik.Image(4, 4), comp_op: 'multiply'}], function() {}); });
+        assert.throws(function() { dst.compositeMany([{image: new mapnik.Image(4, 4)}]); });
+    });
+});
@@ -70,6 +70,47 @@ describe('mapnik.Image ', function() {
         assert.equal(im.encodeSync().length, im2.encodeSync().length);
     });
 
+    it('should probe images without decoding them', function() {
+        var info = mapnik.Image.probe('./test/support/a.png');
+        assert.deepEqual(info, {format: 'png', width: 256, height: 256, alpha: true});
+        var im = new mapnik.Image(60, 30);
+        im.background = new mapnik.Color('green');
+        assert.deepEqual(mapnik.Image.probe(im.encodeSync('jpeg')),
+                         {format: 'jpeg', width: 60, height: 30, alpha: false});
+        assert.deepEqual(mapnik.Image.probe(im.encodeSync('png')),
+                         {format: 'png', width: 60, height: 30, alpha: true});
+        im.background = new mapnik.Color(0, 0, 0, 0);
+        assert.equal(mapnik.Image.probe(im.encodeSync('png8')).alpha, true);
+        assert.throws(function() { mapnik.Image.probe(); });
+        assert.throws(function() { mapnik.Image.probe(new Buffer('not an image')); });
+        assert.throws(function() { mapnik.Image.probe('./test/support/does-not-exist.png'); });
+    });
+
+    it('should decode a window of an image', function(done) {
+        var full = mapnik.Image.openSync('./test/support/a.png');
+        var window = mapnik.Image.openSync('./test/support/a.png', {window: [64, 96, 32, 16]});
+        assert.equal(window.width(), 32);
+        assert.equal(window.height(), 16);
+        var expected = full.getPixel(64 + 31, 96 + 15);
+        var actual = window.getPixel(31, 15);
+        assert.deepEqual([actual.r, actual.g, actual.b, actual.a], [expected.r, expected.g, expected.b, expected.a]);
+        assert.throws(function() { mapnik.Image.openSync('./test/support/a.png', {window: [250, 0, 10, 10]}); });
+        assert.throws(function() { mapnik.Image.openSync('./test/support/a.png', {window: [0, 0, 0, 10]}); });
+        assert.throws(function() { mapnik.Image.openSync('./test/support/a.png', {window: [0, 0, 10]}); });
+        assert.throws(function() { mapnik.Image.openSync('./test/support/a.png', {mmap: 'yes'}); });
+        assert.throws(function() { mapnik.Image.openSync('./test/support/a.png', 4); });
+        var bytes = mapnik.Image.fromBytesSync(full.encodeSync('png'), {window: [64, 96, 32, 16]});
+        assert.equal(bytes.encodeSync('png').length, window.encodeSync('png').length);
+        mapnik.Image.open('./test/support/a.png', {mmap: true, window: [0, 0, 128, 128]}, function(err, im) {
+            if (err) throw err;
+            assert.equal(im.width(), 128);
+            assert.equal(im.height(), 128);
+            var mapped = mapnik.Image.openSync('./test/support/a.png', {mmap: true});
+            assert.equal(mapped.encodeSync('png').length, full.encodeSync('png').length);
+            done();
+        });
+    });
+
     it('should be able to open via byte stream', function(done) {
         var im = new mapnik.Image(256, 256);
         // png
@@ -206,6 +247,197 @@ describe('mapnik.Image ', function() {
         assert.equal(pixel3.a, 255);
     });
 
+    it('should set the alpha channel from gray asynchronously', function(done) {
+        var im = new mapnik.Image(64, 64);
+        im.background = new mapnik.Color(100, 150, 200, 255);
+        assert.throws(function() { im.setGrayScaleToAlpha('red', function() {}); });
+        im.setGrayScaleToAlpha(new mapnik.Color('green'), function(err, result) {
+            if (err) throw err;
+            assert.equal(result, im);
+            assert.equal(im.premultiplied, false);
+            var p = im.getPixel(63, 63);
+            assert.deepEqual([p.r, p.g, p.b, p.a], [0, 128, 0, 140]);
+            done();
+        });
+    });
+
+    it('should take gray levels from straight colors of premultiplied images', function(done) {
+        var im = new mapnik.Image(4, 4);
+        im.background = new mapnik.Color(200, 200, 200, 128);
+        im.premultiplySync();
+        im.setGrayScaleToAlpha();
+        assert.equal(im.premultiplied, false);
+        assert.ok(im.getPixel(0, 0).a > 190);
+        var async_im = new mapnik.Image(4, 4);
+        async_im.background = new mapnik.Color(200, 200, 200, 128);
+        async_im.premultiplySync();
+        async_im.setGrayScaleToAlpha(function(err, result) {
+            if (err) throw err;
+            assert.equal(async_im.premultiplied, false);
+            assert.equal(async_im.getPixel(0, 0).a, im.getPixel(0, 0).a);
+            var view_im = new mapnik.Image(4, 4);
+            view_im.background = new mapnik.Color(200, 200, 200, 128);
+            view_im.premultiplySync();
+            view_im.view(0, 0, 2, 2).setGrayScaleToAlpha(function(err, view) {
+                if (err) throw err;
+                assert.equal(view_im.premultiplied, false);
+                assert.equal(view_im.getPixel(0, 0).a, im.getPixel(0, 0).a);
+                // outside the view the image was demultiplied too
+                var p = view_im.getPixel(3, 3);
+                assert.ok(Math.abs(p.r - 200) <= 1);
+                assert.equal(p.a, 128);
+                done();
+            });
+        });
+    });
+
+    it('should set the alpha channel from gray in a view', function(done) {
+        var im = new mapnik.Image(16, 16);
+        im.background = new mapnik.Color('black');
+        var view = im.view(4, 4, 8, 8);
+        view.setGrayScaleToAlpha();
+        var inside = im.getPixel(4, 4);
+        assert.deepEqual([inside.r, inside.g, inside.b, inside.a], [255, 255, 255, 0]);
+        var outside = im.getPixel(3, 4);
+        assert.deepEqual([outside.r, outside.g, outside.b, outside.a], [0, 0, 0, 255]);
+        im.background = new mapnik.Color('white');
+        view.setGrayScaleToAlpha(new mapnik.Color('blue'), function(err, result) {
+            if (err) throw err;
+            assert.equal(result, view);
+            var p = view.getPixel(7, 7);
+            assert.deepEqual([p.r, p.g, p.b, p.a], [0, 0, 255, 255]);
+            var q = im.getPixel(12, 12);
+            assert.deepEqual([q.r, q.g, q.b, q.a], [255, 255, 255, 255]);
+            done();
+        });
+    });
+
+    it('should compare images', function(done) {
+        var a = new mapnik.Image(64, 32);
+        a.background = new mapnik.Color(100, 100, 100, 255);
+        var b = new mapnik.Image(64, 32);
+        b.background = new mapnik.Color(100, 100, 100, 255);
+        assert.throws(function() { a.compare(new mapnik.Image(32, 32), function() {}); });
+        assert.throws(function() { a.compare(b); });
+        assert.throws(function() { a.compare(b, {threshold: -1}, function() {}); });
+        b.setPixel(3, 4, new mapnik.Color(110, 100, 100, 255));
+        b.setPixel(60, 30, new mapnik.Color(100, 140, 100, 255));
+        b.setPixel(10, 10, new mapnik.Color(100, 100, 100, 0));
+        a.compare(b, function(err, result) {
+            if (err) throw err;
+            assert.equal(result.different, 2);
+            assert.equal(result.max_delta, 255);
+            assert.equal(result.diff, undefined);
+            a.compare(b, {threshold: 0, alpha: false, diff: true}, function(err, result) {
+                if (err) throw err;
+                assert.equal(result.different, 2);
+                assert.equal(result.max_delta, 40);
+                var diff = result.diff;
+                assert.equal(diff.width(), 64);
+                var p = diff.getPixel(3, 4);
+                assert.deepEqual([p.r, p.g, p.b, p.a], [255, 0, 0, 255]);
+                assert.equal(diff.getPixel(10, 10).a, 0);
+                // a premultiplied copy compares equal to its straight original
+                var c = new mapnik.Image(8, 8);
+                c.background = new mapnik.Color(200, 100, 50, 128);
+                var d = new mapnik.Image(8, 8);
+                d.background = new mapnik.Color(200, 100, 50, 128);
+                d.premultiplySync();
+                c.compare(d, {threshold: 2}, function(err, result) {
+                    if (err) throw err;
+                    assert.equal(result.different, 0);
+                    assert.equal(d.premultiplied, true);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should report image statistics', function(done) {
+        var im = new mapnik.Image(16, 8);
+        im.background = new mapnik.Color(10, 20, 30, 255);
+        im.setPixel(0, 0, new mapnik.Color(0, 0, 0, 0));
+        im.setPixel(15, 7, new mapnik.Color(250, 20, 30, 128));
+        assert.throws(function() { im.stats(); });
+        assert.throws(function() { im.stats({max_colors: -1}, function() {}); });
+        assert.throws(function() { im.stats({max_colors: 65537}, function() {}); });
+        im.stats(function(err, stats) {
+            if (err) throw err;
+            assert.equal(stats.pixels, 128);
+            assert.equal(stats.transparent, 1);
+            assert.equal(stats.opaque, 126);
+            assert.equal(stats.colors, 3);
+            assert.equal(stats.colors_capped, false);
+            assert.equal(stats.r.min, 0);
+            assert.equal(stats.r.max, 250);
+            assert.equal(stats.g.histogram[20], 127);
+            assert.ok(stats.a.histogram instanceof Uint32Array);
+            assert.equal(stats.b.mean, 30 * 127 / 128);
+            im.stats({max_colors: 2}, function(err, capped) {
+                if (err) throw err;
+                assert.equal(capped.colors, 2);
+                assert.equal(capped.colors_capped, true);
+                im.view(1, 1, 4, 4).stats(function(err, view_stats) {
+                    if (err) throw err;
+                    assert.equal(view_stats.pixels, 16);
+                    assert.equal(view_stats.opaque, 16);
+                    assert.equal(view_stats.colors, 1);
+                    assert.deepEqual([view_stats.r.min, view_stats.r.max, view_stats.r.mean], [10, 10, 10]);
+                    // premultiplied images report their straight colors and stay premultiplied
+                    var pm = new mapnik.Image(8, 8);
+                    pm.background = new mapnik.Color(200, 100, 50, 128);
+                    pm.premultiplySync();
+                    pm.stats(function(err, pm_stats) {
+                        if (err) throw err;
+                        assert.ok(Math.abs(pm_stats.r.max - 200) <= 1);
+                        assert.equal(pm_stats.a.max, 128);
+                        assert.equal(pm.premultiplied, true);
+                        pm.view(0, 0, 4, 4).stats(function(err, pm_view_stats) {
+                            if (err) throw err;
+                            assert.ok(Math.abs(pm_view_stats.g.max - 100) <= 1);
+                            done();
+                        });
+                    });
+                });
+            });
+        });
+    });
+
+    it('should read and write pixels in bulk', function() {
+        var im = new mapnik.Image(8, 4);
+        im.background = new mapnik.Color(255, 0, 0, 255);
+        assert.throws(function() { im.getPixels([0, 0]); });
+        assert.throws(function() { im.getPixels(new Int32Array(3)); });
+        var pixels = im.getPixels(new Int32Array([0, 0, 7, 3, 8, 0, -1, 2]));
+        assert.ok(pixels instanceof Uint32Array);
+        assert.deepEqual(Array.prototype.slice.call(pixels), [0xff0000ff, 0xff0000ff, 0, 0]);
+
+        im.setPixels(new Int32Array([1, 1, 2, 2]), new Uint32Array([0xff00ff00, 0x80000080]));
+        var p = im.getPixel(1, 1);
+        assert.deepEqual([p.r, p.g, p.b, p.a], [0, 255, 0, 255]);
+        assert.throws(function() { im.setPixels(new Int32Array([1, 1, 8, 0]), new Uint32Array([0, 0])); });
+        assert.equal(im.getPixel(1, 1).g, 255);
+        assert.throws(function() { im.setPixels(new Int32Array([1, 1]), new Uint32Array([0, 0])); });
+
+        var region = im.readPixels(1, 1, 2, 2);
+        assert.deepEqual(Array.prototype.slice.call(region), [0xff00ff00, 0xff0000ff, 0xff0000ff, 0x80000080]);
+        var reused = new Uint32Array(4);
+        assert.equal(im.readPixels(1, 1, 2, 2, reused), reused);
+        assert.equal(reused[3], 0x80000080);
+        assert.throws(function() { im.readPixels(7, 0, 2, 1); });
+        assert.throws(function() { im.readPixels(0, 0, 2, 2, new Uint32Array(3)); });
+
+        im.writePixels(6, 2, 2, 2, new Uint32Array([1, 2, 3, 4]));
+        assert.deepEqual(Array.prototype.slice.call(im.readPixels(6, 3, 2, 1)), [3, 4]);
+        assert.throws(function() { im.writePixels(0, 0, 2, 2, new Uint32Array(2)); });
+
+        var view = im.view(1, 1, 4, 2);
+        assert.deepEqual(Array.prototype.slice.call(view.getPixels(new Int32Array([0, 0, 1, 1, 4, 0]))),
+                         [0xff00ff00, 0x80000080, 0]);
+        assert.deepEqual(Array.prototype.slice.call(view.readPixels(0, 1, 2, 1)), [0xff0000ff, 0x80000080]);
+        assert.throws(function() { view.readPixels(3, 0, 2, 1); });
+    });
+
     it('should support setting an individual pixel', function() {
         var gray = new mapnik.Image(256, 256);
         gray.setPixel(0,0,new mapnik.Color('white'));
@@ -216,4 +448,362 @@ describe('mapnik.Image ', function() {
         assert.equal(pixel.a, 255);
     });
 
+    // every color/alpha combination, x is the color value and y the alpha
+    function multiplyTestImage() {
+        var im = new mapnik.Image(256, 256);
+        for (var a = 0; a < 256; ++a) {
+            for (var c = 0; c < 256; ++c) {
+                im.setPixel(c, a, new mapnik.Color(c, 255 - c, (c * 7) & 255, a));
+            }
+        }
+        return im;
+    }
+
+    function assertMultiplied(im, fn) {
+        for (var a = 0; a < 256; ++a) {
+            for (var c = 0; c < 256; ++c) {
+                var pixel = im.getPixel(c, a);
+                assert.equal(pixel.r, fn(c, a));
+                assert.equal(pixel.g, fn(255 - c, a));
+                assert.equal(pixel.b, fn((c * 7) & 255, a));
+                assert.equal(pixel.a, a);
+            }
+        }
+    }
+
+    // scalar agg formulas the simd kernels must reproduce exactly
+    function premultiplied(c, a) {
+        if (a === 255) return c;
+        return (c * a + 255) >> 8;
+    }
+
+    function demultiplied(c, a) {
+        if (a === 0) return 0;
+        return Math.min(255, Math.floor(c * 255 / a));
+    }
+
+    it('should premultiply exactly like the scalar formula (' + mapnik.supports.simd + ')', function(done) {
+        var im = multiplyTestImage();
+        im.premultiplySync();
+        assertMultiplied(im, premultiplied);
+        multiplyTestImage().premultiply(function(err, im) {
+            if (err) throw err;
+            assertMultiplied(im, premultiplied);
+            done();
+        });
+    });
+
+    it('should demultiply exactly like the scalar formula (' + mapnik.supports.simd + ')', function(done) {
+        var im = multiplyTestImage();
+        im.premultiplied = true;
+        im.demultiplySync();
+        assertMultiplied(im, demultiplied);
+        var im2 = multiplyTestImage();
+        im2.premultiplied = true;
+        im2.demultiply(function(err, im) {
+            if (err) throw err;
+            assertMultiplied(im, demultiplied);
+            done();
+        });
+    });
+
+    it('should track premultiplied state and skip redundant passes', function() {
+        var im = new mapnik.Image(4, 4);
+        assert.equal(im.premultiplied, false);
+        im.setPixel(0, 0, new mapnik.Color(200, 100, 50, 128));
+        im.premultiplySync();
+        assert.equal(im.premultiplied, true);
+        // a second call must not premultiply again
+        im.premultiplySync();
+        assert.equal(im.getPixel(0, 0).r, 100);
+        im.demultiplySync();
+        assert.equal(im.premultiplied, false);
+        im.demultiplySync();
+        assert.equal(im.getPixel(0, 0).r, 199);
+
+        // encoding writes straight alpha from a copy, the image is unchanged
+        im.premultiplySync();
+        var encoded = mapnik.Image.fromBytesSync(im.encodeSync('png'));
+        assert.equal(encoded.getPixel(0, 0).r, 199);
+        assert.equal(im.premultiplied, true);
+        assert.equal(im.getPixel(0, 0).r, 100);
+        encoded = mapnik.Image.fromBytesSync(im.view(0, 0, 4, 4).encodeSync('png'));
+        assert.equal(encoded.getPixel(0, 0).r, 199);
+        assert.equal(im.premultiplied, true);
+        assert.equal(im.getPixel(0, 0).r, 100);
+
+        assert.throws(function() { im.premultiplied = 'yes'; });
+    });
+
+    it('should report solid images', function(done) {
+        var im = new mapnik.Image(256, 256);
+        assert.equal(im.isSolidSync(), true);
+        im.background = new mapnik.Color('white');
+        assert.equal(im.isSolid(), true);
+        im.isSolid(function(err, solid, pixel) {
+            if (err) throw err;
+            assert.equal(solid, true);
+            assert.equal(pixel, 4294967295);
+            done();
+        });
+    });
+
+    it('should detect a single differing pixel anywhere', function() {
+        // odd sizes leave a tail after the vector loop
+        [[1, 1], [7, 3], [256, 256], [33, 17]].forEach(function(size) {
+            var w = size[0], h = size[1];
+            [[0, 0], [w - 1, h - 1], [w >> 1, h >> 1], [(w * h - 1) % w, 0]].forEach(function(pos) {
+                var im = new mapnik.Image(w, h);
+                im.background = new mapnik.Color(10, 20, 30, 40);
+                if (w * h > 1) {
+                    im.setPixel(pos[0], pos[1], new mapnik.Color(10, 20, 30, 41));
+                }
+                assert.equal(im.isSolidSync(), w * h === 1);
+                assert.equal(im.view(0, 0, w, h).isSolidSync(), w * h === 1);
+            });
+        });
+    });
+
+    it('should report a non solid image async', function(done) {
+        var im = new mapnik.Image.open('./test/support/a.png');
+        assert.equal(im.isSolidSync(), false);
+        im.isSolid(function(err, solid, pixel) {
+            if (err) throw err;
+            assert.equal(solid, false);
+            assert.equal(pixel, undefined);
+            done();
+        });
+    });
+
+    it('should encode the same bytes sync, async and from a view', function(done) {
+        // noisy pixels so the output outgrows the initial encode buffer
+        var im = new mapnik.Image(300, 200);
+        var seed = 1;
+        function rand() {
+            seed = (seed * 16807) % 2147483647;
+            return (seed >> 16) & 255;
+        }
+        for (var y = 0; y < 200; ++y) {
+            for (var x = 0; x < 300; ++x) {
+                im.setPixel(x, y, new mapnik.Color(rand(), rand(), rand(), 255));
+            }
+        }
+        var formats = ['png', 'png8', 'jpeg', 'tiff'];
+        var remaining = formats.length;
+        formats.forEach(function(format) {
+            var sync = im.encodeSync(format);
+            assert.ok(sync.length > 16384);
+            assert.equal(im.view(0, 0, 300, 200).encodeSync(format).toString('hex'), sync.toString('hex'));
+            im.encode(format, function(err, async) {
+                if (err) throw err;
+                assert.equal(async.toString('hex'), sync.toString('hex'));
+                var decoded = mapnik.Image.fromBytesSync(async);
+                assert.equal(decoded.width(), 300);
+                assert.equal(decoded.height(), 200);
+                if (--remaining === 0) done();
+            });
+        });
+    });
+
+    it('should create an image from raw rgba bytes', function() {
+        var buf = new Buffer(3 * 2 * 4);
+        for (var i = 0; i < buf.length; ++i) buf[i] = i * 10;
+        var im = mapnik.Image.fromBuffer(buf, 3, 2);
+        assert.equal(im.width(), 3);
+        assert.equal(im.height(), 2);
+        assert.equal(im.premultiplied, false);
+        var p = im.getPixel(1, 1);
+        assert.deepEqual([p.r, p.g, p.b, p.a], [160, 170, 180, 190]);
+        // the image keeps its own copy
+        buf[0] = 255;
+        assert.equal(im.getPixel(0, 0).r, 0);
+        assert.equal(mapnik.Image.fromBuffer(buf, 3, 2, {premultiplied: true}).premultiplied, true);
+
+        assert.throws(function() { mapnik.Image.fromBuffer(buf, 3); });
+        assert.throws(function() { mapnik.Image.fromBuffer({}, 3, 2); });
+        assert.throws(function() { mapnik.Image.fromBuffer(buf, 0, 2); });
+        assert.throws(function() { mapnik.Image.fromBuffer(buf, 2, 2); });
+        assert.throws(function() { mapnik.Image.fromBuffer(buf, 3, 2, {premultiplied: 1}); });
+    });
+
+    it('should expose its pixels through data()', function() {
+        var im = new mapnik.Image(4, 4);
+        im.setPixel(2, 3, new mapnik.Color(1, 2, 3, 4));
+        var data = im.data();
+        assert.equal(data.length, 4 * 4 * 4);
+        var offset = (3 * 4 + 2) * 4;
+        assert.deepEqual([data[offset], data[offset + 1], data[offset + 2], data[offset + 3]], [1, 2, 3, 4]);
+        // writes go straight to the image
+        data[0] = 200;
+        data[3] = 255;
+        var p = im.getPixel(0, 0);
+        assert.equal(p.r, 200);
+        assert.equal(p.a, 255);
+        var copy = mapnik.Image.fromBuffer(data, 4, 4);
+        assert.equal(copy.encodeSync('png').toString('hex'), im.encodeSync('png').toString('hex'));
+    });
+
+    it('should encode png on several threads', function(done) {
+        var im = new mapnik.Image(300, 400);
+        for (var y = 0; y < 400; y += 3) {
+            for (var x = 0; x < 300; x += 2) {
+                im.setPixel(x, y, new mapnik.Color(x & 255, y & 255, (x + y) & 255, (x * y) & 255));
+            }
+        }
+        assert.throws(function() { im.encode('png32', {threads: 0}, function() {}); });
+        im.encode('png32', {threads: 4}, function(err, buffer) {
+            if (err) throw err;
+            var decoded = mapnik.Image.fromBytesSync(buffer);
+            assert.equal(decoded.width(), 300);
+            assert.equal(decoded.height(), 400);
+            assert.equal(decoded.encodeSync('png32').toString('hex'), im.encodeSync('png32').toString('hex'));
+            done();
+        });
+    });
+
+    it('should pick a format for auto encoding', function(done) {
+        var size = 64;
+        var solid = new mapnik.Image(size, size);
+        solid.background = new mapnik.Color('steelblue');
+        var gradient = new Buffer(size * size * 4);
+        var noise = new Buffer(size * size * 4);
+        var seed = 1;
+        for (var i = 0; i < size * size; ++i) {
+            var x = i % size, y = Math.floor(i / size);
+            gradient[i * 4] = x * 4;
+            gradient[i * 4 + 1] = y * 4;
+            gradient[i * 4 + 2] = (x + y) * 2;
+            gradient[i * 4 + 3] = 255;
+            for (var c = 0; c < 3; ++c) {
+                seed = (seed * 16807) % 2147483647;
+                noise[i * 4 + c] = seed & 255;
+            }
+            noise[i * 4 + 3] = 255;
+        }
+        assert.throws(function() {
+            solid.encode('auto', {palette: new mapnik.Palette('\x01\x02\x03', 'rgb')}, function() {});
+        });
+        solid.encode('auto', function(err, buffer, format) {
+            if (err) throw err;
+            assert.equal(format, 'png8');
+            assert.equal(buffer.slice(1, 4).toString(), 'PNG');
+            mapnik.Image.fromBuffer(gradient, size, size).encode('auto', function(err, buffer, format) {
+                if (err) throw err;
+                assert.equal(format, 'png32');
+                assert.equal(buffer.slice(1, 4).toString(), 'PNG');
+                mapnik.Image.fromBuffer(noise, size, size).view(0, 0, size, size).encode('auto', function(err, buffer, format) {
+                    if (err) throw err;
+                    assert.equal(format, 'jpeg');
+                    assert.equal(buffer[0], 0xff);
+                    assert.equal(buffer[1], 0xd8);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should encode several formats in one job', function(done) {
+        var im = new mapnik.Image(64, 64);
+        for (var y = 0; y < 64; ++y) {
+            for (var x = 0; x < 64; ++x) {
+                im.setPixel(x, y, new mapnik.Color(x * 4, y * 4, 128, 255));
+            }
+        }
+        var pal = new mapnik.Palette('\xff\x00\x00\x00\xff\x00\x00\x00\xff', 'rgb');
+        assert.throws(function() { im.encodeMany('png', function() {}); });
+        assert.throws(function() { im.encodeMany([], function() {}); });
+        assert.throws(function() { im.encodeMany([{}], function() {}); });
+        assert.throws(function() { im.encodeMany([{format: 'png', palette: {}}], function() {}); });
+        assert.throws(function() { im.encodeMany([{format: 'png'}]); });
+        im.encodeMany([{format: 'png32'}, {format: 'jpeg'}, {format: 'png8', palette: pal}], function(err, buffers) {
+            if (err) throw err;
+            assert.equal(buffers.length, 3);
+            assert.equal(buffers[0].toString('hex'), im.encodeSync('png32').toString('hex'));
+            assert.equal(buffers[1].toString('hex'), im.encodeSync('jpeg').toString('hex'));
+            assert.equal(buffers[2].toString('hex'), im.encodeSync('png8', {palette: pal}).toString('hex'));
+            im.encodeMany([{format: 'auto'}, {format: 'png'}], function(err, buffers, formats) {
+                if (err) throw err;
+                assert.equal(buffers.length, 2);
+                assert.deepEqual(formats, ['png32', 'png']);
+                im.encodeMany([{format: 'png'}, {format: 'not-a-format'}], function(err) {
+                    assert.ok(err);
+                    // a premultiplied image is encoded from a demultiplied copy
+                    var expected = im.encodeSync('png32');
+                    im.premultiplySync();
+                    im.encodeMany([{format: 'png32'}, {format: 'png32'}], function(err, buffers) {
+                        if (err) throw err;
+                        assert.equal(im.premultiplied, true);
+                        assert.equal(buffers[0].toString('hex'), expected.toString('hex'));
+                        assert.equal(buffers[1].toString('hex'), expected.toString('hex'));
+                        done();
+                    });
+                });
+            });
+        });
+    });
+
+    it('should reuse encoded bytes for solid images', function(done) {
+        mapnik.clearCache();
+        var before = mapnik.solidTileCacheStats();
+        assert.equal(before.entries, 0);
+        var im = new mapnik.Image(256, 256);
+        im.background = new mapnik.Color(12, 34, 56, 255);
+        var first = im.encodeSync('png');
+        var second = im.encodeSync('png');
+        assert.equal(second.toString('hex'), first.toString('hex'));
+        var stats = mapnik.solidTileCacheStats();
+        assert.equal(stats.misses, before.misses + 1);
+        assert.equal(stats.hits, before.hits + 1);
+        assert.equal(stats.entries, 1);
+        assert.equal(stats.bytes, first.length);
+        // images that are not solid skip the cache
+        im.setPixel(0, 0, new mapnik.Color('red'));
+        im.encodeSync('png');
+        assert.equal(mapnik.solidTileCacheStats().misses, stats.misses);
+        // a solid view of the same size and color shares the entry
+        var big = new mapnik.Image(512, 512);
+        big.background = new mapnik.Color(12, 34, 56, 255);
+        big.view(256, 0, 256, 256).encode('png', function(err, buffer) {
+            if (err) throw err;
+            assert.equal(buffer.toString('hex'), first.toString('hex'));
+            assert.equal(mapnik.solidTileCacheStats().hits, stats.hits + 1);
+            done();
+        });
+    });
+
+    it('should resize images', function(done) {
+        var im = new mapnik.Image(64, 32);
+        im.background = new mapnik.Color(200, 100, 50, 255);
+        assert.throws(function() { im.resize(0, 10, function() {}); });
+        assert.throws(function() { im.resize(10, 10); });
+        assert.throws(function() { im.resize(10, 10, {filter: 'nearest'}, function() {}); });
+        assert.throws(function() { im.resize(10, 10, {premultiplied: 1}, function() {}); });
+        im.setPixel(0, 0, new mapnik.Color(200, 100, 50, 128));
+        im.resize(100, 50, {filter: 'lanczos'}, function(err, big) {
+            if (err) throw err;
+            // the source is left in straight alpha, the result is premultiplied
+            assert.equal(im.premultiplied, false);
+            var s = im.getPixel(0, 0);
+            assert.deepEqual([s.r, s.g, s.b, s.a], [200, 100, 50, 128]);
+            assert.equal(big.premultiplied, true);
+            assert.equal(big.width(), 100);
+            assert.equal(big.height(), 50);
+            var p = big.getPixel(99, 49);
+            assert.deepEqual([p.r, p.g, p.b, p.a], [200, 100, 50, 255]);
+            // power of two downscales average blocks of pixels
+            var checker = new mapnik.Image(4, 4);
+            for (var y = 0; y < 4; ++y) {
+                for (var x = 0; x < 4; ++x) {
+                    var v = (x + y) % 2 ? 255 : 0;
+                    checker.setPixel(x, y, new mapnik.Color(v, v, v, 255));
+                }
+            }
+            checker.resize(2, 2, function(err, small) {
+                if (err) throw err;
+                var p = small.getPixel(1, 1);
+                assert.deepEqual([p.r, p.g, p.b, p.a], [128, 128, 128, 255]);
+                done();
+            });
+        });
+    });
 });
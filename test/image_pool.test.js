@@ -0,0 +1,76 @@
+var mapnik = require('../');
+var assert = require('assert');
+
+describe('mapnik.ImagePool ', function() {
+    it('should throw with invalid usage', function() {
+        // no 'new' keyword
+        assert.throws(function() { mapnik.ImagePool(256, 256); });
+
+        // invalid args
+        assert.throws(function() { new mapnik.ImagePool(); });
+        assert.throws(function() { new mapnik.ImagePool(256); });
+        assert.throws(function() { new mapnik.ImagePool(0, 256); });
+        assert.throws(function() { new mapnik.ImagePool(256, 256, {max: 'a'}); });
+        assert.throws(function() { new mapnik.ImagePool(256, 256, {max: 0}); });
+        var pool = new mapnik.ImagePool(4, 4);
+        assert.throws(function() { pool.acquire({clear: 1}); });
+        assert.throws(function() { pool.release({}); });
+        assert.throws(function() { pool.release(new mapnik.Image(2, 2)); });
+    });
+
+    it('should recycle pixel buffers', function() {
+        var pool = new mapnik.ImagePool(4, 4);
+        assert.equal(pool.width(), 4);
+        assert.equal(pool.height(), 4);
+        var im = pool.acquire();
+        assert.ok(im instanceof mapnik.Image);
+        assert.equal(im.width(), 4);
+        assert.equal(im.height(), 4);
+        im.setPixel(0, 0, new mapnik.Color('green'));
+        assert.equal(pool.release(im), true);
+        // the released image no longer owns any pixels
+        assert.equal(im.width(), 0);
+        assert.equal(im.height(), 0);
+
+        var cleared = pool.acquire();
+        assert.equal(cleared.isSolidSync(), true);
+        assert.equal(cleared.getPixel(0, 0).a, 0);
+        cleared.setPixel(0, 0, new mapnik.Color('green'));
+        pool.release(cleared);
+
+        var dirty = pool.acquire({clear: false});
+        assert.equal(dirty.getPixel(0, 0).g, 128);
+
+        assert.deepEqual(pool.stats(), {hits: 2, misses: 1, released: 2, dropped: 0, available: 0, max: 64});
+    });
+
+    it('should not hand out the background of a released image', function() {
+        var pool = new mapnik.ImagePool(4, 4);
+        var im = pool.acquire();
+        im.background = new mapnik.Color('green');
+        assert.equal(pool.release(im), false);
+        assert.equal(pool.stats().dropped, 1);
+        assert.equal(pool.acquire().background, undefined);
+    });
+
+    it('should respect its maximum size', function() {
+        var pool = new mapnik.ImagePool(4, 4, {max: 1});
+        var a = pool.acquire();
+        var b = pool.acquire();
+        assert.equal(pool.release(a), true);
+        assert.equal(pool.release(b), false);
+        assert.equal(b.width(), 4);
+        var stats = pool.stats();
+        assert.equal(stats.available, 1);
+        assert.equal(stats.dropped, 1);
+        assert.equal(stats.misses, 2);
+    });
+
+    it('should not take images that are still in use', function() {
+        var pool = new mapnik.ImagePool(4, 4);
+        var im = pool.acquire();
+        var view = im.view(0, 0, 4, 4);
+        assert.throws(function() { pool.release(im); });
+        assert.equal(view.width(), 4);
+    });
+});
@@ -42,6 +42,16 @@ describe('mapnik.Map', function() {
         //assert.equal(map.maximumExtent,map.extent)
     });
 
+    it('should toggle the render context', function() {
+        var map = new mapnik.Map(256, 256);
+        assert.equal(map.renderContext, false);
+        map.renderContext = true;
+        assert.equal(map.renderContext, true);
+        map.renderContext = false;
+        assert.equal(map.renderContext, false);
+        assert.throws(function() { map.renderContext = 'yes'; });
+    });
+
     it('should load a stylesheet', function() {
         var map = new mapnik.Map(600, 400);
 
@@ -39,6 +39,62 @@ describe('mapnik.Palette ', function() {
         assert.equal('[Palette 256 colors #272727 #3c3c3c #484847 #564b41 #605243 #6a523e #555555 #785941 #5d5d5d #746856 #676767 #956740 #ba712e #787777 #cb752a #c27c3d #b68049 #dc8030 #df9e10 #878685 #e1a214 #928b82 #a88a70 #ea8834 #e7a81d #cb8d55 #909090 #94938c #e18f48 #f68d36 #6f94b7 #e1ab2e #8e959b #c79666 #999897 #ff9238 #ef9447 #a99a88 #f1b32c #919ca6 #a1a09f #f0b04b #8aa4bf #f8bc39 #b3ac8f #d1a67a #e3b857 #a8a8a7 #ffc345 #a2adb9 #afaeab #f9ab69 #afbba4 #c4c48a #b4b2af #dec177 #9ab2cf #a3bebb #d7b491 #b6cd9e #b5d29c #b9c8a2 #f1c969 #c5c79e #bbbab9 #cabdaa #a6bcd1 #cec4a7 #e7cc89 #dad98a #d5c9a3 #fabd8a #c1d7aa #cec5b4 #d1d1a5 #d9cf9f #c5c4c3 #d3c7b5 #ddd59d #b4c6d6 #d1cbb4 #d1c7ba #d7d1aa #e1c6ab #cbc7c2 #dbd0a9 #e8e58a #fee178 #d3cbba #dfd7a3 #d2cfb9 #c9ddb5 #d2cbbe #c3cbce #d7cbba #dcceb2 #dfd3aa #e5dd9a #dbd3b1 #ceccc6 #d7cbbe #d7cfba #dfc3be #dfd3ae #cbcbcb #cbd3c3 #d3cfc0 #e0d8aa #d7cfbe #dbd3b8 #ebe596 #dfd8b0 #c0ceda #f1ee89 #decfbc #d7cfc4 #d7d3c3 #d1d0cd #d2dfc0 #dbd3c3 #e7c7c3 #e7d7b3 #f2ed92 #d1e2bf #dad7c3 #fef383 #d3d3cf #dbd3c7 #e0d3c2 #dfd7c0 #ebe4a8 #dbd7c7 #dfd3c7 #f7f38f #c9d4de #dcdcc5 #dfd7c7 #e7d5c2 #d6d5d4 #faf78e #d7dfca #fbfb8a #fffb86 #dfd7cb #e5ddc0 #dad7d2 #ecd6c1 #cfd7de #e8d0cc #fbfb8e #fffb8a #eae3b8 #e3d7cd #dfdbce #fffb8e #ffff8a #f5efa6 #dae6cc #e3dbcf #edddc3 #dddbd6 #d5dbdf #ffff91 #e3dbd3 #fefc99 #e7dbd2 #eaddcd #e3dfd3 #ebd7d3 #dddddd #d4dee6 #e2dfd7 #fcdcc0 #e7dbd7 #e7dfd3 #ebe4cb #f4eeb8 #e3dfdb #e7dfd7 #ebded5 #e7e3d7 #fefea6 #e1ecd6 #ece5d3 #e7e3db #dee3e5 #ebe3db #efdfdb #efe3d8 #f4efc9 #e6ecdb #ebe3df #ebe7db #f0ecd3 #e5e6e5 #efe7da #ebe7df #efe3df #fefeb8 #dfe7ef #ebe7e3 #edebde #efe7e0 #e8efe0 #e7f3df #ebebe3 #e7ebe8 #f5edd9 #efebe3 #e3ebf1 #e9efe7 #ebebea #efebe7 #f0efe2 #ecf3e5 #fefdc9 #efefe7 #f3efe7 #f5f3e1 #f2efe9 #e9eef4 #ffeddf #efefef #f3efeb #f3f3eb #f0f7eb #fbf7e1 #fefed8 #f3f3ef #f7f3eb #eef3f7 #f7f7ea #f3f3f3 #f3f7ef #f7f3ef #f3f3f7 #f7f3f3 #f7f7ef #fffee3 #f3f7f7 #f7f7f3 #fcf7ee #f7f7f7 #f7fbf4 #f5f7fb #fbf7f6 #fffeef #f7fbfb #fbfbf7 #fbfbfb #fbfbff #fbfffb #fffbfb #fbffff #fffffb #ffffff]', pal.toString());
     });
 
+    it('should encode images to the nearest palette colors', function(done) {
+        var pal = new mapnik.Palette('\xff\x00\x00\x00\xff\x00\x00\x00\xff\xff\xff\xff', 'rgb');
+        var colors = [[255,0,0], [0,255,0], [0,0,255], [255,255,255]];
+        var im = new mapnik.Image(16, 16);
+        for (var y = 0; y < 16; ++y) {
+            for (var x = 0; x < 16; ++x) {
+                im.setPixel(x, y, new mapnik.Color(x * 17, y * 17, (x * y) % 256));
+            }
+        }
+        var buffer = im.encodeSync('png8', {palette: pal});
+        var decoded = new mapnik.Image.fromBytesSync(buffer);
+        for (var y = 0; y < 16; ++y) {
+            for (var x = 0; x < 16; ++x) {
+                var r = x * 17, g = y * 17, b = (x * y) % 256;
+                var best = 0;
+                var best_d = Infinity;
+                colors.forEach(function(c, i) {
+                    var d = (c[0]-r)*(c[0]-r) + (c[1]-g)*(c[1]-g) + (c[2]-b)*(c[2]-b);
+                    if (d < best_d) { best_d = d; best = i; }
+                });
+                var pixel = decoded.getPixel(x, y);
+                assert.deepEqual([pixel.r, pixel.g, pixel.b, pixel.a], colors[best].concat(255));
+            }
+        }
+        // the lookup is shared so every encode of the image agrees
+        assert.equal(im.view(0, 0, 16, 16).encodeSync('png8', {palette: pal}).toString('hex'), buffer.toString('hex'));
+        im.encode('png8', {palette: pal}, function(err, async_buffer) {
+            if (err) throw err;
+            assert.equal(async_buffer.toString('hex'), buffer.toString('hex'));
+            done();
+        });
+    });
+
+    it('should encode transparent pixels through the tRNS entries', function() {
+        var pal = new mapnik.Palette('\x00\x00\x00\x00\xff\x00\x00\xff\x00\x00\xff\xff');
+        var im = new mapnik.Image(16, 16);
+        for (var x = 0; x < 16; ++x) {
+            im.setPixel(x, 4, new mapnik.Color('red'));
+            im.setPixel(x, 8, new mapnik.Color(0, 0, 255));
+            // transparent but not zero still picks the transparent entry
+            im.setPixel(x, 12, new mapnik.Color(0, 255, 0, 0));
+        }
+        var buffer = im.encodeSync('png8', {palette: pal});
+        assert.notEqual(buffer.toString('binary').indexOf('tRNS'), -1);
+        var decoded = new mapnik.Image.fromBytesSync(buffer);
+        for (var x = 0; x < 16; ++x) {
+            [0, 12, 15].forEach(function(y) {
+                assert.equal(decoded.getPixel(x, y).a, 0);
+            });
+            var red = decoded.getPixel(x, 4);
+            assert.deepEqual([red.r, red.g, red.b, red.a], [255, 0, 0, 255]);
+            var blue = decoded.getPixel(x, 8);
+            assert.deepEqual([blue.r, blue.g, blue.b, blue.a], [0, 0, 255, 255]);
+        }
+    });
+
     it('should support rendering', function() {
         var map = new mapnik.Map(600, 400);
         map.fromStringSync(fs.readFileSync('./test/stylesheet.xml', 'utf8'), { strict: true, base: './test/' });
@@ -1,6 +1,7 @@
 var mapnik = require('../');
 var assert = require('assert');
 var exists = require('fs').existsSync || require('path').existsSync;
+var mercator = new(require('sphericalmercator'));
 
 describe('mapnik async rendering', function() {
     it('should render to a file', function(done) {
@@ -13,6 +14,27 @@ describe('mapnik async rendering', function() {
         });
     });
 
+    it('should render to a png file on several threads', function(done) {
+        var map = new mapnik.Map(600, 400);
+        map.load('./test/stylesheet.xml', function(err, map) {
+            if (err) throw err;
+            map.zoomAll();
+            var filename = './test/tmp/renderFile-threads.png';
+            // png32: newer mapnik writes plain .png itself
+            map.renderFile(filename, {format: 'png32', threads: 4}, function(err) {
+                if (err) throw err;
+                var im = new mapnik.Image(map.width, map.height);
+                map.render(im, function(err, im) {
+                    if (err) throw err;
+                    var from_file = mapnik.Image.openSync(filename);
+                    assert.equal(from_file.encodeSync('png32').toString('hex'), im.encodeSync('png32').toString('hex'));
+                    assert.throws(function() { map.renderFile(filename, {threads: 0}, function() {}); });
+                    done();
+                });
+            });
+        });
+    });
+
     it('should render to an image', function(done) {
         var map = new mapnik.Map(256, 256);
         map.load('./test/stylesheet.xml', function(err,map) {
@@ -27,4 +49,162 @@ describe('mapnik async rendering', function() {
             });
         });
     });
+
+    it('should render the same image with a render context', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            map.zoomAll();
+            var expected = new mapnik.Image(map.width, map.height);
+            map.render(expected, function(err, expected) {
+                if (err) throw err;
+                map.renderContext = true;
+                var im = new mapnik.Image(map.width, map.height);
+                map.render(im, function(err, im) {
+                    if (err) throw err;
+                    // second render reuses the cached projection
+                    var im2 = new mapnik.Image(map.width, map.height);
+                    map.render(im2, function(err, im2) {
+                        if (err) throw err;
+                        assert.equal(im.encodeSync('png').length, expected.encodeSync('png').length);
+                        assert.equal(im2.encodeSync('png').length, expected.encodeSync('png').length);
+                        done();
+                    });
+                });
+            });
+        });
+    });
+
+    it('should render a tile by z/x/y without changing the map extent', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            map.zoomAll();
+            var original_extent = map.extent;
+            map.renderTile(1, 1, 0, new mapnik.Image(256, 256), function(err, im) {
+                if (err) throw err;
+                assert.deepEqual(map.extent, original_extent);
+                map.extent = mercator.bbox(1, 0, 1, false, '900913');
+                map.render(new mapnik.Image(256, 256), function(err, expected) {
+                    if (err) throw err;
+                    assert.equal(im.encodeSync('png').length, expected.encodeSync('png').length);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should throw with invalid renderTile usage', function() {
+        var map = new mapnik.Map(256, 256, '+init=epsg:3857');
+        var im = new mapnik.Image(256, 256);
+        assert.throws(function() { map.renderTile(0, 0, im, function(err, im) {}); });
+        assert.throws(function() { map.renderTile('0', 0, 0, im, function(err, im) {}); });
+        assert.throws(function() { map.renderTile(-1, 0, 0, im, function(err, im) {}); });
+        assert.throws(function() { map.renderTile(1, 2, 0, im, function(err, im) {}); });
+        assert.throws(function() { map.renderTile(0, 0, 0, {}, function(err, im) {}); });
+        // tile extents are spherical mercator
+        var latlong_map = new mapnik.Map(256, 256, '+proj=latlong +datum=WGS84');
+        assert.throws(function() { latlong_map.renderTile(0, 0, 0, im, function(err, im) {}); });
+    });
+
+    it('should report empty renders with skip_empty', function(done) {
+        var empty_map = new mapnik.Map(256, 256);
+        empty_map.background = new mapnik.Color('green');
+        empty_map.render(new mapnik.Image(256, 256), {skip_empty: true}, function(err, im, empty) {
+            if (err) throw err;
+            assert.equal(empty, true);
+            var pixel = im.getPixel(0, 0);
+            assert.equal(pixel.g, 128);
+            assert.equal(pixel.a, 255);
+            var map = new mapnik.Map(256, 256);
+            map.load('./test/stylesheet.xml', function(err,map) {
+                if (err) throw err;
+                map.zoomAll();
+                map.render(new mapnik.Image(256, 256), {skip_empty: true}, function(err, im, empty) {
+                    if (err) throw err;
+                    assert.equal(empty, false);
+                    // empty is passed, and false, without skip_empty too
+                    empty_map.render(new mapnik.Image(256, 256), function(err, im, empty) {
+                        if (err) throw err;
+                        assert.strictEqual(empty, false);
+                        done();
+                    });
+                });
+            });
+        });
+    });
+
+    it('should throw with skip_empty on grids and vector tiles', function() {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        assert.throws(function() { map.render(new mapnik.Grid(256, 256), {layer: 0, skip_empty: true}, function(err, grid) {}); });
+        assert.throws(function() { map.render(new mapnik.VectorTile(0, 0, 0), {skip_empty: true}, function(err, vtile) {}); });
+    });
+
+    it('should render several scales from one query', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            map.zoomAll();
+            map.renderScales('png', {scales: [1, 2]}, function(err, buffers) {
+                if (err) throw err;
+                assert.equal(buffers.length, 2);
+                var im1 = mapnik.Image.fromBytesSync(buffers[0]);
+                var im2 = mapnik.Image.fromBytesSync(buffers[1]);
+                assert.equal(im1.width(), 256);
+                assert.equal(im1.height(), 256);
+                assert.equal(im2.width(), 512);
+                assert.equal(im2.height(), 512);
+                done();
+            });
+        });
+    });
+
+    it('should scale an explicit scale_denominator per scale', function(done) {
+        var map = new mapnik.Map(256, 256);
+        // the fill only applies up to 1:1500, so 1:1000 at scale 1 but not 1:2000 at scale 2
+        map.fromStringSync('<Map srs="+proj=latlong +datum=WGS84">' +
+                           '<Style name="fill"><Rule><MaxScaleDenominator>1500</MaxScaleDenominator>' +
+                           '<PolygonSymbolizer fill="#ff0000" /></Rule></Style></Map>');
+        var l = new mapnik.Layer('box', map.srs);
+        l.styles = ['fill'];
+        l.datasource = new mapnik.Datasource({type: 'csv', 'inline': 'wkt\n"POLYGON((-180 -90,180 -90,180 90,-180 90,-180 -90))"'});
+        map.add_layer(l);
+        map.extent = [-90, -45, 90, 45];
+        map.renderScales('png', {scales: [1, 2], scale_denominator: 1000}, function(err, buffers) {
+            if (err) throw err;
+            var p1 = mapnik.Image.fromBytesSync(buffers[0]).getPixel(128, 128);
+            var p2 = mapnik.Image.fromBytesSync(buffers[1]).getPixel(256, 256);
+            assert.equal(p1.r, 255);
+            assert.equal(p1.a, 255);
+            assert.equal(p2.a, 0);
+            done();
+        });
+    });
+
+    it('should report the formats picked for auto renderScales', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            map.zoomAll();
+            map.renderScales('auto', {scales: [1, 2]}, function(err, buffers, formats) {
+                if (err) throw err;
+                assert.equal(buffers.length, 2);
+                assert.equal(formats.length, 2);
+                formats.forEach(function(format) {
+                    assert.ok(['png8', 'png32', 'jpeg'].indexOf(format) != -1);
+                });
+                done();
+            });
+        });
+    });
+
+    it('should throw with invalid renderScales usage', function() {
+        var map = new mapnik.Map(256, 256);
+        assert.throws(function() { map.renderScales('png', function(err, buffers) {}); });
+        assert.throws(function() { map.renderScales('png', {}, function(err, buffers) {}); });
+        assert.throws(function() { map.renderScales('png', {scales: []}, function(err, buffers) {}); });
+        assert.throws(function() { map.renderScales('png', {scales: [0]}, function(err, buffers) {}); });
+        assert.throws(function() { map.renderScales('png', {scales: ['2x']}, function(err, buffers) {}); });
+    });
 });
@@ -13,4 +13,25 @@ describe('mapnik sync rendering ', function() {
         map.renderFileSync(filename);
         assert.ok(exists(filename));
     });
+
+    it('should return a blank tile when nothing can paint', function() {
+        var map = new mapnik.Map(256, 256);
+        map.background = new mapnik.Color('green');
+        var expected = map.renderSync('png');
+        mapnik.clearCache();
+        var buffer = map.renderSync('png', {skip_empty: true});
+        assert.equal(buffer.toString('hex'), expected.toString('hex'));
+        var stats = mapnik.solidTileCacheStats();
+        assert.equal(stats.entries, 1);
+        // second call is served from the solid tile cache
+        buffer = map.renderSync('png', {skip_empty: true});
+        assert.equal(buffer.toString('hex'), expected.toString('hex'));
+        assert.equal(mapnik.solidTileCacheStats().hits, stats.hits + 1);
+        mapnik.clearCache();
+        assert.equal(mapnik.solidTileCacheStats().entries, 0);
+        var pal = new mapnik.Palette('\x00\x80\x00\xff\xff\xff\xff\xff');
+        assert.equal(map.renderSync('png', {skip_empty: true, palette: pal}).toString('hex'),
+                     map.renderSync('png', {palette: pal}).toString('hex'));
+        assert.throws(function() { map.renderSync('png', {skip_empty: 1}); });
+    });
 });
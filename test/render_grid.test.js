@@ -155,4 +155,76 @@ describe('mapnik grid rendering ', function() {
         });
     });
 
+    it('should render an array of layers into one grid', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync(stylesheet, {strict: true});
+        map.zoomAll();
+        var grid = new mapnik.Grid(map.width, map.height, {key: '__id__'});
+        var options = {'layer': ['world'],
+                       'fields': ['NAME']
+                      };
+        map.render(grid, options, function(err, grid) {
+            if (err) throw err;
+            var grid_utf = grid.encodeSync('utf', {resolution: 4});
+            assert.equal(JSON.stringify(grid_utf), reference);
+            done();
+        });
+    });
+
+    it('should render a layer named twice in an array once', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync(stylesheet, {strict: true});
+        map.zoomAll();
+        var grid = new mapnik.Grid(map.width, map.height, {key: '__id__'});
+        map.render(grid, {layer: ['world', 0], fields: ['NAME']}, function(err, grid) {
+            if (err) throw err;
+            var grid_utf = grid.encodeSync('utf', {resolution: 4});
+            assert.equal(JSON.stringify(grid_utf), reference);
+            done();
+        });
+    });
+
+    it('should keep the features of two layers sharing a feature id apart', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.fromStringSync('<Map srs="+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over">' +
+                           '<Style name="fill"><Rule><PolygonSymbolizer /></Rule></Style></Map>');
+        // both datasources number their single feature 1
+        var halves = {
+            west: 'POLYGON((-20000000 -10000000,-1000000 -10000000,-1000000 10000000,-20000000 10000000,-20000000 -10000000))',
+            east: 'POLYGON((1000000 -10000000,20000000 -10000000,20000000 10000000,1000000 10000000,1000000 -10000000))'
+        };
+        Object.keys(halves).forEach(function(name) {
+            var l = new mapnik.Layer(name, map.srs);
+            l.styles = ['fill'];
+            l.datasource = new mapnik.Datasource({type: 'csv', 'inline': 'wkt,name\n"' + halves[name] + '",' + name});
+            map.add_layer(l);
+        });
+        map.extent = [-20037508.34, -20037508.34, 20037508.34, 20037508.34];
+        map.render(new mapnik.Grid(256, 256), {layer: 'west'}, function(err, grid) {
+            if (err) throw err;
+            assert.equal(grid.painted(), true);
+            map.render(new mapnik.Grid(256, 256), {layer: ['west', 'east'], fields: ['name']}, function(err, grid) {
+                if (err) throw err;
+                var utf = grid.encodeSync('utf');
+                var keys = utf.keys.filter(function(k) { return k !== ''; });
+                assert.equal(keys.length, 2);
+                assert.notEqual(keys[0], keys[1]);
+                var names = keys.map(function(k) { return utf.data[k].name; }).sort();
+                assert.deepEqual(names, ['east', 'west']);
+                done();
+            });
+        });
+    });
+
+    it('should throw with an invalid array of layers', function() {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync(stylesheet, {strict: true});
+        map.zoomAll();
+        var grid = new mapnik.Grid(map.width, map.height, {key: '__id__'});
+        assert.throws(function() { map.render(grid, {layer: []}, function(err, grid) {}); });
+        assert.throws(function() { map.render(grid, {layer: [0, 'doesnotexist']}, function(err, grid) {}); });
+        assert.throws(function() { map.render(grid, {layer: [0, 1]}, function(err, grid) {}); });
+        assert.throws(function() { map.render(grid, {layer: [[0]]}, function(err, grid) {}); });
+    });
+
 });
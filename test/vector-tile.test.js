@@ -343,6 +343,53 @@ describe('mapnik.VectorTile ', function() {
         });
     });
 
+    it('should render a grid from an array of layers', function(done) {
+        var vtile = new mapnik.VectorTile(0, 0, 0);
+        vtile.setData(fs.readFileSync('./test/data/vector_tile/tile0.vector.pbf'));
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.extent = [-20037508.34, -20037508.34, 20037508.34, 20037508.34];
+        vtile.render(map, new mapnik.Grid(256, 256), {layer:['world']}, function(err, vtile_image) {
+            if (err) throw err;
+            var utf = vtile_image.encodeSync('utf');
+            var expected = JSON.parse(fs.readFileSync('./test/data/vector_tile/tile0.expected.grid.json'));
+            assert.deepEqual(utf,expected)
+            done();
+        });
+    });
+
+    it('should keep the features of two layers sharing a feature id apart', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.fromStringSync('<Map srs="+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over">' +
+                           '<Style name="fill"><Rule><PolygonSymbolizer /></Rule></Style></Map>');
+        // both datasources number their single feature 1
+        var halves = {
+            west: 'POLYGON((-20000000 -10000000,-1000000 -10000000,-1000000 10000000,-20000000 10000000,-20000000 -10000000))',
+            east: 'POLYGON((1000000 -10000000,20000000 -10000000,20000000 10000000,1000000 10000000,1000000 -10000000))'
+        };
+        Object.keys(halves).forEach(function(name) {
+            var l = new mapnik.Layer(name, map.srs);
+            l.styles = ['fill'];
+            l.datasource = new mapnik.Datasource({type: 'csv', 'inline': 'wkt,name\n"' + halves[name] + '",' + name});
+            map.add_layer(l);
+        });
+        map.extent = [-20037508.34, -20037508.34, 20037508.34, 20037508.34];
+        var vtile = new mapnik.VectorTile(0, 0, 0);
+        map.render(vtile, {}, function(err, vtile) {
+            if (err) throw err;
+            vtile.render(map, new mapnik.Grid(256, 256), {layer: ['west', 'east'], fields: ['name']}, function(err, grid) {
+                if (err) throw err;
+                var utf = grid.encodeSync('utf');
+                var keys = utf.keys.filter(function(k) { return k !== ''; });
+                assert.equal(keys.length, 2);
+                assert.notEqual(keys[0], keys[1]);
+                var names = keys.map(function(k) { return utf.data[k].name; }).sort();
+                assert.deepEqual(names, ['east', 'west']);
+                done();
+            });
+        });
+    });
+
     it('should be able to query features from vector tile', function(done) {
         var data = fs.readFileSync("./test/data/vector_tile/tile3.vector.pbf");
         var vtile = new mapnik.VectorTile(5,28,12);